@@ -6,6 +6,61 @@
 #include "matrix3.h"
 #include "matrix4.h"
 
+class LiMappedFile;
+
+/**
+ * @brief
+ * 只读数组视图，直接指向BinaryAccessor的数据，不复制内存。
+ * 视图内部持有数据的QByteArray引用；数据来自内存映射文件时同时持有LiMappedFile，
+ * 视图有效期间映射不会被解除。
+ */
+template<typename T>
+class LiArrayView
+{
+public:
+    LiArrayView()
+        : m_data(nullptr)
+        , m_size(0)
+    {
+    }
+
+    LiArrayView(const QByteArray &storage, const T *data, int size,
+                const QSharedPointer<LiMappedFile> &mapping = QSharedPointer<LiMappedFile>())
+        : m_storage(storage)
+        , m_mapping(mapping)
+        , m_data(data)
+        , m_size(size)
+    {
+    }
+
+    bool isMapped() const { return !m_mapping.isNull(); }
+
+    const T *data() const { return m_data; }
+    const T *constData() const { return m_data; }
+    int size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+
+    const T &operator [](int i) const { return m_data[i]; }
+    const T &at(int i) const { return m_data[i]; }
+
+    const T *begin() const { return m_data; }
+    const T *end() const { return m_data + m_size; }
+
+    QVector<T> toVector() const
+    {
+        QVector<T> result(m_size);
+        if (m_size)
+            memcpy(result.data(), m_data, sizeof(T)*m_size);
+        return result;
+    }
+
+private:
+    QByteArray m_storage;
+    QSharedPointer<LiMappedFile> m_mapping;
+    const T *m_data;
+    int m_size;
+};
+
 /**
  * @brief
  * BinaryAccessor描述如何从一块内存中读取为特定类型的数据，
@@ -82,6 +137,17 @@ public:
     template<typename T>
     QVector<T> createArrayBufferView(int count) const;
 
+    /**
+     * @brief
+     * 与createArrayBufferView相同，但不复制数据。
+     * 只有在数据长度不足或地址未按T对齐时才会复制。
+     * @param count
+     * @param mapping 数据来自LiMappedBuffer::data()时传入LiMappedBuffer::file()，由视图持有
+     * @return LiArrayView<T>
+     */
+    template<typename T>
+    LiArrayView<T> createArrayView(int count, const QSharedPointer<LiMappedFile> &mapping = QSharedPointer<LiMappedFile>()) const;
+
     /**
      * @brief
      *
@@ -130,6 +196,23 @@ QVector<T> BinaryAccessor::createArrayBufferView(int count) const
     return result;
 }
 
+template<typename T>
+LiArrayView<T> BinaryAccessor::createArrayView(int count, const QSharedPointer<LiMappedFile> &mapping) const
+{
+    const char *data = m_binary.constData() + m_byteOffset;
+    int available = m_binary.size() - m_byteOffset;
+    if (available >= int(sizeof(T))*count && quintptr(data) % alignof(T) == 0) {
+        return LiArrayView<T>(m_binary, reinterpret_cast<const T *>(data), count, mapping);
+    }
+
+    QByteArray copy(int(sizeof(T))*count, 0);
+    int copyCount = std::min(available, copy.size());
+    if (copyCount > 0) {
+        memcpy(copy.data(), data, copyCount);
+    }
+    return LiArrayView<T>(copy, reinterpret_cast<const T *>(copy.constData()), count);
+}
+
 /**
  * @brief
  *
@@ -0,0 +1,490 @@
+#ifndef CAMERAPREFETCH_H
+#define CAMERAPREFETCH_H
+
+#include "licore_global.h"
+#include "limath.h"
+#include "vector3.h"
+#include "cartesian3.h"
+#include "perspectivefrustum.h"
+#include "cullingvolume.h"
+#include "cullingbatch.h"
+#include "orientedboundingbox.h"
+#include "tilingscheme.h"
+#include "terrainprovider.h"
+#include "imageryprovider.h"
+#include "li3dtilearena.h"
+#include "lirequest.h"
+#include "requestscheduler.h"
+#include <cmath>
+#include <functional>
+
+/**
+ * @brief
+ * 按摄像机的未来路径预取地形、影像和3DTiles数据。
+ * 对飞行路径的采样点（flyTo的目标点优先）以及自由浏览时按速度外推的位置，
+ * 在不修改场景状态的前提下按与QuadtreePrimitive、Li3DTileset相同的屏幕空间误差规则预测需要的瓦片，
+ * 通过RequestScheduler以低优先级请求。数据加载时通过take()取走已预取的请求并提升优先级；
+ * 路径改变后不再需要、且自上一次刷新以来没有通过markVisible()标记的请求会被移除，未完成的同时取消。
+ * RequestScheduler中优先级数值越小越先处理。
+ */
+class CameraPrefetch
+{
+public:
+    struct Pose
+    {
+        Vector3 position;
+        Vector3 direction;
+        Vector3 up;
+    };
+
+    /**
+     * @brief
+     * 飞行路径，t从0到1
+     */
+    typedef std::function<Pose(double t)> PathFunction;
+    typedef std::function<QUrl(int x, int y, int level)> UrlFunction;
+
+    /**
+     * @brief
+     * 四叉树瓦片数据源，地形和影像都用它描述
+     */
+    struct QuadtreeLayer
+    {
+        LiRequest::RequestType type = LiRequest::TERRAIN;
+        TilingScheme *tilingScheme = nullptr;
+        std::function<double(int level)> geometricError;
+        std::function<bool(int x, int y, int level)> available;
+        UrlFunction url;
+        int minimumLevel = 0;
+        int maximumLevel = 18;
+        double minimumHeight = 0.0;
+        double maximumHeight = 0.0;
+    };
+
+    struct TilesetLayer
+    {
+        const Li3DTileArena *arena = nullptr;
+        QUrl baseUrl;
+        double maximumScreenSpaceError = 16.0;
+    };
+
+    /**
+     * @brief
+     * 预取请求的优先级，加上预测顺序后仍大于可见瓦片的优先级
+     */
+    enum
+    {
+        PrefetchPriority = 100000000
+    };
+
+    CameraPrefetch()
+        : m_sseDenominator(1.0)
+        , m_maximumScreenSpaceError(2.0)
+        , m_maximumRequests(256)
+        , m_refreshInterval(0.25)
+        , m_lastTime(-1.0)
+        , m_lastRefreshTime(-1.0)
+        , m_hasVelocity(false)
+        , m_refreshCount(0)
+    {
+        m_horizons << 0.5 << 1.0 << 2.0;
+    }
+
+    ~CameraPrefetch()
+    {
+        cancelAll();
+    }
+
+    /**
+     * @brief
+     * 设置视锥，sseDenominator为屏幕高度 / (2 * tan(fovy / 2))，即LiCamera::sseDenominator()
+     */
+    void setFrustum(const PerspectiveFrustum &frustum, double sseDenominator)
+    {
+        m_frustum = frustum;
+        m_sseDenominator = sseDenominator;
+    }
+
+    /**
+     * @brief
+     * 地形和影像的最大屏幕空间误差，与QuadtreePrimitive保持一致
+     */
+    void setMaximumScreenSpaceError(double error) { m_maximumScreenSpaceError = error; }
+
+    /**
+     * @brief
+     * 同时存在的预取请求数量上限
+     */
+    int maximumRequests() const { return m_maximumRequests; }
+    void setMaximumRequests(int count) { m_maximumRequests = count; }
+
+    /**
+     * @brief
+     * 自由浏览时外推的时间，单位为秒，为空时不外推
+     */
+    void setHorizons(const QVector<double> &horizons) { m_horizons = horizons; }
+
+    int addQuadtreeLayer(const QuadtreeLayer &layer)
+    {
+        m_quadtreeLayers.append(layer);
+        return m_quadtreeLayers.size() - 1;
+    }
+
+    int addTerrainLayer(TerrainProvider *provider, const UrlFunction &url, double maximumHeight = 9000.0)
+    {
+        QuadtreeLayer layer;
+        layer.type = LiRequest::TERRAIN;
+        layer.tilingScheme = provider->tilingScheme();
+        layer.geometricError = [provider](int level) { return provider->getLevelMaximumGeometricError(level); };
+        layer.available = [provider](int x, int y, int level) { return provider->getTileDataAvailable(x, y, level); };
+        layer.url = url;
+        layer.minimumHeight = -500.0;
+        layer.maximumHeight = maximumHeight;
+        return addQuadtreeLayer(layer);
+    }
+
+    int addImageryLayer(ImageryProvider *provider)
+    {
+        QuadtreeLayer layer;
+        layer.type = LiRequest::IMAGERY;
+        layer.tilingScheme = provider->tilingScheme();
+        layer.geometricError = [provider](int level) { return imageryGeometricError(provider, level); };
+        layer.url = [provider](int x, int y, int level) { return provider->buildImageUrl(x, y, level); };
+        layer.minimumLevel = provider->minimumLevel();
+        layer.maximumLevel = provider->maximumLevel();
+        return addQuadtreeLayer(layer);
+    }
+
+    int addTilesetLayer(const Li3DTileArena *arena, const QUrl &baseUrl, double maximumScreenSpaceError = 16.0)
+    {
+        TilesetLayer layer;
+        layer.arena = arena;
+        layer.baseUrl = baseUrl;
+        layer.maximumScreenSpaceError = maximumScreenSpaceError;
+        m_tilesetLayers.append(layer);
+        return m_tilesetLayers.size() - 1;
+    }
+
+    void removeLayers()
+    {
+        m_quadtreeLayers.clear();
+        m_tilesetLayers.clear();
+        cancelAll();
+    }
+
+    /**
+     * @brief
+     * 与LiCamera::flyTo同时调用，按飞行路径预取，目标点最先请求
+     * @param samples 路径上的采样数量，不包括目标点
+     */
+    void setFlightPath(const PathFunction &path, int samples = 8)
+    {
+        m_pathPoses.clear();
+        m_pathPoses.append(path(1.0));
+        for (int i = 1; i <= samples; ++i)
+            m_pathPoses.append(path(double(i) / (samples + 1)));
+        refresh();
+    }
+
+    void setDestination(const Pose &destination)
+    {
+        m_pathPoses.clear();
+        m_pathPoses.append(destination);
+        refresh();
+    }
+
+    /**
+     * @brief
+     * 飞行结束或者被打断时调用，取消尚未完成的路径预取
+     */
+    void clearFlightPath()
+    {
+        m_pathPoses.clear();
+        refresh();
+    }
+
+    /**
+     * @brief
+     * 每帧调用，估计摄像机的速度并按速度外推未来的位置
+     * @param time 当前时间，单位为秒
+     */
+    void updateCamera(const Pose &pose, double time)
+    {
+        if (m_lastTime >= 0.0 && time > m_lastTime)
+        {
+            Vector3 velocity = (pose.position - m_lastPose.position) / (time - m_lastTime);
+            m_velocity = m_hasVelocity ? m_velocity * 0.7 + velocity * 0.3 : velocity;
+            m_hasVelocity = true;
+        }
+        m_lastPose = pose;
+        m_lastTime = time;
+
+        if (m_lastRefreshTime >= 0.0 && time - m_lastRefreshTime < m_refreshInterval)
+            return;
+        m_lastRefreshTime = time;
+
+        m_predictedPoses.clear();
+        if (m_hasVelocity && m_velocity.length() > 1.0)
+        {
+            for (double horizon : m_horizons)
+            {
+                Pose predicted = pose;
+                predicted.position = pose.position + m_velocity * horizon;
+                m_predictedPoses.append(predicted);
+            }
+        }
+        refresh();
+    }
+
+    bool contains(const QUrl &url) const { return m_entries.contains(url.toString()); }
+    int requestCount() const { return m_entries.size(); }
+
+    /**
+     * @brief
+     * 瓦片可见时调用，提升预取请求的优先级。标记只保持到下一次刷新之后，
+     * 瓦片持续可见但没有take()时需要每帧调用
+     */
+    void markVisible(const QUrl &url, double priority = 0.0)
+    {
+        auto it = m_entries.find(url.toString());
+        if (it != m_entries.end())
+        {
+            it->visibleRefresh = m_refreshCount;
+            *it->priority = priority;
+        }
+    }
+
+    /**
+     * @brief
+     * 取走已预取的请求，之后不再由预取管理。请求不存在时返回无效的QFuture，需要正常请求。
+     */
+    QFuture<QByteArray> take(const QUrl &url, double priority = 0.0)
+    {
+        auto it = m_entries.find(url.toString());
+        if (it == m_entries.end())
+            return QFuture<QByteArray>();
+
+        *it->priority = priority;
+        QFuture<QByteArray> future = it->future;
+        m_entries.erase(it);
+        return future;
+    }
+
+    /**
+     * @brief
+     * 由瓦片的几何误差估计影像的几何误差，与地形高度图的估计方法相同
+     */
+    static double imageryGeometricError(ImageryProvider *provider, int level)
+    {
+        TilingScheme *tilingScheme = provider->tilingScheme();
+        double levelZero = tilingScheme->ellipsoid()->maximumRadius() * Math::TWO_PI * 0.25
+                / (qMax(provider->tileWidth(), 1) * tilingScheme->getNumberOfXTilesAtLevel(0));
+        return levelZero / double(1 << level);
+    }
+
+private:
+    struct Candidate
+    {
+        double distance;
+        QUrl url;
+        LiRequest::RequestType type;
+    };
+
+    struct Entry
+    {
+        LiRequest request;
+        QFuture<QByteArray> future;
+        QSharedPointer<double> priority;
+        int visibleRefresh = -2;
+    };
+
+    /**
+     * @brief
+     * 自上一次刷新以来是否调用过markVisible()
+     */
+    bool isVisible(const Entry &entry) const { return entry.visibleRefresh >= m_refreshCount - 1; }
+
+    void refresh()
+    {
+        ++m_refreshCount;
+
+        QVector<Pose> poses = m_pathPoses;
+        poses += m_predictedPoses;
+
+        QVector<Candidate> candidates;
+        QSet<QString> wanted;
+        for (const Pose &pose : poses)
+        {
+            if (candidates.size() >= m_maximumRequests)
+                break;
+
+            QVector<Candidate> poseCandidates;
+            predict(pose, &poseCandidates);
+            std::sort(poseCandidates.begin(), poseCandidates.end(), [](const Candidate &a, const Candidate &b) {
+                return a.distance < b.distance;
+            });
+
+            for (const Candidate &candidate : poseCandidates)
+            {
+                if (candidates.size() >= m_maximumRequests)
+                    break;
+                QString key = candidate.url.toString();
+                if (wanted.contains(key))
+                    continue;
+                wanted.insert(key);
+                candidates.append(candidate);
+            }
+        }
+
+        // 路径改变后不再需要的请求，可见的请求在不再标记后移除，避免一直没有take()的请求累积
+        for (auto it = m_entries.begin(); it != m_entries.end();)
+        {
+            if (!isVisible(*it) && !wanted.contains(it.key()))
+            {
+                if (!it->future.isFinished())
+                    RequestScheduler::instance()->cancelRequest(it->request);
+                it = m_entries.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        for (int i = 0; i < candidates.size(); ++i)
+        {
+            const Candidate &candidate = candidates[i];
+            QString key = candidate.url.toString();
+            auto it = m_entries.find(key);
+            if (it != m_entries.end())
+            {
+                if (!isVisible(*it))
+                    *it->priority = double(PrefetchPriority) + i;
+                continue;
+            }
+
+            Entry entry;
+            entry.priority = QSharedPointer<double>::create(double(PrefetchPriority) + i);
+            QSharedPointer<double> priority = entry.priority;
+            entry.request = LiRequest(QNetworkRequest(candidate.url),
+                                      [priority]() { return *priority; },
+                                      candidate.type);
+            entry.future = RequestScheduler::instance()->request(entry.request);
+            if (entry.future.isCanceled())
+                continue;
+            m_entries.insert(key, entry);
+        }
+    }
+
+    void cancelAll()
+    {
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+        {
+            if (!it->future.isFinished())
+                RequestScheduler::instance()->cancelRequest(it->request);
+        }
+        m_entries.clear();
+    }
+
+    void predict(const Pose &pose, QVector<Candidate> *candidates)
+    {
+        CullingVolume culling = m_frustum.computeCullingVolume(pose.position, pose.direction, pose.up);
+
+        for (const QuadtreeLayer &layer : m_quadtreeLayers)
+        {
+            if (!layer.tilingScheme || !layer.geometricError || !layer.url)
+                continue;
+
+            const int xTiles = layer.tilingScheme->getNumberOfXTilesAtLevel(0);
+            const int yTiles = layer.tilingScheme->getNumberOfYTilesAtLevel(0);
+            for (int y = 0; y < yTiles; ++y)
+            {
+                for (int x = 0; x < xTiles; ++x)
+                    visitQuadtree(layer, culling, pose.position, x, y, 0, candidates);
+            }
+        }
+
+        if (m_tilesetLayers.isEmpty())
+            return;
+
+        CullingBatch batch(culling);
+        Cartesian3 position(pose.position.x(), pose.position.y(), pose.position.z());
+        for (const TilesetLayer &layer : m_tilesetLayers)
+        {
+            if (!layer.arena)
+                continue;
+
+            QVector<int> requested;
+            layer.arena->predictRequests(batch, position, m_sseDenominator, layer.maximumScreenSpaceError, &requested);
+            for (int id : requested)
+            {
+                Candidate candidate;
+                candidate.distance = 0.0;
+                candidate.url = layer.baseUrl.resolved(QUrl(layer.arena->contentUri(id)));
+                candidate.type = LiRequest::TILES3D;
+                candidates->append(candidate);
+            }
+        }
+    }
+
+    /**
+     * @brief
+     * 不创建QuadtreeTile的四叉树遍历，遍历经过的瓦片都需要预取（子瓦片的加载依赖父瓦片）
+     */
+    void visitQuadtree(const QuadtreeLayer &layer, const CullingVolume &culling, const Vector3 &position,
+                       int x, int y, int level, QVector<Candidate> *candidates)
+    {
+        LiRectangle rectangle = layer.tilingScheme->tileXYToRectangle(x, y, level);
+        OrientedBoundingBox box = OrientedBoundingBox::fromRectangle(rectangle, layer.minimumHeight, layer.maximumHeight,
+                                                                     layer.tilingScheme->ellipsoid());
+        if (!culling.isVisible(box))
+            return;
+
+        if (layer.available && !layer.available(x, y, level))
+            return;
+
+        const double distance = qMax(std::sqrt(box.distanceSquaredTo(position)), 1e-7);
+        if (level >= layer.minimumLevel)
+        {
+            Candidate candidate;
+            // 粗层级优先
+            candidate.distance = level * 1.0e9 + distance;
+            candidate.url = layer.url(x, y, level);
+            candidate.type = layer.type;
+            candidates->append(candidate);
+        }
+
+        const double sse = layer.geometricError(level) * m_sseDenominator / distance;
+        if (sse <= m_maximumScreenSpaceError || level >= layer.maximumLevel)
+            return;
+
+        for (int j = 0; j < 2; ++j)
+        {
+            for (int i = 0; i < 2; ++i)
+                visitQuadtree(layer, culling, position, x * 2 + i, y * 2 + j, level + 1, candidates);
+        }
+    }
+
+    PerspectiveFrustum m_frustum;
+    double m_sseDenominator;
+    double m_maximumScreenSpaceError;
+    int m_maximumRequests;
+    double m_refreshInterval;
+    QVector<double> m_horizons;
+
+    QVector<QuadtreeLayer> m_quadtreeLayers;
+    QVector<TilesetLayer> m_tilesetLayers;
+
+    QVector<Pose> m_pathPoses;
+    QVector<Pose> m_predictedPoses;
+    Pose m_lastPose;
+    double m_lastTime;
+    double m_lastRefreshTime;
+    Vector3 m_velocity;
+    bool m_hasVelocity;
+    int m_refreshCount;
+
+    QHash<QString, Entry> m_entries;
+};
+
+#endif // CAMERAPREFETCH_H
@@ -0,0 +1,408 @@
+#ifndef CULLINGBATCH_H
+#define CULLINGBATCH_H
+
+#include "licore_global.h"
+#include "cullingvolume.h"
+#include <cmath>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CULLINGBATCH_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CULLINGBATCH_SSE2 1
+#endif
+
+/**
+ * @brief
+ * 包围球的SoA（structure of arrays）数组，用于批量视锥裁切。
+ */
+struct BoundingSphereBatch
+{
+    std::vector<double> centerX;
+    std::vector<double> centerY;
+    std::vector<double> centerZ;
+    std::vector<double> radius;
+
+    int size() const { return int(radius.size()); }
+
+    void reserve(int n)
+    {
+        centerX.reserve(n);
+        centerY.reserve(n);
+        centerZ.reserve(n);
+        radius.reserve(n);
+    }
+
+    void clear()
+    {
+        centerX.clear();
+        centerY.clear();
+        centerZ.clear();
+        radius.clear();
+    }
+
+    void append(const BoundingSphere &sphere)
+    {
+        centerX.push_back(sphere.center.x());
+        centerY.push_back(sphere.center.y());
+        centerZ.push_back(sphere.center.z());
+        radius.push_back(sphere.radius);
+    }
+};
+
+/**
+ * @brief
+ * 方向包围盒的SoA数组，halfAxes按列存储，axis[c][r]为第c列第r行。
+ */
+struct OrientedBoundingBoxBatch
+{
+    std::vector<double> centerX;
+    std::vector<double> centerY;
+    std::vector<double> centerZ;
+    std::vector<double> axis[3][3];
+
+    int size() const { return int(centerX.size()); }
+
+    void reserve(int n)
+    {
+        centerX.reserve(n);
+        centerY.reserve(n);
+        centerZ.reserve(n);
+        for (int c = 0; c < 3; ++c)
+        {
+            for (int r = 0; r < 3; ++r)
+            {
+                axis[c][r].reserve(n);
+            }
+        }
+    }
+
+    void clear()
+    {
+        centerX.clear();
+        centerY.clear();
+        centerZ.clear();
+        for (int c = 0; c < 3; ++c)
+        {
+            for (int r = 0; r < 3; ++r)
+            {
+                axis[c][r].clear();
+            }
+        }
+    }
+
+    void append(const OrientedBoundingBox &box)
+    {
+        centerX.push_back(box.center.x());
+        centerY.push_back(box.center.y());
+        centerZ.push_back(box.center.z());
+        for (int c = 0; c < 3; ++c)
+        {
+            for (int r = 0; r < 3; ++r)
+            {
+                axis[c][r].push_back(box.halfAxes(r, c));
+            }
+        }
+    }
+};
+
+/**
+ * @brief
+ * 批量视锥裁切，结果与CullingVolume::computeVisibilityWithPlaneMask逐个计算的结果相同。
+ * 构造时复制一次裁切面，之后对N个包围体同时计算所有裁切面，
+ * 启用AVX2时4个包围体一组，只支持SSE2时（包括默认选项的MSVC x64）2个一组，否则使用标量计算。
+ * 4个一组的实现只用到AVX指令，但按AVX2的编译选项启用，与其他SIMD代码的选项保持一致。
+ * 没有使用FMA，保证结果与逐个计算完全相同。
+ * 平面掩码的最高位用于表示MASK_INDETERMINATE，最多支持31个裁切面。
+ */
+class CullingBatch
+{
+public:
+    enum
+    {
+        MaximumPlanes = 31
+    };
+
+    explicit CullingBatch(const CullingVolume &cullingVolume)
+    {
+        const QVector<Plane> planes = cullingVolume.planes();
+        Q_ASSERT_X(planes.size() <= MaximumPlanes, "CullingBatch", "more than 31 planes cannot be encoded in a plane mask");
+        if (planes.size() > MaximumPlanes)
+            qWarning("CullingBatch: %d planes, only the first %d are tested", planes.size(), int(MaximumPlanes));
+        m_planeCount = qMin(planes.size(), int(MaximumPlanes));
+        for (int k = 0; k < m_planeCount; ++k)
+        {
+            const Plane &plane = planes.at(k);
+            m_normalX[k] = plane.normal.x();
+            m_normalY[k] = plane.normal.y();
+            m_normalZ[k] = plane.normal.z();
+            m_distance[k] = plane.distance;
+        }
+    }
+
+    int planeCount() const { return m_planeCount; }
+
+    /**
+     * @brief
+     * 计算包围球的可见性
+     * @param spheres 包围球数组
+     * @param parentPlaneMasks 父节点的平面掩码，为nullptr时视为CullingVolume::MASK_INDETERMINATE
+     * @param planeMasks 输出的平面掩码，长度与spheres相同
+     */
+    void computeVisibilityWithPlaneMask(const BoundingSphereBatch &spheres,
+                                        const uint *parentPlaneMasks,
+                                        uint *planeMasks) const
+    {
+        computeVisibilityWithPlaneMask(spheres, 0, spheres.size(), parentPlaneMasks, planeMasks);
+    }
+
+    /**
+     * @brief
+     * 只计算spheres中[first, first + count)范围内的包围球，
+     * parentPlaneMasks和planeMasks的长度为count
+     */
+    void computeVisibilityWithPlaneMask(const BoundingSphereBatch &spheres,
+                                        int first, int count,
+                                        const uint *parentPlaneMasks,
+                                        uint *planeMasks) const
+    {
+        const double *cx = spheres.centerX.data() + first;
+        const double *cy = spheres.centerY.data() + first;
+        const double *cz = spheres.centerZ.data() + first;
+        const double *r = spheres.radius.data() + first;
+
+        int i = 0;
+#if defined(CULLINGBATCH_AVX2)
+        const __m256d zero = _mm256_setzero_pd();
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m256d x = _mm256_loadu_pd(cx + i);
+            const __m256d y = _mm256_loadu_pd(cy + i);
+            const __m256d z = _mm256_loadu_pd(cz + i);
+            const __m256d radius = _mm256_loadu_pd(r + i);
+            const __m256d negRadius = _mm256_sub_pd(zero, radius);
+
+            uint outside[MaximumPlanes];
+            uint intersecting[MaximumPlanes];
+            for (int k = 0; k < m_planeCount; ++k)
+            {
+                __m256d d = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(m_normalX[k]), x),
+                                          _mm256_mul_pd(_mm256_set1_pd(m_normalY[k]), y));
+                d = _mm256_add_pd(d, _mm256_mul_pd(_mm256_set1_pd(m_normalZ[k]), z));
+                d = _mm256_add_pd(d, _mm256_set1_pd(m_distance[k]));
+                outside[k] = uint(_mm256_movemask_pd(_mm256_cmp_pd(d, negRadius, _CMP_LT_OQ)));
+                intersecting[k] = uint(_mm256_movemask_pd(_mm256_cmp_pd(d, radius, _CMP_LT_OQ)));
+            }
+            resolve(4, i, outside, intersecting, parentPlaneMasks, planeMasks);
+        }
+#elif defined(CULLINGBATCH_SSE2)
+        const __m128d zero = _mm_setzero_pd();
+        for (; i + 2 <= count; i += 2)
+        {
+            const __m128d x = _mm_loadu_pd(cx + i);
+            const __m128d y = _mm_loadu_pd(cy + i);
+            const __m128d z = _mm_loadu_pd(cz + i);
+            const __m128d radius = _mm_loadu_pd(r + i);
+            const __m128d negRadius = _mm_sub_pd(zero, radius);
+
+            uint outside[MaximumPlanes];
+            uint intersecting[MaximumPlanes];
+            for (int k = 0; k < m_planeCount; ++k)
+            {
+                __m128d d = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(m_normalX[k]), x),
+                                       _mm_mul_pd(_mm_set1_pd(m_normalY[k]), y));
+                d = _mm_add_pd(d, _mm_mul_pd(_mm_set1_pd(m_normalZ[k]), z));
+                d = _mm_add_pd(d, _mm_set1_pd(m_distance[k]));
+                outside[k] = uint(_mm_movemask_pd(_mm_cmplt_pd(d, negRadius)));
+                intersecting[k] = uint(_mm_movemask_pd(_mm_cmplt_pd(d, radius)));
+            }
+            resolve(2, i, outside, intersecting, parentPlaneMasks, planeMasks);
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            uint outside[MaximumPlanes];
+            uint intersecting[MaximumPlanes];
+            for (int k = 0; k < m_planeCount; ++k)
+            {
+                double d = m_normalX[k] * cx[i] + m_normalY[k] * cy[i] + m_normalZ[k] * cz[i] + m_distance[k];
+                outside[k] = d < -r[i] ? 1u : 0u;
+                intersecting[k] = d < r[i] ? 1u : 0u;
+            }
+            resolve(1, i, outside, intersecting, parentPlaneMasks, planeMasks);
+        }
+    }
+
+    /**
+     * @brief
+     * 计算方向包围盒的可见性，参数同上
+     */
+    void computeVisibilityWithPlaneMask(const OrientedBoundingBoxBatch &boxes,
+                                        const uint *parentPlaneMasks,
+                                        uint *planeMasks) const
+    {
+        const int count = boxes.size();
+        const double *cx = boxes.centerX.data();
+        const double *cy = boxes.centerY.data();
+        const double *cz = boxes.centerZ.data();
+        const double *a[3][3];
+        for (int c = 0; c < 3; ++c)
+        {
+            for (int r = 0; r < 3; ++r)
+            {
+                a[c][r] = boxes.axis[c][r].data();
+            }
+        }
+
+        int i = 0;
+#if defined(CULLINGBATCH_AVX2)
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d signMask = _mm256_set1_pd(-0.0);
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m256d x = _mm256_loadu_pd(cx + i);
+            const __m256d y = _mm256_loadu_pd(cy + i);
+            const __m256d z = _mm256_loadu_pd(cz + i);
+            __m256d axis[3][3];
+            for (int c = 0; c < 3; ++c)
+            {
+                for (int r = 0; r < 3; ++r)
+                {
+                    axis[c][r] = _mm256_loadu_pd(a[c][r] + i);
+                }
+            }
+
+            uint outside[MaximumPlanes];
+            uint intersecting[MaximumPlanes];
+            for (int k = 0; k < m_planeCount; ++k)
+            {
+                const __m256d nx = _mm256_set1_pd(m_normalX[k]);
+                const __m256d ny = _mm256_set1_pd(m_normalY[k]);
+                const __m256d nz = _mm256_set1_pd(m_normalZ[k]);
+
+                __m256d radEffective = zero;
+                for (int c = 0; c < 3; ++c)
+                {
+                    __m256d p = _mm256_add_pd(_mm256_mul_pd(nx, axis[c][0]), _mm256_mul_pd(ny, axis[c][1]));
+                    p = _mm256_add_pd(p, _mm256_mul_pd(nz, axis[c][2]));
+                    radEffective = _mm256_add_pd(radEffective, _mm256_andnot_pd(signMask, p));
+                }
+
+                __m256d d = _mm256_add_pd(_mm256_mul_pd(nx, x), _mm256_mul_pd(ny, y));
+                d = _mm256_add_pd(d, _mm256_mul_pd(nz, z));
+                d = _mm256_add_pd(d, _mm256_set1_pd(m_distance[k]));
+                outside[k] = uint(_mm256_movemask_pd(_mm256_cmp_pd(d, _mm256_sub_pd(zero, radEffective), _CMP_LE_OQ)));
+                intersecting[k] = uint(_mm256_movemask_pd(_mm256_cmp_pd(d, radEffective, _CMP_LT_OQ)));
+            }
+            resolve(4, i, outside, intersecting, parentPlaneMasks, planeMasks);
+        }
+#elif defined(CULLINGBATCH_SSE2)
+        const __m128d zero = _mm_setzero_pd();
+        const __m128d signMask = _mm_set1_pd(-0.0);
+        for (; i + 2 <= count; i += 2)
+        {
+            const __m128d x = _mm_loadu_pd(cx + i);
+            const __m128d y = _mm_loadu_pd(cy + i);
+            const __m128d z = _mm_loadu_pd(cz + i);
+            __m128d axis[3][3];
+            for (int c = 0; c < 3; ++c)
+            {
+                for (int r = 0; r < 3; ++r)
+                {
+                    axis[c][r] = _mm_loadu_pd(a[c][r] + i);
+                }
+            }
+
+            uint outside[MaximumPlanes];
+            uint intersecting[MaximumPlanes];
+            for (int k = 0; k < m_planeCount; ++k)
+            {
+                const __m128d nx = _mm_set1_pd(m_normalX[k]);
+                const __m128d ny = _mm_set1_pd(m_normalY[k]);
+                const __m128d nz = _mm_set1_pd(m_normalZ[k]);
+
+                __m128d radEffective = zero;
+                for (int c = 0; c < 3; ++c)
+                {
+                    __m128d p = _mm_add_pd(_mm_mul_pd(nx, axis[c][0]), _mm_mul_pd(ny, axis[c][1]));
+                    p = _mm_add_pd(p, _mm_mul_pd(nz, axis[c][2]));
+                    radEffective = _mm_add_pd(radEffective, _mm_andnot_pd(signMask, p));
+                }
+
+                __m128d d = _mm_add_pd(_mm_mul_pd(nx, x), _mm_mul_pd(ny, y));
+                d = _mm_add_pd(d, _mm_mul_pd(nz, z));
+                d = _mm_add_pd(d, _mm_set1_pd(m_distance[k]));
+                outside[k] = uint(_mm_movemask_pd(_mm_cmple_pd(d, _mm_sub_pd(zero, radEffective))));
+                intersecting[k] = uint(_mm_movemask_pd(_mm_cmplt_pd(d, radEffective)));
+            }
+            resolve(2, i, outside, intersecting, parentPlaneMasks, planeMasks);
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            uint outside[MaximumPlanes];
+            uint intersecting[MaximumPlanes];
+            for (int k = 0; k < m_planeCount; ++k)
+            {
+                double radEffective = 0.0;
+                for (int c = 0; c < 3; ++c)
+                {
+                    radEffective += std::abs(m_normalX[k] * a[c][0][i] + m_normalY[k] * a[c][1][i] + m_normalZ[k] * a[c][2][i]);
+                }
+
+                double d = m_normalX[k] * cx[i] + m_normalY[k] * cy[i] + m_normalZ[k] * cz[i] + m_distance[k];
+                outside[k] = d <= -radEffective ? 1u : 0u;
+                intersecting[k] = d < radEffective ? 1u : 0u;
+            }
+            resolve(1, i, outside, intersecting, parentPlaneMasks, planeMasks);
+        }
+    }
+
+private:
+    /**
+     * @brief
+     * outside/intersecting的第j位表示第first+j个包围体对第k个平面的测试结果
+     */
+    void resolve(int lanes, int first,
+                 const uint *outside, const uint *intersecting,
+                 const uint *parentPlaneMasks, uint *planeMasks) const
+    {
+        for (int j = 0; j < lanes; ++j)
+        {
+            const uint parent = parentPlaneMasks ? parentPlaneMasks[first + j] : uint(CullingVolume::MASK_INDETERMINATE);
+            if (parent == uint(CullingVolume::MASK_OUTSIDE) || parent == uint(CullingVolume::MASK_INSIDE))
+            {
+                planeMasks[first + j] = parent;
+                continue;
+            }
+
+            uint mask = CullingVolume::MASK_INSIDE;
+            for (int k = 0; k < m_planeCount; ++k)
+            {
+                const uint flag = 1u << k;
+                if ((parent & flag) == 0)
+                    continue;
+
+                if ((outside[k] >> j) & 1u)
+                {
+                    mask = CullingVolume::MASK_OUTSIDE;
+                    break;
+                }
+
+                if ((intersecting[k] >> j) & 1u)
+                    mask |= flag;
+            }
+            planeMasks[first + j] = mask;
+        }
+    }
+
+    int m_planeCount;
+    double m_normalX[MaximumPlanes];
+    double m_normalY[MaximumPlanes];
+    double m_normalZ[MaximumPlanes];
+    double m_distance[MaximumPlanes];
+};
+
+#endif // CULLINGBATCH_H
@@ -0,0 +1,379 @@
+#ifndef FLATTENMASKINDEX_H
+#define FLATTENMASKINDEX_H
+
+#include "licore_global.h"
+#include <QPolygonF>
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FLATTENMASKINDEX_SSE2 1
+#endif
+
+class LiFlattenMask;
+
+/**
+ * @brief
+ * 压平多边形的点包含测试索引，多边形坐标与FlattenMaskData::normalizedPoints一致（瓦片内归一化坐标）。
+ * 多边形包围盒划分为gridSize x gridSize的格子，没有边经过的格子预先判断为完全在内或完全在外；
+ * 边经过的格子中的点只与所在行的边做射线交叉测试（奇偶规则）。
+ */
+class FlattenMaskIndex
+{
+public:
+    FlattenMaskIndex() {}
+
+    explicit FlattenMaskIndex(const QPolygonF &polygon, int gridSize = 16)
+    {
+        build(polygon, gridSize);
+    }
+
+    bool isEmpty() const { return m_edgeCount == 0; }
+    QRectF boundingRect() const { return QRectF(m_minX, m_minY, m_maxX - m_minX, m_maxY - m_minY); }
+
+    void build(const QPolygonF &polygon, int gridSize = 16)
+    {
+        m_gridSize = qMax(1, gridSize);
+        m_edgeCount = 0;
+        m_rows.assign(m_gridSize + 1, 0);
+        m_x0.clear();
+        m_y0.clear();
+        m_x1.clear();
+        m_y1.clear();
+        m_cells.assign(m_gridSize * m_gridSize, Outside);
+
+        const int n = polygon.size();
+        if (n < 3)
+            return;
+
+        QRectF bounds = polygon.boundingRect();
+        m_minX = bounds.left();
+        m_minY = bounds.top();
+        m_maxX = bounds.right();
+        m_maxY = bounds.bottom();
+        m_cellWidth = qMax(bounds.width(), 1e-12) / m_gridSize;
+        m_cellHeight = qMax(bounds.height(), 1e-12) / m_gridSize;
+
+        // 按行分桶，每条边加入它在y方向覆盖的所有行
+        std::vector<std::vector<int>> rows(m_gridSize);
+        for (int i = 0; i < n; ++i)
+        {
+            const QPointF &a = polygon.at(i);
+            const QPointF &b = polygon.at((i + 1) % n);
+            if (a.y() == b.y())
+            {
+                // 水平边不参与交叉测试，但经过的格子不能整体判断
+                int r0 = row(a.y() - m_cellHeight * 1e-6);
+                int r1 = row(a.y() + m_cellHeight * 1e-6);
+                for (int r = r0; r <= r1; ++r)
+                {
+                    for (int c = column(qMin(a.x(), b.x())); c <= column(qMax(a.x(), b.x())); ++c)
+                    {
+                        m_cells[r * m_gridSize + c] = Boundary;
+                    }
+                }
+                continue;
+            }
+
+            int r0 = row(qMin(a.y(), b.y()));
+            int r1 = row(qMax(a.y(), b.y()));
+            for (int r = r0; r <= r1; ++r)
+            {
+                rows[r].push_back(i);
+            }
+
+            // 标记边经过的格子
+            int c0 = column(qMin(a.x(), b.x()));
+            int c1 = column(qMax(a.x(), b.x()));
+            for (int r = r0; r <= r1; ++r)
+            {
+                for (int c = c0; c <= c1; ++c)
+                {
+                    if (segmentTouchesCell(a, b, r, c))
+                        m_cells[r * m_gridSize + c] = Boundary;
+                }
+            }
+        }
+
+        for (int r = 0; r < m_gridSize; ++r)
+        {
+            m_rows[r] = int(m_x0.size());
+            for (int i : rows[r])
+            {
+                const QPointF &a = polygon.at(i);
+                const QPointF &b = polygon.at((i + 1) % n);
+                m_x0.push_back(a.x());
+                m_y0.push_back(a.y());
+                m_x1.push_back(b.x());
+                m_y1.push_back(b.y());
+            }
+        }
+        m_rows[m_gridSize] = int(m_x0.size());
+        m_edgeCount = n;
+
+        // 没有边经过的格子用中心点判断
+        for (int r = 0; r < m_gridSize; ++r)
+        {
+            for (int c = 0; c < m_gridSize; ++c)
+            {
+                quint8 &cell = m_cells[r * m_gridSize + c];
+                if (cell == Boundary)
+                    continue;
+                double x = m_minX + (c + 0.5) * m_cellWidth;
+                double y = m_minY + (r + 0.5) * m_cellHeight;
+                cell = crossings(x, y, r) & 1 ? Inside : Outside;
+            }
+        }
+    }
+
+    bool contains(double x, double y) const
+    {
+        if (m_edgeCount == 0 || x < m_minX || x > m_maxX || y < m_minY || y > m_maxY)
+            return false;
+
+        int r = row(y);
+        quint8 cell = m_cells[r * m_gridSize + column(x)];
+        if (cell != Boundary)
+            return cell == Inside;
+
+        return crossings(x, y, r) & 1;
+    }
+
+    /**
+     * @brief
+     * 批量测试顶点，把在多边形内的顶点序号按升序写入inside
+     * @param u 顶点的归一化x坐标
+     * @param v 顶点的归一化y坐标
+     */
+    void containedVertices(const double *u, const double *v, int count, QVector<int> *inside) const
+    {
+        inside->clear();
+        if (m_edgeCount == 0)
+            return;
+
+        for (int i = 0; i < count; ++i)
+        {
+            if (contains(u[i], v[i]))
+                inside->append(i);
+        }
+    }
+
+private:
+    enum CellState
+    {
+        Outside = 0,
+        Inside = 1,
+        Boundary = 2
+    };
+
+    int row(double y) const
+    {
+        return qBound(0, int((y - m_minY) / m_cellHeight), m_gridSize - 1);
+    }
+
+    int column(double x) const
+    {
+        return qBound(0, int((x - m_minX) / m_cellWidth), m_gridSize - 1);
+    }
+
+    bool segmentTouchesCell(const QPointF &a, const QPointF &b, int r, int c) const
+    {
+        // 线段与格子（略微扩大）的y范围求交后比较x范围
+        double cy0 = m_minY + r * m_cellHeight - m_cellHeight * 1e-6;
+        double cy1 = m_minY + (r + 1) * m_cellHeight + m_cellHeight * 1e-6;
+        double cx0 = m_minX + c * m_cellWidth - m_cellWidth * 1e-6;
+        double cx1 = m_minX + (c + 1) * m_cellWidth + m_cellWidth * 1e-6;
+
+        double t0 = (qMax(cy0, qMin(a.y(), b.y())) - a.y()) / (b.y() - a.y());
+        double t1 = (qMin(cy1, qMax(a.y(), b.y())) - a.y()) / (b.y() - a.y());
+        double x0 = a.x() + (b.x() - a.x()) * t0;
+        double x1 = a.x() + (b.x() - a.x()) * t1;
+        return qMax(x0, x1) >= cx0 && qMin(x0, x1) <= cx1;
+    }
+
+    /**
+     * @brief
+     * 点向+x方向的射线与所在行的边的交点数
+     */
+    int crossings(double x, double y, int r) const
+    {
+        int i = m_rows[r];
+        const int end = m_rows[r + 1];
+        int count = 0;
+
+#if defined(FLATTENMASKINDEX_SSE2)
+        const __m128d px = _mm_set1_pd(x);
+        const __m128d py = _mm_set1_pd(y);
+        for (; i + 2 <= end; i += 2)
+        {
+            __m128d x0 = _mm_loadu_pd(&m_x0[i]);
+            __m128d y0 = _mm_loadu_pd(&m_y0[i]);
+            __m128d x1 = _mm_loadu_pd(&m_x1[i]);
+            __m128d y1 = _mm_loadu_pd(&m_y1[i]);
+
+            __m128d straddle = _mm_xor_pd(_mm_cmpgt_pd(y0, py), _mm_cmpgt_pd(y1, py));
+            __m128d xi = _mm_add_pd(_mm_div_pd(_mm_mul_pd(_mm_sub_pd(x1, x0), _mm_sub_pd(py, y0)),
+                                               _mm_sub_pd(y1, y0)), x0);
+            __m128d hit = _mm_and_pd(straddle, _mm_cmplt_pd(px, xi));
+            int mask = _mm_movemask_pd(hit);
+            count += (mask & 1) + (mask >> 1);
+        }
+#endif
+
+        for (; i < end; ++i)
+        {
+            if (((m_y0[i] > y) != (m_y1[i] > y))
+                    && x < (m_x1[i] - m_x0[i]) * (y - m_y0[i]) / (m_y1[i] - m_y0[i]) + m_x0[i])
+                ++count;
+        }
+        return count;
+    }
+
+    int m_gridSize = 16;
+    int m_edgeCount = 0;
+    double m_minX = 0.0;
+    double m_minY = 0.0;
+    double m_maxX = 0.0;
+    double m_maxY = 0.0;
+    double m_cellWidth = 1.0;
+    double m_cellHeight = 1.0;
+    std::vector<int> m_rows;
+    std::vector<double> m_x0;
+    std::vector<double> m_y0;
+    std::vector<double> m_x1;
+    std::vector<double> m_y1;
+    std::vector<quint8> m_cells;
+};
+
+/**
+ * @brief
+ * 单个瓦片的增量压平状态。记录每个压平多边形在当前瓦片内包含的顶点，
+ * 多边形修改时只返回包含关系或高度真正变化的顶点，调用者只需重新计算这些顶点。
+ * 多个多边形重叠时，后加入的多边形优先。
+ */
+class FlattenMaskTileState
+{
+public:
+    /**
+     * @brief
+     * 设置或更新多边形
+     * @param mask 压平对象，只用作键
+     * @param polygon 归一化后的多边形，geometryChanged为false时不使用
+     * @param geometryChanged 多边形顶点是否变化，只修改高度时为false
+     * @param height 压平高度
+     * @param u 顶点的归一化x坐标
+     * @param v 顶点的归一化y坐标
+     * @param count 顶点数量（不包括裙边）
+     * @param changed 输出，需要重新计算的顶点，升序
+     */
+    void setMask(LiFlattenMask *mask, const QPolygonF &polygon, bool geometryChanged, double height,
+                 const double *u, const double *v, int count, QVector<int> *changed)
+    {
+        changed->clear();
+
+        int index = indexOf(mask);
+        if (index < 0)
+        {
+            Entry entry;
+            entry.mask = mask;
+            entry.height = height;
+            entry.index.build(polygon);
+            entry.index.containedVertices(u, v, count, &entry.inside);
+            m_entries.push_back(entry);
+            *changed = m_entries.back().inside;
+            return;
+        }
+
+        Entry &entry = m_entries[index];
+        if (geometryChanged)
+        {
+            QVector<int> inside;
+            entry.index.build(polygon);
+            entry.index.containedVertices(u, v, count, &inside);
+
+            if (entry.height != height)
+            {
+                unite(entry.inside, inside, changed);
+            }
+            else
+            {
+                // 高度不变时只有进出多边形的顶点需要更新
+                symmetricDifference(entry.inside, inside, changed);
+            }
+            entry.inside = inside;
+        }
+        else if (entry.height != height)
+        {
+            *changed = entry.inside;
+        }
+        entry.height = height;
+    }
+
+    void removeMask(LiFlattenMask *mask, QVector<int> *changed)
+    {
+        changed->clear();
+        int index = indexOf(mask);
+        if (index < 0)
+            return;
+
+        *changed = m_entries[index].inside;
+        m_entries.erase(m_entries.begin() + index);
+    }
+
+    bool isEmpty() const { return m_entries.empty(); }
+
+    /**
+     * @brief
+     * 顶点的压平高度，不在任何多边形内时返回false
+     */
+    bool flattenedHeight(int vertex, double *height) const
+    {
+        for (auto it = m_entries.rbegin(); it != m_entries.rend(); ++it)
+        {
+            if (std::binary_search(it->inside.constBegin(), it->inside.constEnd(), vertex))
+            {
+                *height = it->height;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Entry
+    {
+        LiFlattenMask *mask = nullptr;
+        double height = 0.0;
+        FlattenMaskIndex index;
+        QVector<int> inside;
+    };
+
+    int indexOf(LiFlattenMask *mask) const
+    {
+        for (int i = 0; i < int(m_entries.size()); ++i)
+        {
+            if (m_entries[i].mask == mask)
+                return i;
+        }
+        return -1;
+    }
+
+    static void unite(const QVector<int> &a, const QVector<int> &b, QVector<int> *result)
+    {
+        result->resize(a.size() + b.size());
+        auto end = std::set_union(a.constBegin(), a.constEnd(), b.constBegin(), b.constEnd(), result->begin());
+        result->resize(int(end - result->begin()));
+    }
+
+    static void symmetricDifference(const QVector<int> &a, const QVector<int> &b, QVector<int> *result)
+    {
+        result->resize(a.size() + b.size());
+        auto end = std::set_symmetric_difference(a.constBegin(), a.constEnd(), b.constBegin(), b.constEnd(), result->begin());
+        result->resize(int(end - result->begin()));
+    }
+
+    std::vector<Entry> m_entries;
+};
+
+#endif // FLATTENMASKINDEX_H
@@ -0,0 +1,352 @@
+#ifndef IMAGERYCACHE_H
+#define IMAGERYCACHE_H
+
+#include "licore_global.h"
+#include <functional>
+#include <vector>
+
+class Imagery;
+
+/**
+ * @brief
+ * 影像切片缓存，替代ImageryLayer中以getImageryCacheKey生成的字符串为键的QHash。
+ * 键为(x, y, level)压缩成的64位整数，使用线性探测的开放寻址散列表，查找时不分配内存。
+ * 引用计数降为0的影像不立即删除，而是放入按字节限制的LRU队列，短时间内再次需要时直接复用，
+ * 超出预算后由最久未使用的开始调用evict回调删除。只在主线程中使用。
+ */
+class ImageryCache
+{
+public:
+    typedef std::function<void(Imagery *)> EvictFunction;
+
+    explicit ImageryCache(qint64 releasedBudgetBytes = qint64(64) * 1024 * 1024)
+        : m_count(0)
+        , m_lruHead(-1)
+        , m_lruTail(-1)
+        , m_freeNode(-1)
+        , m_releasedBytes(0)
+        , m_releasedBudget(releasedBudgetBytes)
+    {
+        m_slots.resize(64);
+    }
+
+    static quint64 makeKey(int x, int y, int level)
+    {
+        return (quint64(level) << 58) | (quint64(y) << 29) | quint64(x);
+    }
+
+    void setEvictFunction(const EvictFunction &evict) { m_evict = evict; }
+
+    qint64 releasedBudget() const { return m_releasedBudget; }
+    void setReleasedBudget(qint64 bytes)
+    {
+        m_releasedBudget = bytes;
+        trim();
+    }
+
+    int count() const { return m_count; }
+    qint64 releasedBytes() const { return m_releasedBytes; }
+
+    /**
+     * @brief
+     * 查找影像，如果在LRU队列中则移出队列，调用者需要增加引用计数
+     */
+    Imagery *acquire(int x, int y, int level)
+    {
+        int slot = findSlot(makeKey(x, y, level));
+        if (slot < 0)
+            return nullptr;
+
+        Slot &s = m_slots[slot];
+        if (s.node >= 0)
+        {
+            unlink(s.node);
+            freeNode(s.node);
+            s.node = -1;
+        }
+        return s.imagery;
+    }
+
+    Imagery *find(int x, int y, int level) const
+    {
+        int slot = findSlot(makeKey(x, y, level));
+        return slot < 0 ? nullptr : m_slots[slot].imagery;
+    }
+
+    void insert(int x, int y, int level, Imagery *imagery)
+    {
+        quint64 key = makeKey(x, y, level);
+        int slot = findSlot(key);
+        if (slot >= 0)
+        {
+            Slot &s = m_slots[slot];
+            if (s.node >= 0)
+            {
+                unlink(s.node);
+                freeNode(s.node);
+                s.node = -1;
+            }
+            s.imagery = imagery;
+            return;
+        }
+
+        if ((m_count + 1) * 4 > int(m_slots.size()) * 3)
+            rehash(int(m_slots.size()) * 2);
+
+        size_t mask = m_slots.size() - 1;
+        size_t i = hash(key) & mask;
+        while (m_slots[i].key != EmptyKey)
+            i = (i + 1) & mask;
+
+        m_slots[i].key = key;
+        m_slots[i].imagery = imagery;
+        m_slots[i].node = -1;
+        ++m_count;
+    }
+
+    /**
+     * @brief
+     * 影像引用计数降为0时调用，放入LRU队列而不是立即删除
+     * @param bytes 影像占用的内存，用于限制队列大小
+     */
+    void release(int x, int y, int level, qint64 bytes)
+    {
+        quint64 key = makeKey(x, y, level);
+        int slot = findSlot(key);
+        if (slot < 0)
+            return;
+
+        Slot &s = m_slots[slot];
+        if (s.node >= 0)
+            unlink(s.node);
+        else
+            s.node = allocateNode();
+
+        Node &node = m_nodes[s.node];
+        node.key = key;
+        node.bytes = bytes;
+        pushFront(s.node);
+        trim();
+    }
+
+    /**
+     * @brief
+     * 从缓存中移除，不调用evict回调
+     */
+    Imagery *remove(int x, int y, int level)
+    {
+        int slot = findSlot(makeKey(x, y, level));
+        if (slot < 0)
+            return nullptr;
+        return removeSlot(slot);
+    }
+
+    /**
+     * @brief
+     * 删除超出预算的已释放影像
+     */
+    void trim()
+    {
+        while (m_releasedBytes > m_releasedBudget && m_lruTail >= 0)
+        {
+            quint64 key = m_nodes[m_lruTail].key;
+            int slot = findSlot(key);
+            if (slot < 0)
+            {
+                int node = m_lruTail;
+                unlink(node);
+                freeNode(node);
+                continue;
+            }
+
+            Imagery *imagery = removeSlot(slot);
+            if (m_evict && imagery)
+                m_evict(imagery);
+        }
+    }
+
+    /**
+     * @brief
+     * 删除所有已释放的影像
+     */
+    void evictReleased()
+    {
+        qint64 budget = m_releasedBudget;
+        m_releasedBudget = 0;
+        trim();
+        m_releasedBudget = budget;
+    }
+
+    template <typename Func>
+    void forEach(Func func) const
+    {
+        for (const Slot &s : m_slots)
+        {
+            if (s.key != EmptyKey)
+                func(s.imagery);
+        }
+    }
+
+    void clear()
+    {
+        m_slots.assign(64, Slot());
+        m_nodes.clear();
+        m_count = 0;
+        m_lruHead = -1;
+        m_lruTail = -1;
+        m_freeNode = -1;
+        m_releasedBytes = 0;
+    }
+
+private:
+    static const quint64 EmptyKey = ~quint64(0);
+
+    struct Slot
+    {
+        quint64 key = EmptyKey;
+        Imagery *imagery = nullptr;
+        int node = -1;
+    };
+
+    struct Node
+    {
+        quint64 key = 0;
+        qint64 bytes = 0;
+        int prev = -1;
+        int next = -1;
+    };
+
+    static size_t hash(quint64 key)
+    {
+        key ^= key >> 33;
+        key *= Q_UINT64_C(0xff51afd7ed558ccd);
+        key ^= key >> 33;
+        return size_t(key);
+    }
+
+    int findSlot(quint64 key) const
+    {
+        size_t mask = m_slots.size() - 1;
+        size_t i = hash(key) & mask;
+        for (;;)
+        {
+            const Slot &s = m_slots[i];
+            if (s.key == key)
+                return int(i);
+            if (s.key == EmptyKey)
+                return -1;
+            i = (i + 1) & mask;
+        }
+    }
+
+    Imagery *removeSlot(int slot)
+    {
+        Slot &s = m_slots[slot];
+        Imagery *imagery = s.imagery;
+        if (s.node >= 0)
+        {
+            unlink(s.node);
+            freeNode(s.node);
+        }
+
+        // 向后移动删除，不使用墓碑标记
+        size_t mask = m_slots.size() - 1;
+        size_t hole = size_t(slot);
+        size_t i = hole;
+        for (;;)
+        {
+            i = (i + 1) & mask;
+            if (m_slots[i].key == EmptyKey)
+                break;
+
+            size_t home = hash(m_slots[i].key) & mask;
+            bool movable = (i > hole) ? (home <= hole || home > i) : (home <= hole && home > i);
+            if (movable)
+            {
+                m_slots[hole] = m_slots[i];
+                hole = i;
+            }
+        }
+        m_slots[hole] = Slot();
+        --m_count;
+        return imagery;
+    }
+
+    void rehash(int capacity)
+    {
+        std::vector<Slot> old;
+        old.swap(m_slots);
+        m_slots.resize(size_t(capacity));
+
+        size_t mask = m_slots.size() - 1;
+        for (const Slot &s : old)
+        {
+            if (s.key == EmptyKey)
+                continue;
+            size_t i = hash(s.key) & mask;
+            while (m_slots[i].key != EmptyKey)
+                i = (i + 1) & mask;
+            m_slots[i] = s;
+        }
+    }
+
+    int allocateNode()
+    {
+        if (m_freeNode >= 0)
+        {
+            int node = m_freeNode;
+            m_freeNode = m_nodes[node].next;
+            m_nodes[node] = Node();
+            return node;
+        }
+        m_nodes.push_back(Node());
+        return int(m_nodes.size()) - 1;
+    }
+
+    void freeNode(int node)
+    {
+        m_nodes[node].next = m_freeNode;
+        m_freeNode = node;
+    }
+
+    void pushFront(int node)
+    {
+        Node &n = m_nodes[node];
+        n.prev = -1;
+        n.next = m_lruHead;
+        if (m_lruHead >= 0)
+            m_nodes[m_lruHead].prev = node;
+        m_lruHead = node;
+        if (m_lruTail < 0)
+            m_lruTail = node;
+        m_releasedBytes += n.bytes;
+    }
+
+    void unlink(int node)
+    {
+        Node &n = m_nodes[node];
+        if (n.prev >= 0)
+            m_nodes[n.prev].next = n.next;
+        else
+            m_lruHead = n.next;
+        if (n.next >= 0)
+            m_nodes[n.next].prev = n.prev;
+        else
+            m_lruTail = n.prev;
+        n.prev = -1;
+        n.next = -1;
+        m_releasedBytes -= n.bytes;
+    }
+
+    std::vector<Slot> m_slots;
+    std::vector<Node> m_nodes;
+    int m_count;
+    int m_lruHead;
+    int m_lruTail;
+    int m_freeNode;
+    qint64 m_releasedBytes;
+    qint64 m_releasedBudget;
+    EvictFunction m_evict;
+};
+
+#endif // IMAGERYCACHE_H
@@ -0,0 +1,715 @@
+#ifndef LI3DTILEARENA_H
+#define LI3DTILEARENA_H
+
+#include "licore_global.h"
+#include "boundingvolume.h"
+#include "cullingbatch.h"
+#include "cartesian3.h"
+#include "liutils.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+class Li3DTile;
+
+/**
+ * @brief
+ * 3DTiles瓦片树的紧凑表示，用于大数据量瓦片集的遍历。
+ * 每个瓦片只保存遍历需要的数据（世界坐标包围球、几何误差、细化方式、子节点范围、帧号），
+ * 以瓦片id为下标连续存放，同一个父节点的子节点id是连续的（广度优先编号）。
+ * Li3DTile对象只在瓦片需要加载内容时才通过header()创建，并用setTile()关联。
+ */
+class Li3DTileArena
+{
+public:
+    enum Flag
+    {
+        HasContent = 0x01,
+        HasTilesetContent = 0x02,
+        ContentReady = 0x04,
+        ContentFailed = 0x08,
+        Loaded = 0x10           /**< 瓦片数据已插入，流式解析时子节点可能尚未插入 */
+    };
+
+    enum VolumeType
+    {
+        NoVolume = 0,
+        SphereVolume,
+        BoxVolume,
+        RegionVolume
+    };
+
+    enum
+    {
+        MaximumChildCount = 0xffff  /**< Node::childCount的上限 */
+    };
+
+    struct Node
+    {
+        double geometricError = 0.0;
+        qint32 parent = -1;
+        qint32 firstChild = -1;
+        qint32 content = -1;
+        quint16 childCount = 0;
+        quint8 refine = 1; // 0 = ADD, 1 = REPLACE，与Li3DTile::Refine一致
+        quint8 flags = 0;
+        quint32 planeMask = CullingVolume::MASK_OUTSIDE;
+        quint32 visitedFrame = 0;
+        quint32 selectedFrame = 0;
+        quint32 requestedFrame = 0;
+    };
+
+    Li3DTileArena() {}
+
+    int size() const { return int(m_nodes.size()); }
+    bool isEmpty() const { return m_nodes.empty(); }
+    void clear()
+    {
+        m_nodes.clear();
+        m_cold.clear();
+        m_bounds.clear();
+        m_volumes.clear();
+        m_transforms.clear();
+        m_contentUris.clear();
+        m_tiles.clear();
+    }
+
+    const Node &node(int id) const { return m_nodes[id]; }
+    Node &node(int id) { return m_nodes[id]; }
+    const BoundingSphereBatch &bounds() const { return m_bounds; }
+
+    BoundingSphere boundingSphere(int id) const
+    {
+        return BoundingSphere(Vector3(m_bounds.centerX[id], m_bounds.centerY[id], m_bounds.centerZ[id]),
+                              m_bounds.radius[id]);
+    }
+
+    QString contentUri(int id) const
+    {
+        int content = m_nodes[id].content;
+        return content < 0 ? QString() : m_contentUris.at(content);
+    }
+
+    void setContentReady(int id, bool ready)
+    {
+        if (ready)
+            m_nodes[id].flags |= ContentReady;
+        else
+            m_nodes[id].flags &= ~ContentReady;
+    }
+
+    void setContentFailed(int id)
+    {
+        m_nodes[id].flags |= ContentFailed;
+    }
+
+    Li3DTile *tile(int id) const { return m_tiles.value(id, nullptr); }
+    void setTile(int id, Li3DTile *tile)
+    {
+        if (tile)
+            m_tiles.insert(id, tile);
+        else
+            m_tiles.remove(id);
+    }
+    int tileCount() const { return m_tiles.size(); }
+
+    /**
+     * @brief
+     * 从tileset.json的root节点构建瓦片树，返回瓦片数量。
+     * 某个瓦片的子瓦片超过MaximumChildCount时构建失败，返回0
+     * @param root tileset.json中的root对象
+     * @param transform 瓦片集的模型矩阵
+     */
+    int build(const QJsonObject &root, const Matrix4 &transform = Matrix4())
+    {
+        clear();
+        m_modelMatrix = transform;
+
+        struct Pending
+        {
+            QJsonObject json;
+            Matrix4 parentTransform;
+        };
+
+        QVector<Pending> queue;
+        queue.append({root, transform});
+        resize(1);
+
+        // 广度优先编号，保证同一父节点的子节点连续
+        for (int id = 0; id < queue.size(); ++id)
+        {
+            const Pending pending = queue.at(id);
+            const int parent = id == 0 ? -1 : m_nodes[id].parent;
+            Matrix4 computedTransform = setNode(id, parent, pending.json, pending.parentTransform);
+
+            QJsonArray children = pending.json["children"].toArray();
+            if (!children.isEmpty())
+            {
+                const int count = children.size();
+                if (count > MaximumChildCount)
+                {
+                    qWarning() << "Li3DTileArena: too many children" << count;
+                    clear();
+                    return 0;
+                }
+
+                const int first = size();
+                m_nodes[id].firstChild = first;
+                m_nodes[id].childCount = quint16(count);
+
+                resize(first + count);
+                for (int i = 0; i < count; ++i)
+                {
+                    m_nodes[first + i].parent = id;
+                    queue.append({children.at(i).toObject(), computedTransform});
+                }
+            }
+
+            // 释放已处理节点的json
+            queue[id].json = QJsonObject();
+        }
+
+        return size();
+    }
+
+    /**
+     * @brief
+     * 逐个插入瓦片，用于流式解析tileset.json。父节点必须先于子节点插入，
+     * 子节点未全部插入之前，遍历时父节点按叶子节点处理。
+     * @param id 瓦片id
+     * @param parent 父瓦片id，根瓦片为-1
+     * @param firstChild 第一个子瓦片的id，子瓦片的id连续
+     * @param childCount 子瓦片数量
+     * @param tile 不包含children的瓦片json
+     * @return bool 子瓦片超过MaximumChildCount时不插入并返回false
+     */
+    bool insert(int id, int parent, int firstChild, int childCount, const QJsonObject &tile)
+    {
+        if (childCount > MaximumChildCount)
+        {
+            qWarning() << "Li3DTileArena: too many children" << childCount;
+            return false;
+        }
+
+        resize(qMax(size(), qMax(id + 1, childCount > 0 ? firstChild + childCount : 0)));
+
+        Matrix4 parentTransform = parent >= 0 ? computedTransform(parent) : m_modelMatrix;
+        setNode(id, parent, tile, parentTransform);
+        if (childCount > 0)
+        {
+            m_nodes[id].firstChild = firstChild;
+            m_nodes[id].childCount = quint16(childCount);
+        }
+        return true;
+    }
+
+    const Matrix4 &modelMatrix() const { return m_modelMatrix; }
+    void setModelMatrix(const Matrix4 &matrix) { m_modelMatrix = matrix; }
+
+    /**
+     * @brief
+     * 为瓦片生成创建Li3DTile所需的json，transform为计算后的世界矩阵，
+     * 因此创建的Li3DTile不需要父节点即可得到正确的坐标
+     */
+    QJsonObject header(int id) const
+    {
+        const Node &n = m_nodes[id];
+        const Cold &cold = m_cold[id];
+
+        QJsonObject json;
+        json["geometricError"] = n.geometricError;
+        json["refine"] = n.refine == 0 ? QStringLiteral("ADD") : QStringLiteral("REPLACE");
+        json["transform"] = matrix4ToJsonArr(computedTransform(id));
+
+        QJsonArray values;
+        for (int i = 0; i < volumeLength(VolumeType(cold.volumeType)); ++i)
+        {
+            values.append(m_volumes.at(cold.volume + i));
+        }
+
+        QJsonObject boundingVolume;
+        switch (cold.volumeType)
+        {
+        case SphereVolume:
+            boundingVolume["sphere"] = values;
+            break;
+        case BoxVolume:
+            boundingVolume["box"] = values;
+            break;
+        case RegionVolume:
+            boundingVolume["region"] = values;
+            break;
+        default:
+            break;
+        }
+        json["boundingVolume"] = boundingVolume;
+
+        if (n.content >= 0)
+        {
+            QJsonObject content;
+            content["uri"] = m_contentUris.at(n.content);
+            json["content"] = content;
+        }
+
+        return json;
+    }
+
+    /**
+     * @brief
+     * 沿父节点链计算瓦片的世界矩阵，包括build时传入的模型矩阵
+     */
+    Matrix4 computedTransform(int id) const
+    {
+        Matrix4 result;
+        for (int i = id; i >= 0; i = m_nodes[i].parent)
+        {
+            if (m_cold[i].transform >= 0)
+                result = m_transforms.at(m_cold[i].transform) * result;
+        }
+        return m_modelMatrix * result;
+    }
+
+    /**
+     * @brief
+     * 基本的屏幕空间误差遍历，所有子节点的可见性以连续区间批量计算。
+     * @param culling 当前帧的裁切面
+     * @param cameraPosition 摄像机位置
+     * @param sseDenominator 屏幕高度 / (2 * tan(fovy / 2))
+     * @param maximumScreenSpaceError 最大屏幕空间误差
+     * @param frameNumber 当前帧号
+     * @param selected 输出，内容已就绪、需要渲染的瓦片
+     * @param requested 输出，需要请求内容的瓦片，按距离由近到远排列
+     */
+    void selectTiles(const CullingBatch &culling,
+                     const Cartesian3 &cameraPosition,
+                     double sseDenominator,
+                     double maximumScreenSpaceError,
+                     quint32 frameNumber,
+                     QVector<int> *selected,
+                     QVector<int> *requested)
+    {
+        if (m_nodes.empty())
+            return;
+
+        uint rootMask = CullingVolume::MASK_INDETERMINATE;
+        culling.computeVisibilityWithPlaneMask(m_bounds, 0, 1, &rootMask, &m_nodes[0].planeMask);
+        if (m_nodes[0].planeMask == CullingVolume::MASK_OUTSIDE)
+            return;
+
+        QVector<QPair<double, int>> requests;
+        QVarLengthArray<uint, 64> parentMasks;
+        QVarLengthArray<uint, 64> childMasks;
+        std::vector<int> stack;
+        stack.push_back(0);
+
+        while (!stack.empty())
+        {
+            const int id = stack.back();
+            stack.pop_back();
+
+            Node &n = m_nodes[id];
+            n.visitedFrame = frameNumber;
+
+            const double distance = distanceTo(id, cameraPosition);
+            const double sse = n.geometricError * sseDenominator / distance;
+
+            if (n.childCount == 0 || sse <= maximumScreenSpaceError || !childrenLoaded(n))
+            {
+                selectOrRequest(id, distance, frameNumber, selected, &requests);
+                continue;
+            }
+
+            const int first = n.firstChild;
+            const int count = n.childCount;
+            parentMasks.resize(count);
+            childMasks.resize(count);
+            for (int i = 0; i < count; ++i)
+            {
+                parentMasks[i] = n.planeMask;
+            }
+            culling.computeVisibilityWithPlaneMask(m_bounds, first, count, parentMasks.constData(), childMasks.data());
+
+            for (int i = 0; i < count; ++i)
+            {
+                m_nodes[first + i].planeMask = childMasks[i];
+            }
+
+            if (n.refine == 0)
+            {
+                // ADD: 父节点和子节点同时渲染
+                selectOrRequest(id, distance, frameNumber, selected, &requests);
+            }
+            else if (!replacementReady(n, culling, cameraPosition, sseDenominator, maximumScreenSpaceError,
+                                       frameNumber, &requests))
+            {
+                // REPLACE: 替代父节点的瓦片未就绪时继续渲染父节点，replacementReady已请求这些瓦片
+                selectOrRequest(id, distance, frameNumber, selected, &requests);
+                continue;
+            }
+
+            for (int i = count - 1; i >= 0; --i)
+            {
+                if (m_nodes[first + i].planeMask != CullingVolume::MASK_OUTSIDE)
+                    stack.push_back(first + i);
+            }
+        }
+
+        std::sort(requests.begin(), requests.end());
+        for (const auto &request : requests)
+        {
+            requested->append(request.second);
+        }
+    }
+
+    /**
+     * @brief
+     * 预测某个视点需要的瓦片内容，用于预取。遍历规则与selectTiles相同，但不修改节点的可见性和帧号，
+     * 遍历经过的内容未就绪的节点都会输出，按距离由近到远排列。
+     */
+    void predictRequests(const CullingBatch &culling,
+                         const Cartesian3 &cameraPosition,
+                         double sseDenominator,
+                         double maximumScreenSpaceError,
+                         QVector<int> *requested) const
+    {
+        if (m_nodes.empty())
+            return;
+
+        uint rootMask = CullingVolume::MASK_INDETERMINATE;
+        uint mask = 0;
+        culling.computeVisibilityWithPlaneMask(m_bounds, 0, 1, &rootMask, &mask);
+        if (mask == CullingVolume::MASK_OUTSIDE)
+            return;
+
+        QVector<QPair<double, int>> requests;
+        QVarLengthArray<uint, 64> parentMasks;
+        QVarLengthArray<uint, 64> childMasks;
+        std::vector<QPair<int, uint>> stack;
+        stack.push_back(qMakePair(0, mask));
+
+        while (!stack.empty())
+        {
+            const int id = stack.back().first;
+            const uint planeMask = stack.back().second;
+            stack.pop_back();
+
+            const Node &n = m_nodes[id];
+            const double distance = distanceTo(id, cameraPosition);
+            if ((n.flags & HasContent) && !(n.flags & (ContentReady | ContentFailed)))
+                requests.append(qMakePair(distance, id));
+
+            const double sse = n.geometricError * sseDenominator / distance;
+            if (n.childCount == 0 || sse <= maximumScreenSpaceError || !childrenLoaded(n))
+                continue;
+
+            const int first = n.firstChild;
+            const int count = n.childCount;
+            parentMasks.resize(count);
+            childMasks.resize(count);
+            for (int i = 0; i < count; ++i)
+            {
+                parentMasks[i] = planeMask;
+            }
+            culling.computeVisibilityWithPlaneMask(m_bounds, first, count, parentMasks.constData(), childMasks.data());
+
+            for (int i = count - 1; i >= 0; --i)
+            {
+                if (childMasks[i] != CullingVolume::MASK_OUTSIDE)
+                    stack.push_back(qMakePair(first + i, childMasks[i]));
+            }
+        }
+
+        std::sort(requests.begin(), requests.end());
+        for (const auto &request : requests)
+        {
+            requested->append(request.second);
+        }
+    }
+
+    /**
+     * @brief
+     * 估算占用的内存字节数，不包括已创建的Li3DTile
+     */
+    qint64 memoryUsage() const
+    {
+        qint64 bytes = qint64(m_nodes.capacity()) * sizeof(Node)
+                + qint64(m_cold.capacity()) * sizeof(Cold)
+                + qint64(m_bounds.centerX.capacity()) * sizeof(double) * 4
+                + qint64(m_volumes.capacity()) * sizeof(double)
+                + qint64(m_transforms.capacity()) * sizeof(Matrix4);
+        for (const QString &uri : m_contentUris)
+        {
+            bytes += uri.capacity() * sizeof(QChar);
+        }
+        return bytes;
+    }
+
+private:
+    struct Cold
+    {
+        qint32 volume = -1;
+        qint32 transform = -1;
+        quint8 volumeType = NoVolume;
+    };
+
+    /**
+     * @brief
+     * 设置瓦片的遍历数据，返回瓦片的世界矩阵
+     */
+    Matrix4 setNode(int id, int parent, const QJsonObject &json, const Matrix4 &parentTransform)
+    {
+        Matrix4 computedTransform = parentTransform;
+        Cold &cold = m_cold[id];
+        if (json.contains("transform"))
+        {
+            Matrix4 local = jsonArrToMatrix4(json["transform"].toArray());
+            computedTransform = parentTransform * local;
+            cold.transform = m_transforms.size();
+            m_transforms.append(local);
+        }
+
+        Node &n = m_nodes[id];
+        n.parent = parent;
+        n.geometricError = json["geometricError"].toDouble();
+        n.refine = parent >= 0 ? m_nodes[parent].refine : quint8(1);
+        if (json.contains("refine"))
+            n.refine = json["refine"].toString().compare(QLatin1String("ADD"), Qt::CaseInsensitive) == 0 ? 0 : 1;
+        n.flags |= Loaded;
+
+        setBoundingVolume(id, json["boundingVolume"].toObject(), computedTransform);
+
+        if (json.contains("content"))
+        {
+            QJsonObject content = json["content"].toObject();
+            QString uri = content.contains("uri") ? content["uri"].toString() : content["url"].toString();
+            if (!uri.isEmpty())
+            {
+                n.content = m_contentUris.size();
+                n.flags |= HasContent;
+                if (uri.endsWith(QLatin1String(".json"), Qt::CaseInsensitive))
+                    n.flags |= HasTilesetContent;
+                m_contentUris.append(uri);
+            }
+        }
+
+        return computedTransform;
+    }
+
+    bool childrenLoaded(const Node &n) const
+    {
+        for (int i = 0; i < n.childCount; ++i)
+        {
+            if (!(m_nodes[n.firstChild + i].flags & Loaded))
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief
+     * 判断REPLACE细化时可见的子节点能否替代父节点，子节点的planeMask需已计算。
+     * 没有内容的子节点在遍历中会继续细化时，由它的子孙节点检查，避免细化后出现空洞。
+     * 未就绪的瓦片会被请求。
+     */
+    bool replacementReady(const Node &parent,
+                          const CullingBatch &culling,
+                          const Cartesian3 &cameraPosition,
+                          double sseDenominator,
+                          double maximumScreenSpaceError,
+                          quint32 frameNumber,
+                          QVector<QPair<double, int>> *requests)
+    {
+        bool ready = true;
+        std::vector<int> stack;
+        for (int i = parent.childCount - 1; i >= 0; --i)
+        {
+            if (m_nodes[parent.firstChild + i].planeMask != CullingVolume::MASK_OUTSIDE)
+                stack.push_back(parent.firstChild + i);
+        }
+
+        QVarLengthArray<uint, 64> parentMasks;
+        QVarLengthArray<uint, 64> childMasks;
+        while (!stack.empty())
+        {
+            const int id = stack.back();
+            stack.pop_back();
+
+            Node &n = m_nodes[id];
+            const double distance = distanceTo(id, cameraPosition);
+            if (n.flags & HasContent)
+            {
+                if (!(n.flags & (ContentReady | ContentFailed)))
+                {
+                    ready = false;
+                    requestContent(id, distance, frameNumber, requests);
+                }
+                continue;
+            }
+
+            // 没有内容，遍历会停在这里的瓦片本来就不渲染任何内容
+            const double sse = n.geometricError * sseDenominator / distance;
+            if (n.childCount == 0 || sse <= maximumScreenSpaceError)
+                continue;
+
+            if (!childrenLoaded(n))
+            {
+                ready = false;
+                continue;
+            }
+
+            const int first = n.firstChild;
+            const int count = n.childCount;
+            parentMasks.resize(count);
+            childMasks.resize(count);
+            for (int i = 0; i < count; ++i)
+            {
+                parentMasks[i] = n.planeMask;
+            }
+            culling.computeVisibilityWithPlaneMask(m_bounds, first, count, parentMasks.constData(), childMasks.data());
+
+            for (int i = count - 1; i >= 0; --i)
+            {
+                m_nodes[first + i].planeMask = childMasks[i];
+                if (childMasks[i] != CullingVolume::MASK_OUTSIDE)
+                    stack.push_back(first + i);
+            }
+        }
+        return ready;
+    }
+
+    void resize(int n)
+    {
+        reserve(n);
+        m_nodes.resize(n);
+        m_cold.resize(n);
+        while (m_bounds.size() < n)
+        {
+            m_bounds.append(BoundingSphere());
+        }
+    }
+
+    static int volumeLength(VolumeType type)
+    {
+        switch (type)
+        {
+        case SphereVolume: return 4;
+        case BoxVolume: return 12;
+        case RegionVolume: return 6;
+        default: return 0;
+        }
+    }
+
+    void reserve(int n)
+    {
+        if (int(m_nodes.capacity()) < n)
+        {
+            int capacity = qMax(n, int(m_nodes.capacity()) * 2);
+            m_nodes.reserve(capacity);
+            m_cold.reserve(capacity);
+            m_bounds.reserve(capacity);
+        }
+    }
+
+    void setBoundingVolume(int id, const QJsonObject &json, const Matrix4 &transform)
+    {
+        Cold &cold = m_cold[id];
+        QJsonArray values;
+        BoundingSphere sphere;
+
+        if (json.contains("region"))
+        {
+            values = json["region"].toArray();
+            cold.volumeType = RegionVolume;
+            BoundingVolume volume(LiRectangle(values[0].toDouble(), values[1].toDouble(),
+                                              values[2].toDouble(), values[3].toDouble()),
+                                  values[4].toDouble(), values[5].toDouble());
+            sphere = volume.boundingSphere();
+        }
+        else if (json.contains("box"))
+        {
+            values = json["box"].toArray();
+            cold.volumeType = BoxVolume;
+            Vector3 center = transform.map(Vector3(values[0].toDouble(), values[1].toDouble(), values[2].toDouble()));
+            Vector3 corner;
+            for (int c = 0; c < 3; ++c)
+            {
+                corner += transform.mapVector(Vector3(values[3 + c * 3].toDouble(),
+                                                      values[4 + c * 3].toDouble(),
+                                                      values[5 + c * 3].toDouble()));
+            }
+            sphere = BoundingSphere(center, corner.length());
+        }
+        else if (json.contains("sphere"))
+        {
+            values = json["sphere"].toArray();
+            cold.volumeType = SphereVolume;
+            Vector3 center = transform.map(Vector3(values[0].toDouble(), values[1].toDouble(), values[2].toDouble()));
+            double scale = qMax(transform.mapVector(Vector3(1, 0, 0)).length(),
+                                qMax(transform.mapVector(Vector3(0, 1, 0)).length(),
+                                     transform.mapVector(Vector3(0, 0, 1)).length()));
+            sphere = BoundingSphere(center, values[3].toDouble() * scale);
+        }
+
+        if (cold.volumeType != NoVolume)
+        {
+            cold.volume = m_volumes.size();
+            for (int i = 0; i < volumeLength(VolumeType(cold.volumeType)); ++i)
+            {
+                m_volumes.append(values[i].toDouble());
+            }
+        }
+
+        m_bounds.centerX[id] = sphere.center.x();
+        m_bounds.centerY[id] = sphere.center.y();
+        m_bounds.centerZ[id] = sphere.center.z();
+        m_bounds.radius[id] = sphere.radius;
+    }
+
+    double distanceTo(int id, const Cartesian3 &position) const
+    {
+        double dx = m_bounds.centerX[id] - position.x;
+        double dy = m_bounds.centerY[id] - position.y;
+        double dz = m_bounds.centerZ[id] - position.z;
+        double distance = std::sqrt(dx * dx + dy * dy + dz * dz) - m_bounds.radius[id];
+        return qMax(distance, 1e-7);
+    }
+
+    void selectOrRequest(int id, double distance, quint32 frameNumber,
+                         QVector<int> *selected, QVector<QPair<double, int>> *requests)
+    {
+        Node &n = m_nodes[id];
+        if (!(n.flags & HasContent))
+            return;
+
+        if (n.flags & ContentReady)
+        {
+            n.selectedFrame = frameNumber;
+            selected->append(id);
+        }
+        else
+        {
+            requestContent(id, distance, frameNumber, requests);
+        }
+    }
+
+    void requestContent(int id, double distance, quint32 frameNumber, QVector<QPair<double, int>> *requests)
+    {
+        Node &n = m_nodes[id];
+        if (!(n.flags & HasContent) || (n.flags & (ContentReady | ContentFailed)) || n.requestedFrame == frameNumber)
+            return;
+
+        n.requestedFrame = frameNumber;
+        requests->append(qMakePair(distance, id));
+    }
+
+    std::vector<Node> m_nodes;
+    std::vector<Cold> m_cold;
+    BoundingSphereBatch m_bounds;
+    QVector<double> m_volumes;
+    QVector<Matrix4> m_transforms;
+    QStringList m_contentUris;
+    QHash<int, Li3DTile *> m_tiles;
+    Matrix4 m_modelMatrix;
+};
+
+#endif // LI3DTILEARENA_H
@@ -0,0 +1,685 @@
+#ifndef LI3DTILESETSTREAMPARSER_H
+#define LI3DTILESETSTREAMPARSER_H
+
+#include "licore_global.h"
+#include "limappedfile.h"
+#include "asyncfuture.h"
+#include <QtConcurrent>
+
+/**
+ * @brief
+ * tileset.json的流式解析器，在工作线程中直接扫描文件内容，不构建完整的QJsonDocument。
+ * 前eagerLevels层按广度优先解析并立即发布，遍历可以在深层瓦片解析完成前开始；
+ * 更深的子树只记录位置，之后在线程池中并行解析。
+ * 每个瓦片发布为一条Record，包含不带children的瓦片json，同一父节点的子瓦片id连续，
+ * 父瓦片总是先于子瓦片发布，可以直接用于Li3DTileArena::insert。
+ * 根瓦片的属性在扫描其children之前单独发布（rootTile()），不必等待整棵树扫描完成。
+ * json格式错误或嵌套层数超过MaxDepth时停止解析，返回的QFuture为canceled状态，hasError()返回true。
+ */
+class Li3DTilesetStreamParser
+{
+public:
+    enum
+    {
+        MaxDepth = 512 // 瓦片属性中json值的最大嵌套层数，防止恶意输入导致递归栈溢出
+    };
+
+    struct Record
+    {
+        int id = -1;
+        int parent = -1;
+        int depth = 0;
+        int firstChild = -1;
+        int childCount = 0;
+        QJsonObject tile;
+    };
+
+    /**
+     * @brief
+     * 解析耗时统计，单位为毫秒，-1表示尚未到达
+     */
+    struct Timing
+    {
+        qint64 fileLoaded = -1;
+        qint64 rootPublished = -1;
+        qint64 eagerLevelsPublished = -1;
+        qint64 finished = -1;
+    };
+
+    explicit Li3DTilesetStreamParser(int eagerLevels = 3)
+        : m_eagerLevels(qMax(1, eagerLevels))
+        , m_threadPool(QThreadPool::globalInstance())
+        , m_alive(new int(0))
+    {
+        m_nextId = 0;
+        m_canceled = 0;
+        m_error = 0;
+        m_tileCount = 0;
+    }
+
+    ~Li3DTilesetStreamParser()
+    {
+        cancel();
+        m_alive.reset();
+        m_running.waitForFinished();
+    }
+
+    QThreadPool *threadPool() const { return m_threadPool; }
+    void setThreadPool(QThreadPool *pool) { m_threadPool = pool; }
+
+    /**
+     * @brief
+     * 读取并解析tileset.json，本地大文件使用内存映射。返回的QFuture在全部瓦片解析完成后结束
+     */
+    QFuture<void> parse(const QUrl &url)
+    {
+        m_timer.start();
+        QWeakPointer<int> alive = m_alive;
+        auto promise = LiMappedBuffer::readFile(url);
+        observe(promise).subscribe([=](LiMappedBuffer buffer) {
+            if (alive)
+                parse(buffer);
+        }, [=]() {
+            if (alive)
+                m_finished.cancel();
+        });
+        return m_finished.future();
+    }
+
+    /**
+     * @brief
+     * 解析内存中的tileset.json，buffer在解析结束前会一直被持有
+     */
+    QFuture<void> parse(const LiMappedBuffer &buffer)
+    {
+        if (!m_timer.isValid())
+            m_timer.start();
+
+        m_buffer = buffer;
+        m_timing.fileLoaded = m_timer.elapsed();
+        m_running = QtConcurrent::run(m_threadPool, [this]() { run(); });
+        return m_finished.future();
+    }
+
+    void cancel() { m_canceled = 1; }
+
+    bool hasError() const { return m_error.load() != 0; }
+
+    QFuture<void> future() { return m_finished.future(); }
+
+    /**
+     * @brief
+     * tileset.json中除root以外的内容（asset、geometricError、properties等），第二层瓦片发布前有效
+     */
+    QJsonObject tileset()
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_tileset;
+    }
+
+    /**
+     * @brief
+     * 根瓦片中children之前的属性，在扫描children之前发布，timing().rootPublished不为-1后有效。
+     * children之后的属性只包含在根瓦片的Record中
+     */
+    QJsonObject rootTile()
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_rootTile;
+    }
+
+    /**
+     * @brief
+     * 取出已发布的瓦片，按发布顺序追加到records
+     */
+    int takeRecords(QVector<Record> *records)
+    {
+        QMutexLocker locker(&m_mutex);
+        int count = m_records.size();
+        *records += m_records;
+        m_records.clear();
+        return count;
+    }
+
+    int tileCount() const { return m_tileCount.load(); }
+
+    Timing timing()
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_timing;
+    }
+
+private:
+    struct Pending
+    {
+        const char *position;
+        int id;
+        int parent;
+        int depth;
+    };
+
+    void run()
+    {
+        const char *p = m_buffer.constData();
+        const char *end = p + m_buffer.size();
+
+        // 跳过UTF-8 BOM
+        if (end - p >= 3 && uchar(p[0]) == 0xef && uchar(p[1]) == 0xbb && uchar(p[2]) == 0xbf)
+            p += 3;
+
+        QJsonObject tileset;
+        Record root;
+        QVector<const char *> rootChildren;
+        bool hasRoot = false;
+        skipWhitespace(p, end);
+        if (!consume(p, end, '{'))
+        {
+            fail();
+            return;
+        }
+
+        skipWhitespace(p, end);
+        if (!consume(p, end, '}'))
+        {
+            for (;;)
+            {
+                QString key;
+                skipWhitespace(p, end);
+                if (!parseString(p, end, &key) || !consumeColon(p, end))
+                {
+                    fail();
+                    return;
+                }
+
+                bool ok;
+                if (key == QLatin1String("root"))
+                {
+                    // 根瓦片就地解析并立即发布，整棵树只扫描一遍
+                    ok = !hasRoot && parseTile({p, m_nextId.fetchAndAddOrdered(1), -1, 0}, end, &root, &rootChildren, &p);
+                    hasRoot = true;
+                    if (ok)
+                        publish(root);
+                }
+                else
+                {
+                    QJsonValue value;
+                    ok = parseValue(p, end, &value);
+                    tileset[key] = value;
+                }
+
+                skipWhitespace(p, end);
+                if (!ok)
+                {
+                    fail();
+                    return;
+                }
+                if (consume(p, end, ','))
+                    continue;
+                if (consume(p, end, '}'))
+                    break;
+                fail();
+                return;
+            }
+        }
+
+        if (!hasRoot)
+        {
+            fail();
+            return;
+        }
+
+        {
+            QMutexLocker locker(&m_mutex);
+            m_tileset = tileset;
+        }
+
+        // 前几层按广度优先解析
+        QVector<Pending> queue;
+        QVector<Pending> deep;
+        for (int c = 0; c < rootChildren.size(); ++c)
+        {
+            queue.append({rootChildren.at(c), root.firstChild + c, root.id, 1});
+        }
+        for (int i = 0; i < queue.size() && !stopped(); ++i)
+        {
+            const Pending pending = queue.at(i);
+            if (pending.depth >= m_eagerLevels)
+            {
+                deep.append(pending);
+                continue;
+            }
+
+            QVector<const char *> children;
+            Record record;
+            if (!parseTile(pending, end, &record, &children))
+            {
+                m_error = 1;
+                break;
+            }
+            for (int c = 0; c < children.size(); ++c)
+            {
+                queue.append({children.at(c), record.firstChild + c, record.id, pending.depth + 1});
+            }
+            publish(record);
+        }
+
+        {
+            QMutexLocker locker(&m_mutex);
+            m_timing.eagerLevelsPublished = m_timer.elapsed();
+        }
+
+        // 深层子树在线程池中各自深度优先解析
+        QVector<QFuture<void>> futures;
+        if (!stopped())
+        {
+            for (const Pending &pending : deep)
+            {
+                futures.append(QtConcurrent::run(m_threadPool, [this, pending, end]() {
+                    parseSubtree(pending, end);
+                }));
+            }
+        }
+        for (auto &future : futures)
+        {
+            future.waitForFinished();
+        }
+
+        {
+            QMutexLocker locker(&m_mutex);
+            m_timing.finished = m_timer.elapsed();
+        }
+
+        if (m_error.load())
+            qWarning() << "Li3DTilesetStreamParser: malformed tileset json";
+
+        if (stopped())
+            m_finished.cancel();
+        else
+            m_finished.complete();
+    }
+
+    void parseSubtree(const Pending &root, const char *end)
+    {
+        QVector<Pending> stack;
+        stack.append(root);
+        QVector<Record> batch;
+        QVector<const char *> children;
+
+        while (!stack.isEmpty() && !stopped())
+        {
+            const Pending pending = stack.takeLast();
+            children.clear();
+            Record record;
+            if (!parseTile(pending, end, &record, &children))
+            {
+                m_error = 1;
+                break;
+            }
+            for (int c = children.size() - 1; c >= 0; --c)
+            {
+                stack.append({children.at(c), record.firstChild + c, record.id, pending.depth + 1});
+            }
+
+            batch.append(record);
+            if (batch.size() >= 256)
+            {
+                publish(batch);
+                batch.clear();
+            }
+        }
+
+        if (!batch.isEmpty())
+            publish(batch);
+    }
+
+    bool stopped() const { return m_canceled.load() || m_error.load(); }
+
+    void fail()
+    {
+        m_error = 1;
+        qWarning() << "Li3DTilesetStreamParser: malformed tileset json";
+        m_finished.cancel();
+    }
+
+    /**
+     * @brief
+     * 解析一个瓦片对象，children只记录每个子瓦片的起始位置，并为子瓦片分配连续的id。
+     * 根瓦片在扫描children之前发布已解析的属性。stop不为空时返回瓦片对象之后的位置，格式错误时返回false
+     */
+    bool parseTile(const Pending &pending, const char *end, Record *record, QVector<const char *> *children,
+                   const char **stop = nullptr)
+    {
+        record->id = pending.id;
+        record->parent = pending.parent;
+        record->depth = pending.depth;
+
+        const char *p = pending.position;
+        if (!consume(p, end, '{'))
+            return false;
+
+        skipWhitespace(p, end);
+        if (!consume(p, end, '}'))
+        {
+            for (;;)
+            {
+                QString key;
+                skipWhitespace(p, end);
+                if (!parseString(p, end, &key) || !consumeColon(p, end))
+                    return false;
+
+                if (key == QLatin1String("children"))
+                {
+                    if (!consume(p, end, '['))
+                        return false;
+                    if (pending.parent < 0)
+                        publishRootTile(record->tile);
+
+                    skipWhitespace(p, end);
+                    if (!consume(p, end, ']'))
+                    {
+                        for (;;)
+                        {
+                            skipWhitespace(p, end);
+                            if (p >= end || *p != '{')
+                                return false;
+                            children->append(p);
+                            if (!skipValue(p, end))
+                                return false;
+                            skipWhitespace(p, end);
+                            if (consume(p, end, ','))
+                                continue;
+                            if (consume(p, end, ']'))
+                                break;
+                            return false;
+                        }
+                    }
+                }
+                else
+                {
+                    QJsonValue value;
+                    if (!parseValue(p, end, &value))
+                        return false;
+                    record->tile[key] = value;
+                }
+
+                skipWhitespace(p, end);
+                if (consume(p, end, ','))
+                    continue;
+                if (consume(p, end, '}'))
+                    break;
+                return false;
+            }
+        }
+
+        record->childCount = children->size();
+        if (record->childCount > 0)
+            record->firstChild = m_nextId.fetchAndAddOrdered(record->childCount);
+        else if (pending.parent < 0)
+            publishRootTile(record->tile);
+
+        if (stop)
+            *stop = p;
+        return true;
+    }
+
+    void publishRootTile(const QJsonObject &tile)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_rootTile = tile;
+        m_timing.rootPublished = m_timer.elapsed();
+    }
+
+    void publish(const Record &record)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_records.append(record);
+        m_tileCount.fetchAndAddRelaxed(1);
+    }
+
+    void publish(const QVector<Record> &records)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_records += records;
+        m_tileCount.fetchAndAddRelaxed(records.size());
+    }
+
+    /*
+     * 以下扫描函数在格式错误时返回false，每个循环要么前进要么返回，保证在任何输入上都能结束
+     */
+
+    static void skipWhitespace(const char *&p, const char *end)
+    {
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+            ++p;
+    }
+
+    static bool consume(const char *&p, const char *end, char c)
+    {
+        if (p >= end || *p != c)
+            return false;
+        ++p;
+        return true;
+    }
+
+    static bool consumeColon(const char *&p, const char *end)
+    {
+        skipWhitespace(p, end);
+        if (!consume(p, end, ':'))
+            return false;
+        skipWhitespace(p, end);
+        return true;
+    }
+
+    static bool isDelimiter(char c)
+    {
+        return c == ',' || c == '}' || c == ']' || c == ' ' || c == '\n' || c == '\r' || c == '\t';
+    }
+
+    static bool skipString(const char *&p, const char *end)
+    {
+        if (!consume(p, end, '"'))
+            return false;
+        while (p < end && *p != '"')
+        {
+            if (*p == '\\' && end - p > 1)
+                ++p;
+            ++p;
+        }
+        return consume(p, end, '"');
+    }
+
+    /**
+     * @brief
+     * 跳过一个值，只匹配括号和字符串，不做任何转换
+     */
+    static bool skipValue(const char *&p, const char *end)
+    {
+        if (p >= end || *p == '}' || *p == ']' || *p == ',')
+            return false;
+
+        if (*p == '"')
+            return skipString(p, end);
+
+        if (*p != '{' && *p != '[')
+        {
+            const char *begin = p;
+            while (p < end && !isDelimiter(*p))
+                ++p;
+            return p > begin;
+        }
+
+        int depth = 0;
+        while (p < end)
+        {
+            char c = *p;
+            if (c == '"')
+            {
+                if (!skipString(p, end))
+                    return false;
+                continue;
+            }
+            if (c == '{' || c == '[')
+                ++depth;
+            else if ((c == '}' || c == ']') && --depth == 0)
+            {
+                ++p;
+                return true;
+            }
+            ++p;
+        }
+        return false;
+    }
+
+    static bool parseString(const char *&p, const char *end, QString *result)
+    {
+        if (p >= end || *p != '"')
+            return false;
+
+        const char *begin = ++p;
+        bool escaped = false;
+        while (p < end && *p != '"')
+        {
+            if (*p == '\\' && end - p > 1)
+            {
+                escaped = true;
+                ++p;
+            }
+            ++p;
+        }
+        if (p >= end)
+            return false;
+        const char *stop = p++;
+
+        if (!escaped)
+        {
+            *result = QString::fromUtf8(begin, int(stop - begin));
+            return true;
+        }
+
+        // 含有转义字符时交给QJsonDocument处理
+        QByteArray quoted;
+        quoted.reserve(int(stop - begin) + 4);
+        quoted.append('[').append(begin - 1, int(stop - begin) + 2).append(']');
+        QJsonParseError error;
+        QJsonDocument document = QJsonDocument::fromJson(quoted, &error);
+        if (error.error != QJsonParseError::NoError)
+            return false;
+        *result = document.array().at(0).toString();
+        return true;
+    }
+
+    static bool parseLiteral(const char *&p, const char *end, const char *text, int length)
+    {
+        if (end - p < length || memcmp(p, text, size_t(length)) != 0)
+            return false;
+        p += length;
+        return p >= end || isDelimiter(*p);
+    }
+
+    static bool parseValue(const char *&p, const char *end, QJsonValue *result, int depth = 0)
+    {
+        if (p >= end || depth > MaxDepth)
+            return false;
+
+        switch (*p)
+        {
+        case '"':
+        {
+            QString string;
+            if (!parseString(p, end, &string))
+                return false;
+            *result = string;
+            return true;
+        }
+        case '{':
+        {
+            QJsonObject object;
+            ++p;
+            skipWhitespace(p, end);
+            if (!consume(p, end, '}'))
+            {
+                for (;;)
+                {
+                    QString key;
+                    QJsonValue value;
+                    skipWhitespace(p, end);
+                    if (!parseString(p, end, &key) || !consumeColon(p, end) || !parseValue(p, end, &value, depth + 1))
+                        return false;
+                    object[key] = value;
+                    skipWhitespace(p, end);
+                    if (consume(p, end, ','))
+                        continue;
+                    if (consume(p, end, '}'))
+                        break;
+                    return false;
+                }
+            }
+            *result = object;
+            return true;
+        }
+        case '[':
+        {
+            QJsonArray array;
+            ++p;
+            skipWhitespace(p, end);
+            if (!consume(p, end, ']'))
+            {
+                for (;;)
+                {
+                    QJsonValue value;
+                    skipWhitespace(p, end);
+                    if (!parseValue(p, end, &value, depth + 1))
+                        return false;
+                    array.append(value);
+                    skipWhitespace(p, end);
+                    if (consume(p, end, ','))
+                        continue;
+                    if (consume(p, end, ']'))
+                        break;
+                    return false;
+                }
+            }
+            *result = array;
+            return true;
+        }
+        case 't':
+            *result = true;
+            return parseLiteral(p, end, "true", 4);
+        case 'f':
+            *result = false;
+            return parseLiteral(p, end, "false", 5);
+        case 'n':
+            *result = QJsonValue();
+            return parseLiteral(p, end, "null", 4);
+        default:
+        {
+            const char *begin = p;
+            while (p < end && !isDelimiter(*p))
+                ++p;
+            bool ok = false;
+            double number = QByteArray::fromRawData(begin, int(p - begin)).toDouble(&ok);
+            *result = number;
+            return ok;
+        }
+        }
+    }
+
+    int m_eagerLevels;
+    QThreadPool *m_threadPool;
+    LiMappedBuffer m_buffer;
+    QElapsedTimer m_timer;
+    QAtomicInt m_nextId;
+    QAtomicInt m_canceled;
+    QAtomicInt m_error;
+    QAtomicInt m_tileCount;
+    QMutex m_mutex;
+    QJsonObject m_tileset;
+    QJsonObject m_rootTile;
+    QVector<Record> m_records;
+    Timing m_timing;
+    QFuture<void> m_running;
+    QSharedPointer<int> m_alive;
+    Deferred<void> m_finished;
+};
+
+#endif // LI3DTILESETSTREAMPARSER_H
@@ -0,0 +1,303 @@
+#ifndef LIDRAWSORTKEY_H
+#define LIDRAWSORTKEY_H
+
+#include "licore_global.h"
+#include "ligeometryrenderer.h"
+#include "linodeid.h"
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+/**
+ * @brief
+ * 绘制命令的64位排序键。Globe和Opaque内按着色器程序、材质（纹理集合）、顶点数组排序以减少状态切换，最后按由近到远排序；
+ * 透明物体（Translucent、Symbol）为了混合结果正确先按由远到近排序，再按状态排序；
+ * 其他阶段（环境、投影、后处理、界面等）的绘制顺序有意义，只按提交序号排序。
+ * 不透明：[pass:4][program:12][material:16][vertexArray:12][depth:20]
+ * 透明：  [pass:4][depth:24][program:12][material:12][vertexArray:12]
+ * 其他：  [pass:4][0:28][sequence:32]
+ * 编号超出位宽时只保留低位，只影响状态合并的效果，不影响正确性。
+ */
+class LiDrawSortKey
+{
+public:
+    enum
+    {
+        OpaqueDepthBits = 20,
+        TranslucentDepthBits = 24
+    };
+
+    static bool isTranslucent(LiGeometryRenderer::Type pass)
+    {
+        return pass == LiGeometryRenderer::Translucent || pass == LiGeometryRenderer::Symbol;
+    }
+
+    /**
+     * @brief
+     * 按状态排序的阶段，其中的绘制顺序不影响结果
+     */
+    static bool isStateSorted(LiGeometryRenderer::Type pass)
+    {
+        return pass == LiGeometryRenderer::Globe || pass == LiGeometryRenderer::Opaque;
+    }
+
+    /**
+     * @param program、material、vertexArray 由LiDrawStateIds分配的连续编号
+     * @param depth 到相机的距离
+     * @param nearDistance、farDistance 距离的范围，用于对数量化
+     * @param sequence 提交序号，只用于Globe、Opaque和透明阶段以外的阶段
+     */
+    static quint64 make(LiGeometryRenderer::Type pass, quint32 program, quint32 material, quint32 vertexArray,
+                        double depth, double nearDistance, double farDistance, quint32 sequence = 0)
+    {
+        quint64 key = quint64(pass & 0xF) << 60;
+        if (isTranslucent(pass))
+        {
+            quint64 d = quantizeDepth(depth, nearDistance, farDistance, TranslucentDepthBits);
+            d = ((quint64(1) << TranslucentDepthBits) - 1) - d;
+            key |= d << 36;
+            key |= quint64(program & 0xFFF) << 24;
+            key |= quint64(material & 0xFFF) << 12;
+            key |= quint64(vertexArray & 0xFFF);
+        }
+        else if (isStateSorted(pass))
+        {
+            key |= quint64(program & 0xFFF) << 48;
+            key |= quint64(material & 0xFFFF) << 32;
+            key |= quint64(vertexArray & 0xFFF) << 20;
+            key |= quantizeDepth(depth, nearDistance, farDistance, OpaqueDepthBits);
+        }
+        else
+        {
+            // 排序是稳定的，序号相同时保持添加的顺序
+            key |= sequence;
+        }
+        return key;
+    }
+
+    static LiGeometryRenderer::Type pass(quint64 key)
+    {
+        return LiGeometryRenderer::Type(key >> 60);
+    }
+
+    /**
+     * @brief
+     * 按对数量化距离，近处精度更高
+     */
+    static quint64 quantizeDepth(double depth, double nearDistance, double farDistance, int bits)
+    {
+        nearDistance = qMax(nearDistance, 1e-3);
+        farDistance = qMax(farDistance, nearDistance * (1.0 + 1e-6));
+        depth = qBound(nearDistance, depth, farDistance);
+        double t = std::log(depth / nearDistance) / std::log(farDistance / nearDistance);
+        quint64 maxValue = (quint64(1) << bits) - 1;
+        return qMin(maxValue, quint64(t * double(maxValue) + 0.5));
+    }
+};
+
+/**
+ * @brief
+ * 把着色器程序、材质、顶点数组等节点的LiNodeId映射为从1开始的连续编号，用于填充排序键。
+ * 编号在clear()前保持不变，首次出现的顺序决定编号大小。
+ */
+class LiDrawStateIds
+{
+public:
+    quint32 id(LiNodeId node)
+    {
+        if (node.isNull())
+            return 0;
+        auto it = m_ids.constFind(node);
+        if (it != m_ids.constEnd())
+            return it.value();
+        quint32 id = quint32(m_ids.size() + 1);
+        m_ids.insert(node, id);
+        return id;
+    }
+
+    int count() const { return m_ids.size(); }
+    void clear() { m_ids.clear(); }
+
+private:
+    QHash<LiNodeId, quint32> m_ids;
+};
+
+/**
+ * @brief
+ * 按64位键对绘制命令做稳定的LSD基数排序，每次处理8位，所有键在某一字节上相同时跳过该趟。
+ */
+template<typename T>
+class LiDrawQueue
+{
+public:
+    struct Item
+    {
+        quint64 key;
+        T command;
+    };
+
+    void reserve(int count)
+    {
+        m_items.reserve(size_t(count));
+        m_scratch.reserve(size_t(count));
+    }
+
+    void add(quint64 key, const T &command)
+    {
+        Item item;
+        item.key = key;
+        item.command = command;
+        m_items.push_back(item);
+    }
+
+    void clear() { m_items.clear(); }
+    int count() const { return int(m_items.size()); }
+    bool isEmpty() const { return m_items.empty(); }
+
+    const Item &at(int i) const { return m_items[size_t(i)]; }
+    typename std::vector<Item>::const_iterator begin() const { return m_items.begin(); }
+    typename std::vector<Item>::const_iterator end() const { return m_items.end(); }
+
+    void sort()
+    {
+        const size_t count = m_items.size();
+        if (count < 2)
+            return;
+
+        quint32 histogram[8][256];
+        memset(histogram, 0, sizeof(histogram));
+        for (const Item &item : m_items)
+        {
+            quint64 key = item.key;
+            for (int b = 0; b < 8; ++b)
+                ++histogram[b][(key >> (b * 8)) & 0xFF];
+        }
+
+        m_scratch.resize(count);
+        std::vector<Item> *src = &m_items;
+        std::vector<Item> *dst = &m_scratch;
+        for (int b = 0; b < 8; ++b)
+        {
+            quint32 *h = histogram[b];
+            if (h[(m_items[0].key >> (b * 8)) & 0xFF] == count)
+                continue;
+
+            quint32 offset = 0;
+            for (int i = 0; i < 256; ++i)
+            {
+                quint32 n = h[i];
+                h[i] = offset;
+                offset += n;
+            }
+
+            const int shift = b * 8;
+            for (const Item &item : *src)
+                (*dst)[h[(item.key >> shift) & 0xFF]++] = item;
+            std::swap(src, dst);
+        }
+
+        if (src != &m_items)
+            m_items.swap(m_scratch);
+    }
+
+private:
+    std::vector<Item> m_items;
+    std::vector<Item> m_scratch;
+};
+
+/**
+ * @brief
+ * 提交绘制命令时记录当前绑定的状态，bind*()返回true时才需要真正调用OpenGL，同时统计每帧的绑定和绘制次数。
+ */
+class LiDrawStateCache
+{
+public:
+    enum
+    {
+        MaxTextureUnits = 32
+    };
+
+    struct Statistics
+    {
+        int drawCalls = 0;
+        int programBinds = 0;
+        int textureBinds = 0;
+        int vertexArrayBinds = 0;
+        int skippedBinds = 0;       ///< 因状态未变化而省去的绑定
+    };
+
+    LiDrawStateCache() { invalidate(); }
+
+    bool bindProgram(quint64 program)
+    {
+        if (program == m_program)
+            return skip();
+        m_program = program;
+        ++m_current.programBinds;
+        return true;
+    }
+
+    bool bindTexture(int unit, quint64 texture)
+    {
+        Q_ASSERT(unit >= 0 && unit < MaxTextureUnits);
+        if (texture == m_textures[unit])
+            return skip();
+        m_textures[unit] = texture;
+        ++m_current.textureBinds;
+        return true;
+    }
+
+    bool bindVertexArray(quint64 vertexArray)
+    {
+        if (vertexArray == m_vertexArray)
+            return skip();
+        m_vertexArray = vertexArray;
+        ++m_current.vertexArrayBinds;
+        return true;
+    }
+
+    void draw() { ++m_current.drawCalls; }
+
+    /**
+     * @brief
+     * 外部代码直接修改了OpenGL状态时调用，之后的绑定都会生效
+     */
+    void invalidate()
+    {
+        m_program = InvalidState;
+        m_vertexArray = InvalidState;
+        for (quint64 &texture : m_textures)
+            texture = InvalidState;
+    }
+
+    /**
+     * @brief
+     * 帧结束时调用，保存本帧的统计并清零
+     */
+    void endFrame()
+    {
+        m_last = m_current;
+        m_current = Statistics();
+        invalidate();
+    }
+
+    const Statistics &current() const { return m_current; }
+    const Statistics &statistics() const { return m_last; }
+
+private:
+    static const quint64 InvalidState = ~quint64(0);
+
+    bool skip()
+    {
+        ++m_current.skippedBinds;
+        return false;
+    }
+
+    quint64 m_program;
+    quint64 m_vertexArray;
+    quint64 m_textures[MaxTextureUnits];
+    Statistics m_current;
+    Statistics m_last;
+};
+
+#endif // LIDRAWSORTKEY_H
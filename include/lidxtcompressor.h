@@ -0,0 +1,540 @@
+#ifndef LIDXTCOMPRESSOR_H
+#define LIDXTCOMPRESSOR_H
+
+#include "licore_global.h"
+#include "liimagedata.h"
+#include <QtConcurrent>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LIDXTCOMPRESSOR_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LIDXTCOMPRESSOR_SSE2 1
+#endif
+
+/**
+ * @brief
+ * 多线程DXT1/DXT5压缩。按块行把图像分成若干任务，整个MipMap链或者一批影像瓦片的所有层级
+ * 在一次调用中并行压缩，调用线程同样参与计算。单个块的压缩使用van Waveren的实时DXT压缩算法
+ * （包围盒内缩求端点、按距离选索引），支持AVX2时每次计算8个像素，只支持SSE2时（包括默认选项的MSVC x64）每次计算4个像素，
+ * 否则使用标量实现，各实现的结果完全一致。
+ */
+class LiDXTCompressor
+{
+public:
+    enum Format
+    {
+        DXT1,
+        DXT5
+    };
+
+    typedef QSharedPointer<LiImageData> ImageDataPtr;
+
+    /**
+     * @param threadPool 为空时在调用线程中压缩
+     */
+    explicit LiDXTCompressor(QThreadPool *threadPool = QThreadPool::globalInstance())
+        : m_threadPool(threadPool)
+        , m_blockRowsPerTask(16)
+    {
+    }
+
+    QThreadPool *threadPool() const { return m_threadPool; }
+    void setThreadPool(QThreadPool *pool) { m_threadPool = pool; }
+
+    /**
+     * @brief
+     * 每个任务压缩的块行数，一个块行为4行像素
+     */
+    int blockRowsPerTask() const { return m_blockRowsPerTask; }
+    void setBlockRowsPerTask(int rows) { m_blockRowsPerTask = qMax(1, rows); }
+
+    static int blockBytes(Format format) { return format == DXT1 ? 8 : 16; }
+
+    static int compressedSize(int width, int height, Format format)
+    {
+        return qMax(1, (width + 3) / 4) * qMax(1, (height + 3) / 4) * blockBytes(format);
+    }
+
+    /**
+     * @brief
+     * 压缩一张RGBA图像
+     * @param rowPitch 一行像素的字节数，为0时等于width * 4
+     */
+    void compress(const quint8 *in, int width, int height, int rowPitch, Format format, quint8 *out)
+    {
+        Level level = { in, width, height, rowPitch > 0 ? rowPitch : width * 4, out };
+        QVector<Level> levels;
+        levels.append(level);
+        compressLevels(levels, format);
+    }
+
+    /**
+     * @brief
+     * 压缩未压缩的RGBA8纹理数据的所有MipMap层级，例如LiImageDecodePipeline::prepare的结果
+     * @param format 为DXT1时丢弃alpha
+     */
+    ImageDataPtr compress(const LiImageData &image, Format format)
+    {
+        QVector<ImageDataPtr> results;
+        QVector<const LiImageData *> images;
+        images.append(&image);
+        compressImages(images, format, &results);
+        return results.first();
+    }
+
+    /**
+     * @brief
+     * 一次压缩一批影像的所有MipMap层级，所有层级的块行任务放在同一个队列中并行处理
+     */
+    void compressImages(const QVector<const LiImageData *> &images, Format format, QVector<ImageDataPtr> *results)
+    {
+        results->clear();
+        QVector<Level> levels;
+
+        for (const LiImageData *image : images)
+        {
+            if (!image || image->isCompressed || image->blockSize != 4)
+            {
+                results->append(ImageDataPtr());
+                continue;
+            }
+
+            ImageDataPtr data(new LiImageData(*image));
+            int size = 0;
+            for (int level = 0; level < image->mipLevels; ++level)
+                size += compressedSize(qMax(1, image->width >> level), qMax(1, image->height >> level), format);
+            data->imageData = QByteArray(size, Qt::Uninitialized);
+            data->blockSize = blockBytes(format);
+            data->isCompressed = true;
+            data->hasAlpha = format == DXT5 && image->hasAlpha;
+            data->textureFormat = format == DXT1 ? QOpenGLTexture::RGB_DXT1 : QOpenGLTexture::RGBA_DXT5;
+            results->append(data);
+
+            const quint8 *in = reinterpret_cast<const quint8 *>(image->imageData.constData());
+            quint8 *out = reinterpret_cast<quint8 *>(data->imageData.data());
+            for (int level = 0; level < image->mipLevels; ++level)
+            {
+                int w = qMax(1, image->width >> level);
+                int h = qMax(1, image->height >> level);
+                Level l = { in, w, h, w * 4, out };
+                levels.append(l);
+                in += w * h * 4;
+                out += compressedSize(w, h, format);
+            }
+        }
+
+        compressLevels(levels, format);
+    }
+
+    /**
+     * @brief
+     * 压缩图像的一段块行，在当前线程中执行
+     */
+    static void compressBlockRows(const quint8 *in, int width, int height, int rowPitch, Format format,
+                                  quint8 *out, int firstBlockRow, int blockRowCount)
+    {
+        const int blocksX = qMax(1, (width + 3) / 4);
+        const int bytes = blockBytes(format);
+        alignas(32) quint8 block[64];
+
+        for (int by = firstBlockRow; by < firstBlockRow + blockRowCount; ++by)
+        {
+            quint8 *dest = out + by * blocksX * bytes;
+            for (int bx = 0; bx < blocksX; ++bx)
+            {
+                extractBlock(in, width, height, rowPitch, bx, by, block);
+                if (format == DXT1)
+                    compressBlockDXT1(block, dest);
+                else
+                    compressBlockDXT5(block, dest);
+                dest += bytes;
+            }
+        }
+    }
+
+    /**
+     * @brief
+     * 取出4x4的块，超出图像的部分重复边缘像素
+     */
+    static void extractBlock(const quint8 *in, int width, int height, int rowPitch, int bx, int by, quint8 *block)
+    {
+        const int x0 = bx * 4;
+        const int y0 = by * 4;
+        if (x0 + 4 <= width && y0 + 4 <= height)
+        {
+            for (int row = 0; row < 4; ++row)
+                memcpy(block + row * 16, in + (y0 + row) * rowPitch + x0 * 4, 16);
+            return;
+        }
+
+        for (int row = 0; row < 4; ++row)
+        {
+            const quint8 *line = in + qMin(y0 + row, height - 1) * rowPitch;
+            for (int column = 0; column < 4; ++column)
+                memcpy(block + row * 16 + column * 4, line + qMin(x0 + column, width - 1) * 4, 4);
+        }
+    }
+
+    /**
+     * @brief
+     * 压缩一个4x4块（DXT1/DXT5相同），block为按行排列的16个RGBA像素（64字节），不要求对齐
+     */
+    static void compressBlockDXT1(const quint8 *block, quint8 *out)
+    {
+        quint8 minColor[4], maxColor[4];
+        getMinMaxColors(block, minColor, maxColor);
+        emitColorBlock(block, minColor, maxColor, out);
+    }
+
+    static void compressBlockDXT5(const quint8 *block, quint8 *out)
+    {
+        quint8 minColor[4], maxColor[4];
+        getMinMaxColors(block, minColor, maxColor);
+        emitAlphaBlock(block, minColor[3], maxColor[3], out);
+        emitColorBlock(block, minColor, maxColor, out + 8);
+    }
+
+private:
+    struct Level
+    {
+        const quint8 *in;
+        int width;
+        int height;
+        int rowPitch;
+        quint8 *out;
+    };
+
+    struct Task
+    {
+        int level;
+        int firstBlockRow;
+        int blockRowCount;
+    };
+
+    void compressLevels(const QVector<Level> &levels, Format format)
+    {
+        QVector<Task> tasks;
+        for (int i = 0; i < levels.size(); ++i)
+        {
+            int blockRows = qMax(1, (levels[i].height + 3) / 4);
+            for (int row = 0; row < blockRows; row += m_blockRowsPerTask)
+            {
+                Task task = { i, row, qMin(m_blockRowsPerTask, blockRows - row) };
+                tasks.append(task);
+            }
+        }
+
+        parallelFor(tasks.size(), [&](int i) {
+            const Task &task = tasks[i];
+            const Level &level = levels[task.level];
+            compressBlockRows(level.in, level.width, level.height, level.rowPitch, format,
+                              level.out, task.firstBlockRow, task.blockRowCount);
+        });
+    }
+
+    template <typename Func>
+    void parallelFor(int count, const Func &func)
+    {
+        int threads = m_threadPool ? qMin(count, m_threadPool->maxThreadCount()) : 1;
+        if (threads <= 1)
+        {
+            for (int i = 0; i < count; ++i)
+                func(i);
+            return;
+        }
+
+        QAtomicInt next(0);
+        auto worker = [&]() {
+            for (;;)
+            {
+                int i = next.fetchAndAddRelaxed(1);
+                if (i >= count)
+                    break;
+                func(i);
+            }
+        };
+
+        QVector<QFuture<void>> futures;
+        for (int i = 1; i < threads; ++i)
+            futures.append(QtConcurrent::run(m_threadPool, worker));
+        worker();
+        for (QFuture<void> &future : futures)
+            future.waitForFinished();
+    }
+
+    /**
+     * @brief
+     * 各通道的包围盒，向内收缩1/16（alpha为1/32）以减小均方误差
+     */
+    static void getMinMaxColors(const quint8 *block, quint8 *minColor, quint8 *maxColor)
+    {
+#if defined(LIDXTCOMPRESSOR_AVX2)
+        __m256i p0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+        __m256i p1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + 32));
+        __m256i mn = _mm256_min_epu8(p0, p1);
+        __m256i mx = _mm256_max_epu8(p0, p1);
+        __m128i mn4 = _mm_min_epu8(_mm256_castsi256_si128(mn), _mm256_extracti128_si256(mn, 1));
+        __m128i mx4 = _mm_max_epu8(_mm256_castsi256_si128(mx), _mm256_extracti128_si256(mx, 1));
+        mn4 = _mm_min_epu8(mn4, _mm_shuffle_epi32(mn4, _MM_SHUFFLE(1, 0, 3, 2)));
+        mx4 = _mm_max_epu8(mx4, _mm_shuffle_epi32(mx4, _MM_SHUFFLE(1, 0, 3, 2)));
+        mn4 = _mm_min_epu8(mn4, _mm_shuffle_epi32(mn4, _MM_SHUFFLE(2, 3, 0, 1)));
+        mx4 = _mm_max_epu8(mx4, _mm_shuffle_epi32(mx4, _MM_SHUFFLE(2, 3, 0, 1)));
+        quint32 mnValue = quint32(_mm_cvtsi128_si32(mn4));
+        quint32 mxValue = quint32(_mm_cvtsi128_si32(mx4));
+        memcpy(minColor, &mnValue, 4);
+        memcpy(maxColor, &mxValue, 4);
+#elif defined(LIDXTCOMPRESSOR_SSE2)
+        __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block));
+        __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16));
+        __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 32));
+        __m128i p3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 48));
+        __m128i mn4 = _mm_min_epu8(_mm_min_epu8(p0, p1), _mm_min_epu8(p2, p3));
+        __m128i mx4 = _mm_max_epu8(_mm_max_epu8(p0, p1), _mm_max_epu8(p2, p3));
+        mn4 = _mm_min_epu8(mn4, _mm_shuffle_epi32(mn4, _MM_SHUFFLE(1, 0, 3, 2)));
+        mx4 = _mm_max_epu8(mx4, _mm_shuffle_epi32(mx4, _MM_SHUFFLE(1, 0, 3, 2)));
+        mn4 = _mm_min_epu8(mn4, _mm_shuffle_epi32(mn4, _MM_SHUFFLE(2, 3, 0, 1)));
+        mx4 = _mm_max_epu8(mx4, _mm_shuffle_epi32(mx4, _MM_SHUFFLE(2, 3, 0, 1)));
+        quint32 mnValue = quint32(_mm_cvtsi128_si32(mn4));
+        quint32 mxValue = quint32(_mm_cvtsi128_si32(mx4));
+        memcpy(minColor, &mnValue, 4);
+        memcpy(maxColor, &mxValue, 4);
+#else
+        for (int c = 0; c < 4; ++c)
+        {
+            minColor[c] = 255;
+            maxColor[c] = 0;
+        }
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                minColor[c] = qMin(minColor[c], block[i * 4 + c]);
+                maxColor[c] = qMax(maxColor[c], block[i * 4 + c]);
+            }
+        }
+#endif
+
+        for (int c = 0; c < 4; ++c)
+        {
+            int inset = (maxColor[c] - minColor[c]) >> (c == 3 ? 5 : 4);
+            minColor[c] = quint8(minColor[c] + inset);
+            maxColor[c] = quint8(maxColor[c] - inset);
+        }
+    }
+
+    static quint16 colorTo565(const quint8 *color)
+    {
+        return quint16(((color[0] >> 3) << 11) | ((color[1] >> 2) << 5) | (color[2] >> 3));
+    }
+
+    static void emitColorBlock(const quint8 *block, const quint8 *minColor, const quint8 *maxColor, quint8 *out)
+    {
+        quint16 max565 = colorTo565(maxColor);
+        quint16 min565 = colorTo565(minColor);
+        quint32 indices = colorIndices(block, minColor, maxColor);
+
+        out[0] = quint8(max565);
+        out[1] = quint8(max565 >> 8);
+        out[2] = quint8(min565);
+        out[3] = quint8(min565 >> 8);
+        out[4] = quint8(indices);
+        out[5] = quint8(indices >> 8);
+        out[6] = quint8(indices >> 16);
+        out[7] = quint8(indices >> 24);
+    }
+
+    /**
+     * @brief
+     * 端点按565量化后还原的颜色，以及两个插值颜色
+     */
+    static void paletteColors(const quint8 *minColor, const quint8 *maxColor, int colors[4][3])
+    {
+        colors[0][0] = (maxColor[0] & 0xF8) | (maxColor[0] >> 5);
+        colors[0][1] = (maxColor[1] & 0xFC) | (maxColor[1] >> 6);
+        colors[0][2] = (maxColor[2] & 0xF8) | (maxColor[2] >> 5);
+        colors[1][0] = (minColor[0] & 0xF8) | (minColor[0] >> 5);
+        colors[1][1] = (minColor[1] & 0xFC) | (minColor[1] >> 6);
+        colors[1][2] = (minColor[2] & 0xF8) | (minColor[2] >> 5);
+        for (int c = 0; c < 3; ++c)
+        {
+            colors[2][c] = (2 * colors[0][c] + colors[1][c]) / 3;
+            colors[3][c] = (colors[0][c] + 2 * colors[1][c]) / 3;
+        }
+    }
+
+    static quint32 colorIndices(const quint8 *block, const quint8 *minColor, const quint8 *maxColor)
+    {
+        int colors[4][3];
+        paletteColors(minColor, maxColor, colors);
+
+#if defined(LIDXTCOMPRESSOR_AVX2)
+        const __m256i rgbMask = _mm256_set1_epi32(0x00FFFFFF);
+        const __m256i ones8 = _mm256_set1_epi8(1);
+        const __m256i ones16 = _mm256_set1_epi16(1);
+        __m256i palette[4];
+        for (int k = 0; k < 4; ++k)
+            palette[k] = _mm256_set1_epi32(colors[k][0] | (colors[k][1] << 8) | (colors[k][2] << 16));
+
+        quint32 indices = 0;
+        for (int half = 0; half < 2; ++half)
+        {
+            __m256i p = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + half * 32)), rgbMask);
+            __m256i d[4];
+            for (int k = 0; k < 4; ++k)
+            {
+                __m256i diff = _mm256_or_si256(_mm256_subs_epu8(p, palette[k]), _mm256_subs_epu8(palette[k], p));
+                d[k] = _mm256_madd_epi16(_mm256_maddubs_epi16(diff, ones8), ones16);
+            }
+
+            __m256i b0 = _mm256_cmpgt_epi32(d[0], d[3]);
+            __m256i b1 = _mm256_cmpgt_epi32(d[1], d[2]);
+            __m256i b2 = _mm256_cmpgt_epi32(d[0], d[2]);
+            __m256i b3 = _mm256_cmpgt_epi32(d[1], d[3]);
+            __m256i b4 = _mm256_cmpgt_epi32(d[2], d[3]);
+            __m256i x0 = _mm256_and_si256(b1, b2);
+            __m256i x1 = _mm256_and_si256(b0, b3);
+            __m256i x2 = _mm256_and_si256(b0, b4);
+
+            quint32 low = quint32(_mm256_movemask_ps(_mm256_castsi256_ps(x2)));
+            quint32 high = quint32(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_or_si256(x0, x1))));
+            indices |= (spreadBits(low) | (spreadBits(high) << 1)) << (half * 16);
+        }
+        return indices;
+#elif defined(LIDXTCOMPRESSOR_SSE2)
+        // SSE2没有maddubs，用移位和掩码把每个像素三个通道的差相加
+        const __m128i rgbMask = _mm_set1_epi32(0x00FFFFFF);
+        const __m128i byteMask = _mm_set1_epi32(0xFF);
+        __m128i palette[4];
+        for (int k = 0; k < 4; ++k)
+            palette[k] = _mm_set1_epi32(colors[k][0] | (colors[k][1] << 8) | (colors[k][2] << 16));
+
+        quint32 indices = 0;
+        for (int quarter = 0; quarter < 4; ++quarter)
+        {
+            __m128i p = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(block + quarter * 16)), rgbMask);
+            __m128i d[4];
+            for (int k = 0; k < 4; ++k)
+            {
+                __m128i diff = _mm_or_si128(_mm_subs_epu8(p, palette[k]), _mm_subs_epu8(palette[k], p));
+                d[k] = _mm_add_epi32(_mm_add_epi32(_mm_and_si128(diff, byteMask),
+                                                   _mm_and_si128(_mm_srli_epi32(diff, 8), byteMask)),
+                                     _mm_srli_epi32(diff, 16));
+            }
+
+            __m128i b0 = _mm_cmpgt_epi32(d[0], d[3]);
+            __m128i b1 = _mm_cmpgt_epi32(d[1], d[2]);
+            __m128i b2 = _mm_cmpgt_epi32(d[0], d[2]);
+            __m128i b3 = _mm_cmpgt_epi32(d[1], d[3]);
+            __m128i b4 = _mm_cmpgt_epi32(d[2], d[3]);
+            __m128i x0 = _mm_and_si128(b1, b2);
+            __m128i x1 = _mm_and_si128(b0, b3);
+            __m128i x2 = _mm_and_si128(b0, b4);
+
+            quint32 low = quint32(_mm_movemask_ps(_mm_castsi128_ps(x2)));
+            quint32 high = quint32(_mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(x0, x1))));
+            indices |= (spreadBits(low) | (spreadBits(high) << 1)) << (quarter * 8);
+        }
+        return indices;
+#else
+        quint32 indices = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            const quint8 *p = block + i * 4;
+            int d[4];
+            for (int k = 0; k < 4; ++k)
+                d[k] = qAbs(p[0] - colors[k][0]) + qAbs(p[1] - colors[k][1]) + qAbs(p[2] - colors[k][2]);
+
+            int b0 = d[0] > d[3];
+            int b1 = d[1] > d[2];
+            int b2 = d[0] > d[2];
+            int b3 = d[1] > d[3];
+            int b4 = d[2] > d[3];
+            int x0 = b1 & b2;
+            int x1 = b0 & b3;
+            int x2 = b0 & b4;
+            indices |= quint32(x2 | ((x0 | x1) << 1)) << (i * 2);
+        }
+        return indices;
+#endif
+    }
+
+    /**
+     * @brief
+     * 把8位数的各位分散到16位数的偶数位上
+     */
+    static quint32 spreadBits(quint32 x)
+    {
+        x = (x | (x << 4)) & 0x0F0F;
+        x = (x | (x << 2)) & 0x3333;
+        x = (x | (x << 1)) & 0x5555;
+        return x;
+    }
+
+    static void emitAlphaBlock(const quint8 *block, quint8 minAlpha, quint8 maxAlpha, quint8 *out)
+    {
+        // 6个插值alpha之间的中点作为分界
+        const int mid = (maxAlpha - minAlpha) / 14;
+        int thresholds[7];
+        thresholds[0] = minAlpha + mid;
+        for (int k = 1; k < 7; ++k)
+            thresholds[k] = ((7 - k) * maxAlpha + k * minAlpha) / 7 + mid;
+
+        int indices[16];
+#if defined(LIDXTCOMPRESSOR_AVX2)
+        const __m256i two = _mm256_set1_epi32(2);
+        const __m256i seven = _mm256_set1_epi32(7);
+        const __m256i one = _mm256_set1_epi32(1);
+        for (int half = 0; half < 2; ++half)
+        {
+            __m256i a = _mm256_srli_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + half * 32)), 24);
+            __m256i count = _mm256_set1_epi32(8);
+            for (int k = 0; k < 7; ++k)
+                count = _mm256_add_epi32(count, _mm256_cmpgt_epi32(a, _mm256_set1_epi32(thresholds[k])));
+            __m256i index = _mm256_and_si256(count, seven);
+            index = _mm256_xor_si256(index, _mm256_and_si256(_mm256_cmpgt_epi32(two, index), one));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(indices + half * 8), index);
+        }
+#elif defined(LIDXTCOMPRESSOR_SSE2)
+        const __m128i two = _mm_set1_epi32(2);
+        const __m128i seven = _mm_set1_epi32(7);
+        const __m128i one = _mm_set1_epi32(1);
+        for (int quarter = 0; quarter < 4; ++quarter)
+        {
+            __m128i a = _mm_srli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(block + quarter * 16)), 24);
+            __m128i count = _mm_set1_epi32(8);
+            for (int k = 0; k < 7; ++k)
+                count = _mm_add_epi32(count, _mm_cmpgt_epi32(a, _mm_set1_epi32(thresholds[k])));
+            __m128i index = _mm_and_si128(count, seven);
+            index = _mm_xor_si128(index, _mm_and_si128(_mm_cmpgt_epi32(two, index), one));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(indices + quarter * 4), index);
+        }
+#else
+        for (int i = 0; i < 16; ++i)
+        {
+            int a = block[i * 4 + 3];
+            int count = 1;
+            for (int k = 0; k < 7; ++k)
+                count += a <= thresholds[k];
+            int index = count & 7;
+            indices[i] = index ^ (2 > index);
+        }
+#endif
+
+        quint64 bits = 0;
+        for (int i = 0; i < 16; ++i)
+            bits |= quint64(indices[i]) << (i * 3);
+
+        out[0] = maxAlpha;
+        out[1] = minAlpha;
+        for (int i = 0; i < 6; ++i)
+            out[2 + i] = quint8(bits >> (i * 8));
+    }
+
+    QThreadPool *m_threadPool;
+    int m_blockRowsPerTask;
+};
+
+#endif // LIDXTCOMPRESSOR_H
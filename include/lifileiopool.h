@@ -0,0 +1,265 @@
+#ifndef LIFILEIOPOOL_H
+#define LIFILEIOPOOL_H
+
+#include "licore_global.h"
+#include "liprocessinstance.h"
+#include "liutils.h"
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief
+ * 本地文件读取线程池，用于替代单线程的LiFileIOThread。
+ * 多个读取线程共享一个按优先级排序的队列，每个线程一次取出一批文件，
+ * 在Unix平台使用pread读取，其他平台使用QFile读取。
+ * 优先级数值越小越先读取，与LiRequest::priority()一致。
+ * 读取失败或文件超过MaximumFileSize时返回的QFuture为canceled状态。
+ * 由应用程序在QCoreApplication之后显式创建（例如与LiEngine同生命周期），第一个创建的对象登记为instance()：
+ * @code
+ * QApplication app(argc, argv);
+ * LiFileIOPool fileIOPool;
+ * @endcode
+ */
+class LiFileIOPool
+{
+public:
+    /**
+     * @brief
+     * QByteArray能容纳的最大文件大小
+     */
+    static const qint64 MaximumFileSize = std::numeric_limits<int>::max() - 64;
+
+    explicit LiFileIOPool(int threadCount = 0, int batchSize = 8)
+        : m_batchSize(qMax(1, batchSize))
+        , m_sequence(0)
+    {
+        if (threadCount <= 0)
+            threadCount = qBound(2, QThread::idealThreadCount(), 8);
+
+        m_running = 1;
+        for (int i = 0; i < threadCount; ++i)
+        {
+            Worker *worker = new Worker(this);
+            m_workers.append(worker);
+            worker->start();
+        }
+
+        LiProcessInstance<LiFileIOPool>::attach(InstanceName, this);
+    }
+
+    ~LiFileIOPool()
+    {
+        LiProcessInstance<LiFileIOPool>::detach(InstanceName, this);
+        shutdown();
+    }
+
+    /**
+     * @brief
+     * 应用程序创建的线程池，没有创建时返回nullptr
+     */
+    static LiFileIOPool *instance()
+    {
+        return LiProcessInstance<LiFileIOPool>::get(InstanceName);
+    }
+
+    void shutdown()
+    {
+        if (!m_running.testAndSetOrdered(1, 0))
+            return;
+
+        m_semaphore.release(m_workers.size());
+        for (Worker *worker : m_workers)
+        {
+            worker->wait();
+            delete worker;
+        }
+        m_workers.clear();
+
+        QMutexLocker locker(&m_mutex);
+        for (Work &work : m_works)
+        {
+            work.promise.reportCanceled();
+            work.promise.reportFinished();
+        }
+        m_works.clear();
+    }
+
+    QFuture<QByteArray> addWork(const QUrl &url, double priority = 0.0)
+    {
+        Work work;
+        work.path = urlToLocalFileOrQrc(url);
+        work.priority = priority;
+        work.promise.reportStarted();
+        QFuture<QByteArray> future = work.promise.future();
+
+        if (work.path.isEmpty() || !m_running.load())
+        {
+            work.promise.reportCanceled();
+            work.promise.reportFinished();
+            return future;
+        }
+
+        {
+            QMutexLocker locker(&m_mutex);
+            work.sequence = m_sequence++;
+            m_works.push_back(work);
+            std::push_heap(m_works.begin(), m_works.end(), Later());
+        }
+        m_semaphore.release();
+
+        return future;
+    }
+
+    int workCount()
+    {
+        QMutexLocker locker(&m_mutex);
+        return int(m_works.size());
+    }
+
+    int threadCount() const { return m_workers.size(); }
+
+private:
+    static constexpr const char *InstanceName = "_li_fileIOPool";
+
+    struct Work
+    {
+        QString path;
+        double priority = 0.0;
+        quint64 sequence = 0;
+        QFutureInterface<QByteArray> promise;
+    };
+
+    struct Later
+    {
+        bool operator ()(const Work &a, const Work &b) const
+        {
+            if (a.priority != b.priority)
+                return a.priority > b.priority;
+            return a.sequence > b.sequence;
+        }
+    };
+
+    class Worker : public QThread
+    {
+    public:
+        explicit Worker(LiFileIOPool *pool) : m_pool(pool) {}
+
+    protected:
+        void run() override { m_pool->process(); }
+
+    private:
+        LiFileIOPool *m_pool;
+    };
+
+    void process()
+    {
+        std::vector<Work> batch;
+        batch.reserve(m_batchSize);
+
+        for (;;)
+        {
+            m_semaphore.acquire();
+            if (!m_running.load())
+                break;
+
+            {
+                // 一次取出一批优先级最高的文件，减少加锁次数
+                QMutexLocker locker(&m_mutex);
+                int count = 1;
+                while (count < m_batchSize && m_semaphore.tryAcquire())
+                {
+                    ++count;
+                }
+
+                for (int i = 0; i < count && !m_works.empty(); ++i)
+                {
+                    std::pop_heap(m_works.begin(), m_works.end(), Later());
+                    batch.push_back(m_works.back());
+                    m_works.pop_back();
+                }
+            }
+
+            for (Work &work : batch)
+            {
+                if (!work.promise.isCanceled())
+                {
+                    QByteArray data;
+                    if (readFile(work.path, &data))
+                        work.promise.reportResult(data);
+                    else
+                        work.promise.reportCanceled();
+                }
+                work.promise.reportFinished();
+            }
+            batch.clear();
+        }
+    }
+
+    static bool readFile(const QString &path, QByteArray *data)
+    {
+#ifdef Q_OS_UNIX
+        if (!path.startsWith(QLatin1Char(':')))
+        {
+            int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                return false;
+
+            struct stat st;
+            if (::fstat(fd, &st) != 0)
+            {
+                ::close(fd);
+                return false;
+            }
+
+            if (st.st_size > MaximumFileSize)
+            {
+                qWarning() << "LiFileIOPool: file too large" << path << st.st_size;
+                ::close(fd);
+                return false;
+            }
+
+            data->resize(int(st.st_size));
+            qint64 offset = 0;
+            while (offset < st.st_size)
+            {
+                ssize_t n = ::pread(fd, data->data() + offset, size_t(st.st_size - offset), off_t(offset));
+                if (n <= 0)
+                    break;
+                offset += n;
+            }
+            ::close(fd);
+
+            return offset == st.st_size;
+        }
+#endif
+        QFile file(path);
+        if (!file.open(QFile::ReadOnly))
+            return false;
+
+        if (file.size() > MaximumFileSize)
+        {
+            qWarning() << "LiFileIOPool: file too large" << path << file.size();
+            return false;
+        }
+
+        *data = file.readAll();
+        return true;
+    }
+
+    int m_batchSize;
+    quint64 m_sequence;
+    QAtomicInt m_running;
+    QSemaphore m_semaphore;
+    QMutex m_mutex;
+    std::vector<Work> m_works;
+    QVector<Worker *> m_workers;
+};
+
+#endif // LIFILEIOPOOL_H
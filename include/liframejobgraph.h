@@ -0,0 +1,362 @@
+#ifndef LIFRAMEJOBGRAPH_H
+#define LIFRAMEJOBGRAPH_H
+
+#include "licore_global.h"
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <functional>
+
+/**
+ * @brief
+ * 帧任务图。system和behavior的每帧工作注册为任务，并声明读写的资源，
+ * 按注册顺序由读写冲突（写后读、读后写、写后写）推导依赖关系，互不冲突的任务在线程池中并行执行。
+ * 需要访问QObject或OpenGL的任务标记为MainThread，在调用wait()的线程中执行。
+ * 与LiFrameSnapshot配合可以让下一帧的逻辑和瓦片遍历与当前帧的渲染提交重叠：
+ * @code
+ * graph.start();                  // 第N+1帧的任务写入snapshot.back()
+ * submit(snapshot.front());       // 主线程提交第N帧
+ * graph.wait();
+ * snapshot.publish();
+ * @endcode
+ */
+class LiFrameJobGraph
+{
+public:
+    typedef std::function<void()> JobFunction;
+
+    enum Affinity
+    {
+        AnyThread,
+        MainThread
+    };
+
+    struct Statistics
+    {
+        int jobCount = 0;
+        qint64 wallTime = 0;        ///< start()到wait()返回的时间，单位为纳秒
+        qint64 busyTime = 0;        ///< 所有任务执行时间之和
+        qint64 criticalPath = 0;    ///< 依赖链上最长的执行时间
+    };
+
+    explicit LiFrameJobGraph(QThreadPool *threadPool = QThreadPool::globalInstance())
+        : m_threadPool(threadPool)
+        , m_compiled(false)
+        , m_running(false)
+    {
+    }
+
+    ~LiFrameJobGraph()
+    {
+        if (m_running)
+            wait();
+    }
+
+    QThreadPool *threadPool() const { return m_threadPool; }
+    void setThreadPool(QThreadPool *pool) { m_threadPool = pool; }
+
+    /**
+     * @brief
+     * 按名称返回资源的编号，同名资源编号相同
+     */
+    int resource(const QString &name)
+    {
+        auto it = m_resources.constFind(name);
+        if (it != m_resources.constEnd())
+            return it.value();
+        int id = m_resources.size();
+        m_resources.insert(name, id);
+        return id;
+    }
+
+    /**
+     * @brief
+     * 添加任务，任务在每次run()时执行一次
+     * @return 任务编号
+     */
+    int addJob(const QString &name, const JobFunction &function,
+               const QVector<int> &reads = QVector<int>(),
+               const QVector<int> &writes = QVector<int>(),
+               Affinity affinity = AnyThread)
+    {
+        Q_ASSERT(!m_running);
+        Job job;
+        job.name = name;
+        job.function = function;
+        job.reads = reads;
+        job.writes = writes;
+        job.affinity = affinity;
+        m_jobs.append(job);
+        m_compiled = false;
+        return m_jobs.size() - 1;
+    }
+
+    /**
+     * @brief
+     * 添加资源之外的显式依赖
+     */
+    void addDependency(int before, int after)
+    {
+        Q_ASSERT(before < after);
+        m_explicit.append(qMakePair(before, after));
+        m_compiled = false;
+    }
+
+    void clear()
+    {
+        Q_ASSERT(!m_running);
+        m_jobs.clear();
+        m_explicit.clear();
+        m_resources.clear();
+        m_compiled = false;
+    }
+
+    int jobCount() const { return m_jobs.size(); }
+    QString jobName(int job) const { return m_jobs[job].name; }
+    QVector<int> dependencies(int job) { compile(); return m_jobs[job].predecessors; }
+    bool isRunning() const { return m_running; }
+    const Statistics &statistics() const { return m_statistics; }
+
+    void run()
+    {
+        start();
+        wait();
+    }
+
+    /**
+     * @brief
+     * 开始执行，没有依赖的任务立即分发到线程池，主线程任务在wait()中执行
+     */
+    void start()
+    {
+        Q_ASSERT(!m_running);
+        compile();
+
+        m_running = true;
+        m_timer.start();
+        m_remaining.store(m_jobs.size());
+        for (Job &job : m_jobs)
+        {
+            job.pending.store(job.predecessors.size());
+            job.finishTime = 0;
+            job.duration = 0;
+        }
+
+        for (int i = 0; i < m_jobs.size(); ++i)
+        {
+            if (m_jobs[i].predecessors.isEmpty())
+                dispatch(i);
+        }
+    }
+
+    /**
+     * @brief
+     * 在当前线程中执行主线程任务，直到所有任务完成
+     */
+    void wait()
+    {
+        if (!m_running)
+            return;
+
+        for (;;)
+        {
+            int job = -1;
+            {
+                QMutexLocker locker(&m_mutex);
+                while (m_mainQueue.isEmpty() && m_remaining.load() > 0)
+                    m_condition.wait(&m_mutex);
+                if (m_mainQueue.isEmpty())
+                    break;
+                job = m_mainQueue.takeFirst();
+            }
+            execute(job);
+        }
+
+        m_running = false;
+        m_statistics.jobCount = m_jobs.size();
+        m_statistics.wallTime = m_timer.nsecsElapsed();
+        m_statistics.busyTime = 0;
+        m_statistics.criticalPath = 0;
+        for (const Job &job : m_jobs)
+        {
+            m_statistics.busyTime += job.duration;
+            m_statistics.criticalPath = qMax(m_statistics.criticalPath, job.finishTime);
+        }
+    }
+
+private:
+    struct Job
+    {
+        QString name;
+        JobFunction function;
+        QVector<int> reads;
+        QVector<int> writes;
+        Affinity affinity = AnyThread;
+        QVector<int> predecessors;
+        QVector<int> successors;
+        QAtomicInt pending;
+        qint64 duration = 0;
+        qint64 finishTime = 0;      ///< 依赖链上的累计执行时间
+
+        Job() {}
+        Job(const Job &other)
+            : name(other.name), function(other.function), reads(other.reads), writes(other.writes)
+            , affinity(other.affinity), predecessors(other.predecessors), successors(other.successors)
+            , duration(other.duration), finishTime(other.finishTime)
+        {
+        }
+        Job &operator =(const Job &other)
+        {
+            name = other.name;
+            function = other.function;
+            reads = other.reads;
+            writes = other.writes;
+            affinity = other.affinity;
+            predecessors = other.predecessors;
+            successors = other.successors;
+            duration = other.duration;
+            finishTime = other.finishTime;
+            return *this;
+        }
+    };
+
+    class Runnable : public QRunnable
+    {
+    public:
+        Runnable(LiFrameJobGraph *graph, int job) : m_graph(graph), m_job(job) {}
+        void run() override { m_graph->execute(m_job); }
+
+    private:
+        LiFrameJobGraph *m_graph;
+        int m_job;
+    };
+
+    static bool intersects(const QVector<int> &a, const QVector<int> &b)
+    {
+        for (int x : a)
+        {
+            if (b.contains(x))
+                return true;
+        }
+        return false;
+    }
+
+    void compile()
+    {
+        if (m_compiled)
+            return;
+
+        for (Job &job : m_jobs)
+        {
+            job.predecessors.clear();
+            job.successors.clear();
+        }
+
+        for (int j = 0; j < m_jobs.size(); ++j)
+        {
+            Job &job = m_jobs[j];
+            for (int i = 0; i < j; ++i)
+            {
+                const Job &before = m_jobs[i];
+                if (intersects(before.writes, job.reads)
+                        || intersects(before.writes, job.writes)
+                        || intersects(before.reads, job.writes))
+                {
+                    job.predecessors.append(i);
+                }
+            }
+        }
+
+        for (const auto &dependency : m_explicit)
+        {
+            QVector<int> &predecessors = m_jobs[dependency.second].predecessors;
+            if (!predecessors.contains(dependency.first))
+                predecessors.append(dependency.first);
+        }
+
+        for (int j = 0; j < m_jobs.size(); ++j)
+        {
+            for (int i : m_jobs[j].predecessors)
+                m_jobs[i].successors.append(j);
+        }
+        m_compiled = true;
+    }
+
+    void dispatch(int job)
+    {
+        if (m_jobs[job].affinity == MainThread || !m_threadPool)
+        {
+            QMutexLocker locker(&m_mutex);
+            m_mainQueue.append(job);
+            m_condition.wakeAll();
+            return;
+        }
+
+        Runnable *runnable = new Runnable(this, job);
+        runnable->setAutoDelete(true);
+        m_threadPool->start(runnable);
+    }
+
+    void execute(int index)
+    {
+        Job &job = m_jobs[index];
+
+        qint64 ready = 0;
+        for (int i : job.predecessors)
+            ready = qMax(ready, m_jobs[i].finishTime);
+
+        QElapsedTimer timer;
+        timer.start();
+        if (job.function)
+            job.function();
+        job.duration = timer.nsecsElapsed();
+        job.finishTime = ready + job.duration;
+
+        for (int successor : job.successors)
+        {
+            if (!m_jobs[successor].pending.deref())
+                dispatch(successor);
+        }
+
+        // 在锁内计数，保证wait()返回后工作线程不再访问本对象
+        QMutexLocker locker(&m_mutex);
+        if (!m_remaining.deref())
+            m_condition.wakeAll();
+    }
+
+    QThreadPool *m_threadPool;
+    QVector<Job> m_jobs;
+    QVector<QPair<int, int>> m_explicit;
+    QHash<QString, int> m_resources;
+    bool m_compiled;
+    bool m_running;
+
+    QAtomicInt m_remaining;
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    QList<int> m_mainQueue;
+    QElapsedTimer m_timer;
+    Statistics m_statistics;
+};
+
+/**
+ * @brief
+ * 双缓冲的帧数据。下一帧的任务写入back()，渲染读取front()，两边都完成后调用publish()交换。
+ */
+template <typename T>
+class LiFrameSnapshot
+{
+public:
+    LiFrameSnapshot() : m_back(0) {}
+
+    T &back() { return m_buffers[m_back]; }
+    const T &front() const { return m_buffers[1 - m_back]; }
+
+    void publish() { m_back = 1 - m_back; }
+
+private:
+    T m_buffers[2];
+    int m_back;
+};
+
+#endif // LIFRAMEJOBGRAPH_H
@@ -0,0 +1,283 @@
+#ifndef LIIMAGEDECODEPIPELINE_H
+#define LIIMAGEDECODEPIPELINE_H
+
+#include "licore_global.h"
+#include "liimagedata.h"
+#include "litextureutil.h"
+#include "litextureimage.h"
+#include "lidxtcompressor.h"
+#include "liprocessinstance.h"
+#include <QtConcurrent>
+#include <QImageReader>
+#include <QBuffer>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LIIMAGEDECODE_SSE2 1
+#endif
+
+/**
+ * @brief
+ * 影像解码流水线。PNG/JPEG的解码、转换为RGBA8888、垂直镜像、生成MipMap链以及可选的DXT压缩（LiDXTCompressor）都在线程池中完成，
+ * 渲染线程拿到的LiImageData已经是最终的纹理数据，只需要apply()到LiTextureImage后上传。
+ * 避免大量影像瓦片在同一帧到达时在主线程中集中解码和转换造成卡顿。
+ * 由应用程序在QCoreApplication之后显式创建，第一个创建的对象登记为instance()。
+ * 销毁时还在排队的任务不再执行，返回的QFuture为canceled状态。
+ */
+class LiImageDecodePipeline
+{
+public:
+    struct Options
+    {
+        bool mirrored = false;          ///< 是否垂直镜像
+        bool mipmaps = true;            ///< 是否生成MipMap链
+        bool compress = false;          ///< 是否进行DXT压缩
+        int skipMipLevels = 0;          ///< 跳过的MipMap层数
+    };
+
+    typedef QSharedPointer<LiImageData> ImageDataPtr;
+
+    explicit LiImageDecodePipeline(int threadCount = 0)
+    {
+        if (threadCount <= 0)
+            threadCount = qBound(1, QThread::idealThreadCount() - 1, 8);
+        m_threadPool.setMaxThreadCount(threadCount);
+
+        LiProcessInstance<LiImageDecodePipeline>::attach(InstanceName, this);
+    }
+
+    ~LiImageDecodePipeline()
+    {
+        LiProcessInstance<LiImageDecodePipeline>::detach(InstanceName, this);
+        m_threadPool.clear();
+        m_threadPool.waitForDone();
+    }
+
+    /**
+     * @brief
+     * 应用程序创建的流水线，没有创建时返回nullptr
+     */
+    static LiImageDecodePipeline *instance()
+    {
+        return LiProcessInstance<LiImageDecodePipeline>::get(InstanceName);
+    }
+
+    QThreadPool *threadPool() { return &m_threadPool; }
+
+    /**
+     * @brief
+     * 在线程池中解码压缩的图像数据并生成纹理数据，失败时结果为空指针
+     * @param priority 线程池中的优先级，数值越大越先处理
+     */
+    QFuture<ImageDataPtr> decode(const QByteArray &encoded, const Options &options = Options(), int priority = 0)
+    {
+        return run(priority, [encoded, options]() {
+            QBuffer buffer;
+            buffer.setData(encoded);
+            buffer.open(QIODevice::ReadOnly);
+
+            QImageReader reader(&buffer);
+            QImage image;
+            if (!reader.read(&image))
+                return ImageDataPtr();
+            return prepare(image, options);
+        });
+    }
+
+    /**
+     * @brief
+     * 在线程池中把已经解码的图像转换为纹理数据
+     */
+    QFuture<ImageDataPtr> convert(const QImage &image, const Options &options = Options(), int priority = 0)
+    {
+        return run(priority, [image, options]() {
+            return prepare(image, options);
+        });
+    }
+
+    /**
+     * @brief
+     * 转换为纹理数据，在当前线程中执行
+     */
+    static ImageDataPtr prepare(const QImage &source, const Options &options)
+    {
+        if (source.isNull())
+            return ImageDataPtr();
+
+        QImage image = source.convertToFormat(QImage::Format_RGBA8888);
+        if (options.mirrored)
+            image = image.mirrored();
+        if (options.skipMipLevels > 0)
+            image = LiTextureUtil::skipMipLevels(image, options.skipMipLevels);
+
+        const int width = image.width();
+        const int height = image.height();
+        const int mipLevels = options.mipmaps ? LiTextureUtil::maximumMipLevels(width, height) : 1;
+
+        ImageDataPtr data(new LiImageData);
+        data->width = width;
+        data->height = height;
+        data->depth = 1;
+        data->faces = 1;
+        data->layers = 1;
+        data->mipLevels = mipLevels;
+        data->blockSize = 4;
+        data->hasAlpha = source.hasAlphaChannel();
+        data->isCompressed = false;
+        data->target = QOpenGLTexture::Target2D;
+        data->textureFormat = QOpenGLTexture::RGBA8_UNorm;
+        data->pixelFormat = QOpenGLTexture::RGBA;
+        data->pixelType = QOpenGLTexture::UInt8;
+        int size = 0;
+        for (int level = 0; level < mipLevels; ++level)
+            size += qMax(1, width >> level) * qMax(1, height >> level) * 4;
+        data->imageData.resize(size);
+
+        quint8 *out = reinterpret_cast<quint8 *>(data->imageData.data());
+        for (int y = 0; y < height; ++y)
+            memcpy(out + y * width * 4, image.constScanLine(y), size_t(width) * 4);
+
+        int levelWidth = width;
+        int levelHeight = height;
+        for (int level = 1; level < mipLevels; ++level)
+        {
+            quint8 *next = out + levelWidth * levelHeight * 4;
+            downsample(out, levelWidth, levelHeight, next);
+            out = next;
+            levelWidth = qMax(1, levelWidth / 2);
+            levelHeight = qMax(1, levelHeight / 2);
+        }
+
+        // 已经在线程池中，压缩在当前线程中完成
+        if (options.compress)
+            return LiDXTCompressor(nullptr).compress(*data, data->hasAlpha ? LiDXTCompressor::DXT5 : LiDXTCompressor::DXT1);
+        return data;
+    }
+
+    /**
+     * @brief
+     * 把纹理数据填充到LiTextureImage，在主线程中调用，之后只需上传
+     */
+    static void apply(LiTextureImage *textureImage, const LiImageData &data)
+    {
+        textureImage->setWidth(data.width);
+        textureImage->setHeight(data.height);
+        textureImage->setDepth(data.depth);
+        textureImage->setFaces(data.faces);
+        textureImage->setLayers(data.layers);
+        textureImage->setMipLevels(data.mipLevels);
+        textureImage->setAutoMipMaps(false);
+        textureImage->setHasAlpha(data.hasAlpha);
+        textureImage->setTarget(data.target);
+        textureImage->setTextureFormat(data.textureFormat);
+        textureImage->setPixelFormat(data.pixelFormat);
+        textureImage->setPixelType(data.pixelType);
+        textureImage->setData(data.imageData, data.blockSize, data.isCompressed);
+    }
+
+    /**
+     * @brief
+     * 2x2盒式滤波生成下一层MipMap，尺寸为奇数时丢弃最后一行或一列
+     */
+    static void downsample(const quint8 *src, int width, int height, quint8 *dst)
+    {
+        const int dstWidth = qMax(1, width / 2);
+        const int dstHeight = qMax(1, height / 2);
+        const int stride = width * 4;
+
+        for (int y = 0; y < dstHeight; ++y)
+        {
+            const quint8 *row0 = src + qMin(y * 2, height - 1) * stride;
+            const quint8 *row1 = src + qMin(y * 2 + 1, height - 1) * stride;
+            quint8 *out = dst + y * dstWidth * 4;
+            int x = 0;
+
+#if defined(LIIMAGEDECODE_SSE2)
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i two = _mm_set1_epi16(2);
+            for (; x + 4 <= dstWidth; x += 4)
+            {
+                // 每次处理两行各8个像素，得到4个像素
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + x * 8));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + x * 8 + 16));
+                __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + x * 8));
+                __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + x * 8 + 16));
+
+                // 先纵向相加，再把相邻的两个像素相加
+                __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(c, zero));
+                __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(c, zero));
+                __m128i sum0 = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+
+                lo = _mm_add_epi16(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(d, zero));
+                hi = _mm_add_epi16(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(d, zero));
+                __m128i sum1 = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+
+                sum0 = _mm_srli_epi16(_mm_add_epi16(sum0, two), 2);
+                sum1 = _mm_srli_epi16(_mm_add_epi16(sum1, two), 2);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x * 4), _mm_packus_epi16(sum0, sum1));
+            }
+#endif
+
+            for (; x < dstWidth; ++x)
+            {
+                int x0 = qMin(x * 2, width - 1) * 4;
+                int x1 = qMin(x * 2 + 1, width - 1) * 4;
+                for (int c = 0; c < 4; ++c)
+                {
+                    int sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c];
+                    out[x * 4 + c] = quint8((sum + 2) >> 2);
+                }
+            }
+        }
+    }
+
+private:
+    template <typename Func>
+    QFuture<ImageDataPtr> run(int priority, Func func)
+    {
+        QFutureInterface<ImageDataPtr> *promise = new QFutureInterface<ImageDataPtr>();
+        promise->reportStarted();
+        QFuture<ImageDataPtr> future = promise->future();
+
+        Task<Func> *task = new Task<Func>(promise, func);
+        m_threadPool.start(task, priority);
+        return future;
+    }
+
+    template <typename Func>
+    class Task : public QRunnable
+    {
+    public:
+        Task(QFutureInterface<ImageDataPtr> *promise, Func func) : m_promise(promise), m_func(func), m_finished(false) {}
+
+        ~Task()
+        {
+            // QThreadPool::clear()删除了还没有执行的任务
+            if (!m_finished)
+            {
+                m_promise->reportCanceled();
+                m_promise->reportFinished();
+            }
+            delete m_promise;
+        }
+
+        void run() override
+        {
+            if (!m_promise->isCanceled())
+                m_promise->reportResult(m_func());
+            m_promise->reportFinished();
+            m_finished = true;
+        }
+
+    private:
+        QFutureInterface<ImageDataPtr> *m_promise;
+        Func m_func;
+        bool m_finished;
+    };
+
+    static constexpr const char *InstanceName = "_li_imageDecodePipeline";
+
+    QThreadPool m_threadPool;
+};
+
+#endif // LIIMAGEDECODEPIPELINE_H
@@ -0,0 +1,724 @@
+#ifndef LIIMPLICITTILING_H
+#define LIIMPLICITTILING_H
+
+#include "licore_global.h"
+#include "lifilesystem.h"
+#include "liutils.h"
+#include "asyncfuture.h"
+#include <QtEndian>
+
+/**
+ * @brief
+ * 隐式瓦片坐标，四叉树时z始终为0
+ */
+struct LiImplicitTileCoord
+{
+    int level = 0;
+    quint32 x = 0;
+    quint32 y = 0;
+    quint32 z = 0;
+
+    LiImplicitTileCoord() {}
+    LiImplicitTileCoord(int l, quint32 tx, quint32 ty, quint32 tz = 0)
+        : level(l), x(tx), y(ty), z(tz)
+    {
+    }
+
+    bool operator ==(const LiImplicitTileCoord &other) const
+    {
+        return level == other.level && x == other.x && y == other.y && z == other.z;
+    }
+
+    LiImplicitTileCoord parent() const
+    {
+        return LiImplicitTileCoord(level - 1, x >> 1, y >> 1, z >> 1);
+    }
+
+    /**
+     * @brief
+     * 第index个子瓦片，index的第0、1、2位分别对应x、y、z方向
+     */
+    LiImplicitTileCoord child(int index) const
+    {
+        return LiImplicitTileCoord(level + 1,
+                                   (x << 1) | (index & 1),
+                                   (y << 1) | ((index >> 1) & 1),
+                                   (z << 1) | ((index >> 2) & 1));
+    }
+
+    /**
+     * @brief
+     * 相对于ancestor的坐标，ancestor.level不能大于level
+     */
+    LiImplicitTileCoord relativeTo(const LiImplicitTileCoord &ancestor) const
+    {
+        int d = level - ancestor.level;
+        return LiImplicitTileCoord(d,
+                                   x - (ancestor.x << d),
+                                   y - (ancestor.y << d),
+                                   z - (ancestor.z << d));
+    }
+
+    /**
+     * @brief
+     * Morton序，与可用性位流中的顺序一致
+     */
+    quint64 mortonIndex(bool octree) const
+    {
+        quint64 result = 0;
+        for (int i = 0; i < level; ++i)
+        {
+            if (octree)
+            {
+                result |= quint64((x >> i) & 1) << (3 * i);
+                result |= quint64((y >> i) & 1) << (3 * i + 1);
+                result |= quint64((z >> i) & 1) << (3 * i + 2);
+            }
+            else
+            {
+                result |= quint64((x >> i) & 1) << (2 * i);
+                result |= quint64((y >> i) & 1) << (2 * i + 1);
+            }
+        }
+        return result;
+    }
+
+};
+
+/**
+ * @brief
+ * 按完整坐标计算哈希，QHash中相等比较使用operator ==，不同层级的瓦片不会冲突
+ */
+inline uint qHash(const LiImplicitTileCoord &coord, uint seed = 0)
+{
+    uint h = ::qHash(coord.level, seed);
+    h = h * 31 + ::qHash(coord.x, seed);
+    h = h * 31 + ::qHash(coord.y, seed);
+    h = h * 31 + ::qHash(coord.z, seed);
+    return h;
+}
+
+/**
+ * @brief
+ * 可用性信息，常量或者位流
+ */
+class LiImplicitAvailability
+{
+public:
+    LiImplicitAvailability() {}
+
+    bool isValid() const { return m_valid; }
+
+    bool isAvailable(quint64 index) const
+    {
+        if (m_constant >= 0)
+            return m_constant != 0;
+
+        quint64 byte = index >> 3;
+        if (byte >= quint64(m_bits.size()))
+            return false;
+        return (quint8(m_bits.at(int(byte))) >> (index & 7)) & 1;
+    }
+
+    /**
+     * @brief
+     * 解析tileAvailability、contentAvailability或childSubtreeAvailability
+     * @param json 可用性对象
+     * @param bufferViews 已解析的bufferView数据
+     */
+    static LiImplicitAvailability fromJson(const QJsonObject &json, const QVector<QByteArray> &bufferViews)
+    {
+        LiImplicitAvailability availability;
+        if (json.contains("constant"))
+        {
+            availability.m_constant = json["constant"].toInt();
+            availability.m_valid = true;
+        }
+        else
+        {
+            // 1.0扩展中使用bufferView，1.1中使用bitstream
+            int view = json.contains("bitstream") ? json["bitstream"].toInt(-1) : json["bufferView"].toInt(-1);
+            if (view >= 0 && view < bufferViews.size())
+            {
+                availability.m_bits = bufferViews.at(view);
+                availability.m_valid = true;
+            }
+        }
+        return availability;
+    }
+
+private:
+    int m_constant = -1;
+    bool m_valid = false;
+    QByteArray m_bits;
+};
+
+/**
+ * @brief
+ * 子树，保存子树内瓦片、内容以及子子树的可用性。
+ * 二进制子树文件的缓冲区通过QByteArray::fromRawData引用文件数据，m_data需要一直保留。
+ */
+class LiImplicitSubtree
+{
+public:
+    LiImplicitSubtree(const LiImplicitTileCoord &root)
+        : m_root(root)
+        , m_lastUsedFrame(0)
+    {
+    }
+
+    const LiImplicitTileCoord &root() const { return m_root; }
+
+    const LiImplicitAvailability &tileAvailability() const { return m_tileAvailability; }
+    const LiImplicitAvailability &contentAvailability() const { return m_contentAvailability; }
+    const LiImplicitAvailability &childSubtreeAvailability() const { return m_childSubtreeAvailability; }
+
+    quint32 lastUsedFrame() const { return m_lastUsedFrame; }
+    void setLastUsedFrame(quint32 frame) { m_lastUsedFrame = frame; }
+
+    /**
+     * @brief
+     * 解析子树文件的json部分，外部缓冲区需要事先加载
+     * @param json 子树json
+     * @param internal 二进制子树文件中的内部缓冲区
+     * @param externals 按buffers顺序排列的外部缓冲区，内部缓冲区对应位置为空
+     */
+    bool parse(const QJsonObject &json, const QByteArray &internal, const QVector<QByteArray> &externals)
+    {
+        QJsonArray buffers = json["buffers"].toArray();
+        QVector<QByteArray> bufferData(buffers.size());
+        for (int i = 0; i < buffers.size(); ++i)
+        {
+            QJsonObject buffer = buffers.at(i).toObject();
+            bufferData[i] = buffer.contains("uri") ? externals.value(i) : internal;
+        }
+
+        QJsonArray views = json["bufferViews"].toArray();
+        QVector<QByteArray> viewData(views.size());
+        for (int i = 0; i < views.size(); ++i)
+        {
+            QJsonObject view = views.at(i).toObject();
+            const QByteArray &buffer = bufferData.value(view["buffer"].toInt());
+            int offset = view["byteOffset"].toInt();
+            int length = view["byteLength"].toInt();
+            if (offset < 0 || length < 0 || offset + length > buffer.size())
+                return false;
+            viewData[i] = QByteArray::fromRawData(buffer.constData() + offset, length);
+        }
+
+        m_tileAvailability = LiImplicitAvailability::fromJson(json["tileAvailability"].toObject(), viewData);
+
+        QJsonValue content = json["contentAvailability"];
+        if (content.isArray())
+            content = content.toArray().isEmpty() ? QJsonValue() : content.toArray().at(0);
+        if (content.isObject())
+            m_contentAvailability = LiImplicitAvailability::fromJson(content.toObject(), viewData);
+
+        m_childSubtreeAvailability = LiImplicitAvailability::fromJson(json["childSubtreeAvailability"].toObject(), viewData);
+
+        return m_tileAvailability.isValid() && m_childSubtreeAvailability.isValid();
+    }
+
+    /**
+     * @brief
+     * 保留缓冲区数据，fromRawData视图依赖这些数据
+     */
+    void retain(const QByteArray &data) { m_data.append(data); }
+
+private:
+    LiImplicitTileCoord m_root;
+    LiImplicitAvailability m_tileAvailability;
+    LiImplicitAvailability m_contentAvailability;
+    LiImplicitAvailability m_childSubtreeAvailability;
+    QVector<QByteArray> m_data;
+    quint32 m_lastUsedFrame;
+};
+
+/**
+ * @brief
+ * 3DTiles隐式瓦片（implicitTiling，或1.0中的3DTILES_implicit_tiling扩展）。
+ * 只保存根瓦片的json和已加载的子树，瓦片的包围体、几何误差和内容地址由坐标计算得到；
+ * 遍历到子树根节点时才请求对应的子树文件，视野外的瓦片不会创建任何对象。
+ * header()生成的json可以直接用来创建Li3DTile。
+ */
+class LiImplicitTileset
+{
+public:
+    enum Availability
+    {
+        Unknown,        /**< 所在子树尚未加载 */
+        Unavailable,
+        Available
+    };
+
+    LiImplicitTileset(const QUrl &baseUrl, const QJsonObject &tileJson)
+        : m_baseUrl(baseUrl)
+        , m_tileJson(tileJson)
+        , m_octree(false)
+        , m_subtreeLevels(0)
+        , m_availableLevels(0)
+        , m_geometricError(tileJson["geometricError"].toDouble())
+        , m_alive(new int(0))
+    {
+        m_clock.start();
+
+        QJsonObject implicit = tileJson["implicitTiling"].toObject();
+        if (implicit.isEmpty())
+            implicit = tileJson["extensions"].toObject()["3DTILES_implicit_tiling"].toObject();
+
+        m_octree = implicit["subdivisionScheme"].toString() == QLatin1String("OCTREE");
+        m_subtreeLevels = implicit["subtreeLevels"].toInt();
+        m_availableLevels = implicit.contains("availableLevels") ? implicit["availableLevels"].toInt()
+                                                                 : implicit["maximumLevel"].toInt() + 1;
+
+        QJsonObject subtrees = implicit["subtrees"].toObject();
+        m_subtreeTemplate = subtrees.contains("uri") ? subtrees["uri"].toString() : subtrees["url"].toString();
+
+        QJsonObject content = tileJson["content"].toObject();
+        m_contentTemplate = content.contains("uri") ? content["uri"].toString() : content["url"].toString();
+
+        QJsonObject boundingVolume = tileJson["boundingVolume"].toObject();
+        if (boundingVolume.contains("region"))
+        {
+            m_region = true;
+            m_volume = boundingVolume["region"].toArray();
+        }
+        else
+        {
+            m_region = false;
+            m_volume = boundingVolume["box"].toArray();
+        }
+
+        m_refine = tileJson.contains("refine") ? tileJson["refine"].toString() : QStringLiteral("REPLACE");
+    }
+
+    ~LiImplicitTileset()
+    {
+        qDeleteAll(m_subtrees);
+    }
+
+    /**
+     * @brief
+     * 判断瓦片json是否为隐式瓦片
+     */
+    static bool isImplicit(const QJsonObject &tileJson)
+    {
+        return tileJson.contains("implicitTiling")
+                || tileJson["extensions"].toObject().contains("3DTILES_implicit_tiling");
+    }
+
+    bool isValid() const
+    {
+        return m_subtreeLevels > 0 && m_availableLevels > 0 && !m_subtreeTemplate.isEmpty()
+                && (m_region ? m_volume.size() == 6 : m_volume.size() == 12);
+    }
+
+    bool isOctree() const { return m_octree; }
+    int subtreeLevels() const { return m_subtreeLevels; }
+    int availableLevels() const { return m_availableLevels; }
+    int branchingFactor() const { return m_octree ? 8 : 4; }
+    int subtreeCount() const { return m_subtrees.size(); }
+    int pendingSubtreeCount() const { return m_pending.size(); }
+
+    /**
+     * @brief
+     * 瓦片所在子树的根坐标
+     */
+    LiImplicitTileCoord subtreeRoot(const LiImplicitTileCoord &coord) const
+    {
+        int d = coord.level % m_subtreeLevels;
+        return LiImplicitTileCoord(coord.level - d, coord.x >> d, coord.y >> d, coord.z >> d);
+    }
+
+    /**
+     * @brief
+     * 返回已加载的子树，没有加载时发起请求并返回nullptr
+     */
+    LiImplicitSubtree *subtree(const LiImplicitTileCoord &root)
+    {
+        LiImplicitSubtree *result = m_subtrees.value(root, nullptr);
+        if (!result)
+            requestSubtree(root);
+        return result;
+    }
+
+    Availability tileAvailability(const LiImplicitTileCoord &coord)
+    {
+        if (coord.level >= m_availableLevels)
+            return Unavailable;
+
+        LiImplicitTileCoord root = subtreeRoot(coord);
+        if (coord.level == root.level && coord.level > 0)
+        {
+            // 子树的根瓦片由父子树的childSubtreeAvailability决定。父子树尚未加载或已被释放时先加载父子树，
+            // 不能直接请求可能不存在的子树，否则会因请求失败进入重试等待
+            LiImplicitTileCoord parentRoot = subtreeRoot(root.parent());
+            LiImplicitSubtree *parent = m_subtrees.value(parentRoot, nullptr);
+            if (!parent)
+                return tileAvailability(root.parent()) == Unavailable ? Unavailable : Unknown;
+            if (!parent->childSubtreeAvailability().isAvailable(root.relativeTo(parentRoot).mortonIndex(m_octree)))
+                return Unavailable;
+        }
+
+        LiImplicitSubtree *s = subtree(root);
+        if (!s)
+            return isFailed(root) ? Unavailable : Unknown;
+
+        return s->tileAvailability().isAvailable(indexInSubtree(coord, root)) ? Available : Unavailable;
+    }
+
+    bool hasContent(const LiImplicitTileCoord &coord)
+    {
+        if (m_contentTemplate.isEmpty())
+            return false;
+
+        LiImplicitTileCoord root = subtreeRoot(coord);
+        LiImplicitSubtree *s = m_subtrees.value(root, nullptr);
+        return s && s->contentAvailability().isAvailable(indexInSubtree(coord, root));
+    }
+
+    /**
+     * @brief
+     * 获取可用的子瓦片，子子树尚未加载时发起请求并返回false
+     */
+    bool children(const LiImplicitTileCoord &coord, QVector<LiImplicitTileCoord> *result)
+    {
+        bool complete = true;
+        for (int i = 0; i < branchingFactor(); ++i)
+        {
+            LiImplicitTileCoord c = coord.child(i);
+            Availability availability = tileAvailability(c);
+            if (availability == Available)
+                result->append(c);
+            else if (availability == Unknown)
+                complete = false;
+        }
+        return complete;
+    }
+
+    double geometricError(const LiImplicitTileCoord &coord) const
+    {
+        return m_geometricError / double(quint64(1) << coord.level);
+    }
+
+    QJsonArray boundingVolume(const LiImplicitTileCoord &coord) const
+    {
+        const double n = double(quint64(1) << coord.level);
+        QJsonArray result;
+
+        if (m_region)
+        {
+            double west = m_volume[0].toDouble(), south = m_volume[1].toDouble();
+            double east = m_volume[2].toDouble(), north = m_volume[3].toDouble();
+            double minH = m_volume[4].toDouble(), maxH = m_volume[5].toDouble();
+            double dx = (east - west) / n, dy = (north - south) / n;
+            result.append(west + dx * coord.x);
+            result.append(south + dy * coord.y);
+            result.append(west + dx * (coord.x + 1));
+            result.append(south + dy * (coord.y + 1));
+            if (m_octree)
+            {
+                double dz = (maxH - minH) / n;
+                result.append(minH + dz * coord.z);
+                result.append(minH + dz * (coord.z + 1));
+            }
+            else
+            {
+                result.append(minH);
+                result.append(maxH);
+            }
+            return result;
+        }
+
+        // box: 中心 + 三个半轴
+        double v[12];
+        for (int i = 0; i < 12; ++i)
+        {
+            v[i] = m_volume[i].toDouble();
+        }
+
+        const double t[3] = {
+            2.0 * (coord.x + 0.5) / n - 1.0,
+            2.0 * (coord.y + 0.5) / n - 1.0,
+            m_octree ? 2.0 * (coord.z + 0.5) / n - 1.0 : 0.0
+        };
+        for (int r = 0; r < 3; ++r)
+        {
+            double center = v[r];
+            for (int a = 0; a < 3; ++a)
+            {
+                center += v[3 + a * 3 + r] * t[a];
+            }
+            result.append(center);
+        }
+        for (int a = 0; a < 3; ++a)
+        {
+            double scale = (a < 2 || m_octree) ? 1.0 / n : 1.0;
+            for (int r = 0; r < 3; ++r)
+            {
+                result.append(v[3 + a * 3 + r] * scale);
+            }
+        }
+        return result;
+    }
+
+    QUrl contentUrl(const LiImplicitTileCoord &coord) const
+    {
+        return resolvedQueryUrl(m_baseUrl, QUrl(expand(m_contentTemplate, coord)));
+    }
+
+    QUrl subtreeUrl(const LiImplicitTileCoord &root) const
+    {
+        return resolvedQueryUrl(m_baseUrl, QUrl(expand(m_subtreeTemplate, root)));
+    }
+
+    /**
+     * @brief
+     * 生成创建Li3DTile所需的json，不包含children和implicitTiling
+     */
+    QJsonObject header(const LiImplicitTileCoord &coord)
+    {
+        QJsonObject json;
+        json["geometricError"] = geometricError(coord);
+        json["refine"] = m_refine;
+
+        QJsonObject volume;
+        volume[m_region ? QStringLiteral("region") : QStringLiteral("box")] = boundingVolume(coord);
+        json["boundingVolume"] = volume;
+
+        if (coord.level == 0 && m_tileJson.contains("transform"))
+            json["transform"] = m_tileJson["transform"];
+
+        if (hasContent(coord))
+        {
+            QJsonObject content;
+            content["uri"] = contentUrl(coord).toString();
+            json["content"] = content;
+        }
+
+        return json;
+    }
+
+    /**
+     * @brief
+     * 标记子树在当前帧被使用，配合trimSubtrees释放长时间未使用的子树
+     */
+    void touch(const LiImplicitTileCoord &coord, quint32 frameNumber)
+    {
+        LiImplicitSubtree *s = m_subtrees.value(subtreeRoot(coord), nullptr);
+        if (s)
+            s->setLastUsedFrame(frameNumber);
+    }
+
+    /**
+     * @brief
+     * 释放lastUsedFrame早于frameNumber的子树，根子树始终保留
+     */
+    void trimSubtrees(quint32 frameNumber)
+    {
+        for (auto it = m_subtrees.begin(); it != m_subtrees.end();)
+        {
+            LiImplicitSubtree *s = it.value();
+            if (s->root().level > 0 && s->lastUsedFrame() < frameNumber)
+            {
+                delete s;
+                it = m_subtrees.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    /**
+     * @brief
+     * 请求子树文件，已加载、正在加载或失败后尚未到重试时间时直接返回
+     */
+    void requestSubtree(const LiImplicitTileCoord &root)
+    {
+        if (m_subtrees.contains(root) || m_pending.contains(root) || isFailed(root))
+            return;
+
+        m_pending.insert(root);
+
+        QUrl url = subtreeUrl(root);
+        QWeakPointer<int> alive = m_alive;
+        observe(LiFileSystem::readFile(url)).subscribe([=](QByteArray data) {
+            if (alive)
+                parseSubtree(root, url, data);
+        }, [=]() {
+            if (alive)
+                failSubtree(root);
+        });
+    }
+
+private:
+    quint64 indexInSubtree(const LiImplicitTileCoord &coord, const LiImplicitTileCoord &root) const
+    {
+        LiImplicitTileCoord local = coord.relativeTo(root);
+        const quint64 n = quint64(branchingFactor());
+        quint64 levelOffset = 0;
+        quint64 levelSize = 1;
+        for (int i = 0; i < local.level; ++i)
+        {
+            levelOffset += levelSize;
+            levelSize *= n;
+        }
+        return levelOffset + local.mortonIndex(m_octree);
+    }
+
+    static QString expand(QString uri, const LiImplicitTileCoord &coord)
+    {
+        uri.replace(QLatin1String("{level}"), QString::number(coord.level));
+        uri.replace(QLatin1String("{x}"), QString::number(coord.x));
+        uri.replace(QLatin1String("{y}"), QString::number(coord.y));
+        uri.replace(QLatin1String("{z}"), QString::number(coord.z));
+        return uri;
+    }
+
+    void parseSubtree(const LiImplicitTileCoord &root, const QUrl &url, const QByteArray &data)
+    {
+        QJsonObject json;
+        QByteArray internal;
+
+        // 二进制子树: magic(4) version(4) jsonByteLength(8) binaryByteLength(8)
+        if (data.size() >= 24 && data.startsWith("subt"))
+        {
+            const uchar *p = reinterpret_cast<const uchar *>(data.constData());
+            quint64 jsonLength = qFromLittleEndian<quint64>(p + 8);
+            quint64 binaryLength = qFromLittleEndian<quint64>(p + 16);
+            if (24 + jsonLength + binaryLength > quint64(data.size()))
+            {
+                failSubtree(root);
+                return;
+            }
+            json = QJsonDocument::fromJson(data.mid(24, int(jsonLength))).object();
+            internal = QByteArray::fromRawData(data.constData() + 24 + jsonLength, int(binaryLength));
+        }
+        else
+        {
+            json = QJsonDocument::fromJson(data).object();
+        }
+
+        if (json.isEmpty())
+        {
+            failSubtree(root);
+            return;
+        }
+
+        // 加载外部缓冲区
+        QJsonArray buffers = json["buffers"].toArray();
+        QSharedPointer<QVector<QByteArray>> externals(new QVector<QByteArray>(buffers.size()));
+        QList<QFuture<QByteArray>> futures;
+        for (int i = 0; i < buffers.size(); ++i)
+        {
+            QString uri = buffers.at(i).toObject()["uri"].toString();
+            if (uri.isEmpty())
+                continue;
+
+            if (uri.startsWith(QLatin1String("data:")))
+            {
+                (*externals)[i] = LiFileSystem::dataFromUri(uri);
+                continue;
+            }
+
+            auto future = LiFileSystem::readFile(resolvedQueryUrl(getBaseUrl(url), QUrl(uri)));
+            observe(future).subscribe([=](QByteArray buffer) {
+                (*externals)[i] = buffer;
+            });
+            futures.append(future);
+        }
+
+        auto finish = [=]() {
+            LiImplicitSubtree *s = new LiImplicitSubtree(root);
+            s->retain(data);
+            for (const QByteArray &buffer : *externals)
+            {
+                s->retain(buffer);
+            }
+
+            if (!s->parse(json, internal, *externals))
+            {
+                delete s;
+                failSubtree(root);
+                return;
+            }
+
+            m_pending.remove(root);
+            m_failed.remove(root);
+            m_subtrees.insert(root, s);
+        };
+
+        if (futures.isEmpty())
+        {
+            finish();
+            return;
+        }
+
+        auto combined = combine();
+        for (const auto &f : futures)
+        {
+            combined << f;
+        }
+
+        QWeakPointer<int> alive = m_alive;
+        observe(combined.future()).subscribe([=]() {
+            if (alive)
+                finish();
+        }, [=]() {
+            if (alive)
+                failSubtree(root);
+        });
+    }
+
+    /**
+     * @brief
+     * 加载失败的子树在重试时间之前按不可用处理，每次失败后重试间隔加倍
+     */
+    void failSubtree(const LiImplicitTileCoord &root)
+    {
+        m_pending.remove(root);
+        Failure &failure = m_failed[root];
+        const qint64 delay = qMin(qint64(MaximumRetryDelay), qint64(MinimumRetryDelay) << qMin(failure.attempts, 16));
+        ++failure.attempts;
+        failure.retryTime = m_clock.elapsed() + delay;
+    }
+
+    bool isFailed(const LiImplicitTileCoord &root) const
+    {
+        auto it = m_failed.constFind(root);
+        return it != m_failed.constEnd() && m_clock.elapsed() < it.value().retryTime;
+    }
+
+    enum
+    {
+        MinimumRetryDelay = 1000,   /**< 毫秒 */
+        MaximumRetryDelay = 300000
+    };
+
+    struct Failure
+    {
+        int attempts = 0;
+        qint64 retryTime = 0;
+    };
+
+    QUrl m_baseUrl;
+    QJsonObject m_tileJson;
+    bool m_octree;
+    bool m_region;
+    int m_subtreeLevels;
+    int m_availableLevels;
+    double m_geometricError;
+    QString m_refine;
+    QString m_subtreeTemplate;
+    QString m_contentTemplate;
+    QJsonArray m_volume;
+    QHash<LiImplicitTileCoord, LiImplicitSubtree *> m_subtrees;
+    QSet<LiImplicitTileCoord> m_pending;
+    QHash<LiImplicitTileCoord, Failure> m_failed;
+    QElapsedTimer m_clock;
+    QSharedPointer<int> m_alive;
+};
+
+#endif // LIIMPLICITTILING_H
@@ -0,0 +1,196 @@
+#ifndef LIMAPPEDFILE_H
+#define LIMAPPEDFILE_H
+
+#include "licore_global.h"
+#include "lifilesystem.h"
+#include "liutils.h"
+#include "asyncfuture.h"
+#include "binaryaccessor.h"
+#include <limits>
+
+/**
+ * @brief
+ * 内存映射的本地文件，文件在最后一个引用释放时解除映射。
+ */
+class LiMappedFile
+{
+public:
+    ~LiMappedFile()
+    {
+        if (m_data)
+            m_file.unmap(m_data);
+        m_file.close();
+    }
+
+    /**
+     * @brief
+     * 以只读方式映射整个文件，失败时返回空指针
+     */
+    static QSharedPointer<LiMappedFile> open(const QString &fileName)
+    {
+        QSharedPointer<LiMappedFile> file(new LiMappedFile(fileName));
+        if (!file->m_file.open(QFile::ReadOnly))
+            return QSharedPointer<LiMappedFile>();
+
+        file->m_size = file->m_file.size();
+        if (file->m_size <= 0 || file->m_size > std::numeric_limits<int>::max())
+            return QSharedPointer<LiMappedFile>();
+
+        file->m_data = file->m_file.map(0, file->m_size);
+        if (!file->m_data)
+            return QSharedPointer<LiMappedFile>();
+
+        return file;
+    }
+
+    const char *constData() const { return reinterpret_cast<const char *>(m_data); }
+    qint64 size() const { return m_size; }
+    QString fileName() const { return m_file.fileName(); }
+
+private:
+    explicit LiMappedFile(const QString &fileName)
+        : m_file(fileName)
+        , m_data(nullptr)
+        , m_size(0)
+    {
+    }
+
+    QFile m_file;
+    uchar *m_data;
+    qint64 m_size;
+};
+
+/**
+ * @brief
+ * 文件内容缓冲区。对于本地大文件，data()返回QByteArray::fromRawData指向映射内存的视图，
+ * 不会复制文件内容；使用data()的对象需要同时持有LiMappedBuffer或file()，以保证映射有效。
+ * view()返回的LiArrayView自身持有映射，可以脱离LiMappedBuffer使用。
+ * 对于网络文件、qrc文件和小文件，内部直接保存读取到的QByteArray。
+ */
+class LiMappedBuffer
+{
+public:
+    LiMappedBuffer() {}
+
+    explicit LiMappedBuffer(const QByteArray &data)
+        : m_data(data)
+    {
+    }
+
+    LiMappedBuffer(const QSharedPointer<LiMappedFile> &file, qint64 offset = 0, qint64 length = -1)
+        : m_file(file)
+    {
+        if (!m_file)
+            return;
+
+        offset = qBound(qint64(0), offset, m_file->size());
+        if (length < 0 || offset + length > m_file->size())
+            length = m_file->size() - offset;
+
+        m_data = QByteArray::fromRawData(m_file->constData() + offset, int(length));
+    }
+
+    bool isNull() const { return m_data.isNull(); }
+    bool isMapped() const { return !m_file.isNull(); }
+
+    /**
+     * @brief
+     * 映射的文件，未映射时为空
+     */
+    QSharedPointer<LiMappedFile> file() const { return m_file; }
+    int size() const { return m_data.size(); }
+    const char *constData() const { return m_data.constData(); }
+
+    /**
+     * @brief
+     * 返回不复制内容的QByteArray，注意只能在LiMappedBuffer有效期内使用
+     */
+    QByteArray data() const { return m_data; }
+
+    /**
+     * @brief
+     * 返回子区域，与当前缓冲区共享同一个映射。与QByteArray::mid一样，范围被限制在当前缓冲区内
+     */
+    LiMappedBuffer mid(int position, int length = -1) const
+    {
+        if (!m_file)
+            return LiMappedBuffer(m_data.mid(position, length));
+
+        const int size = m_data.size();
+        if (position < 0)
+        {
+            if (length >= 0)
+                length = qMax(0, length + position);
+            position = 0;
+        }
+        position = qMin(position, size);
+        if (length < 0 || length > size - position)
+            length = size - position;
+
+        qint64 offset = (m_data.constData() - m_file->constData()) + position;
+        return LiMappedBuffer(m_file, offset, length);
+    }
+
+    /**
+     * @brief
+     * 返回从position开始count个T的只读视图，视图持有映射。长度不足或未对齐时复制。
+     */
+    template<typename T>
+    LiArrayView<T> view(int position, int count) const
+    {
+        // 超出缓冲区的部分按0填充
+        const bool inside = position >= 0 && position <= m_data.size();
+        const char *data = m_data.constData() + (inside ? position : 0);
+        int available = inside ? m_data.size() - position : 0;
+        if (available >= int(sizeof(T)) * count && quintptr(data) % alignof(T) == 0)
+            return LiArrayView<T>(m_data, reinterpret_cast<const T *>(data), count, m_file);
+
+        QByteArray copy(int(sizeof(T)) * count, 0);
+        if (available > 0)
+            memcpy(copy.data(), data, size_t(qMin(available, copy.size())));
+        return LiArrayView<T>(copy, reinterpret_cast<const T *>(copy.constData()), count);
+    }
+
+    /**
+     * @brief
+     * 复制为独立的QByteArray，之后不再依赖映射
+     */
+    QByteArray detached() const
+    {
+        return m_file ? QByteArray(m_data.constData(), m_data.size()) : m_data;
+    }
+
+    /**
+     * @brief
+     * 异步读取文件。本地文件大于mappingThreshold时使用内存映射，
+     * 其他情况通过LiFileSystem::readFile读取。
+     */
+    static QFuture<LiMappedBuffer> readFile(const QUrl &url, qint64 mappingThreshold = 256 * 1024)
+    {
+        QString path = urlToLocalFileOrQrc(url);
+        if (!path.isEmpty() && !path.startsWith(QLatin1Char(':'))
+                && QFileInfo(path).size() >= mappingThreshold)
+        {
+            auto file = LiMappedFile::open(path);
+            if (file)
+            {
+                auto defer = deferred<LiMappedBuffer>();
+                defer.complete(LiMappedBuffer(file));
+                return defer.future();
+            }
+        }
+
+        auto promise = LiFileSystem::readFile(url);
+        return observe(promise).subscribe([](QByteArray buffer) {
+            return LiMappedBuffer(buffer);
+        }).future();
+    }
+
+private:
+    QSharedPointer<LiMappedFile> m_file;
+    QByteArray m_data;
+};
+
+Q_DECLARE_METATYPE(LiMappedBuffer)
+
+#endif // LIMAPPEDFILE_H
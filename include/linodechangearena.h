@@ -0,0 +1,296 @@
+#ifndef LINODECHANGEARENA_H
+#define LINODECHANGEARENA_H
+
+#include "licore_global.h"
+#include "linodeid.h"
+#include <algorithm>
+#include <functional>
+#include <new>
+#include <vector>
+
+/**
+ * @brief
+ * 每帧的节点变更流，替代每次属性修改都通过createChangePtr()分配一个QSharedPointer<LiNodeChange<T>>。
+ * 变更数据放在按帧重置的线性分配器中，同一节点的同一属性在一帧内多次修改时原地覆盖，只保留最后的值。
+ * 后端为每个属性注册一次处理函数，apply()按(属性, 节点)排序后一次性批量处理，然后重置分配器。
+ * 处理函数中调用record()产生的变更分配在另一个分配器中，留到下一次apply()处理，两个分配器交替使用。
+ * 不是线程安全的，前后端在不同线程时可以用LiFrameSnapshot<LiNodeChangeArena>做双缓冲。
+ */
+class LiNodeChangeArena
+{
+public:
+    struct Statistics
+    {
+        int produced = 0;       ///< 调用record()的次数
+        int coalesced = 0;      ///< 被同一(节点, 属性)的后续修改覆盖的次数
+        int applied = 0;        ///< 交给处理函数的变更数
+        int dropped = 0;        ///< 没有处理函数而丢弃的变更数
+        qint64 bytes = 0;       ///< 变更数据占用的字节数
+    };
+
+    explicit LiNodeChangeArena(int blockSize = 64 * 1024)
+        : m_blockSize(blockSize)
+        , m_active(0)
+        , m_mask(63)
+    {
+        m_slots.resize(64, -1);
+    }
+
+    ~LiNodeChangeArena()
+    {
+        destroyEntries();
+        for (const Arena &arena : m_arenas)
+        {
+            for (const Block &block : arena.blocks)
+                ::operator delete(block.data);
+        }
+    }
+
+    /**
+     * @brief
+     * 记录节点属性的变更，同一帧内同一(节点, 属性)只保留最后一次的数据
+     */
+    template<typename T>
+    void record(LiNodeId id, int property, const T &data)
+    {
+        ++m_current.produced;
+
+        if (m_entries.size() * 2 >= m_slots.size())
+            rehash(int(m_slots.size()) * 2);
+
+        quint64 key = makeKey(id, property);
+        int slot = int(hash(key) & m_mask);
+        while (m_slots[slot] >= 0)
+        {
+            Entry &entry = m_entries[m_slots[slot]];
+            if (entry.id == id && entry.property == property)
+            {
+                Q_ASSERT(entry.type == typeTag<T>());
+                *static_cast<T *>(entry.data) = data;
+                ++m_current.coalesced;
+                return;
+            }
+            slot = (slot + 1) & m_mask;
+        }
+
+        Entry entry;
+        entry.key = key;
+        entry.id = id;
+        entry.property = property;
+        entry.type = typeTag<T>();
+        entry.data = new (allocate(m_arenas[m_active], sizeof(T), Q_ALIGNOF(T))) T(data);
+        entry.destroy = &destroyData<T>;
+        m_slots[slot] = int(m_entries.size());
+        m_entries.push_back(entry);
+    }
+
+    /**
+     * @brief
+     * 注册属性的处理函数，由后端在初始化时调用
+     */
+    template<typename T>
+    void setHandler(int property, const std::function<void(LiNodeId, const T &)> &handler)
+    {
+        if (property >= m_handlers.size())
+            m_handlers.resize(property + 1);
+        Handler &h = m_handlers[property];
+        h.type = typeTag<T>();
+        h.func = [handler](LiNodeId id, const void *data) { handler(id, *static_cast<const T *>(data)); };
+    }
+
+    /**
+     * @brief
+     * 批量处理本帧的变更并重置，返回处理的变更数
+     */
+    int apply()
+    {
+        // 取出本帧的变更，处理函数可以安全地调用record()
+        std::vector<Entry> entries;
+        entries.swap(m_entries);
+        std::fill(m_slots.begin(), m_slots.end(), -1);
+        Arena &frame = m_arenas[m_active];
+        m_active ^= 1;
+
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+            return a.property != b.property ? a.property < b.property : a.id < b.id;
+        });
+
+        for (const Entry &entry : entries)
+        {
+            const Handler *handler = entry.property < m_handlers.size() ? &m_handlers[entry.property] : nullptr;
+            if (handler && handler->func)
+            {
+                Q_ASSERT(handler->type == entry.type);
+                handler->func(entry.id, entry.data);
+                ++m_current.applied;
+            }
+            else
+            {
+                ++m_current.dropped;
+            }
+        }
+
+        for (const Entry &entry : entries)
+            entry.destroy(entry.data);
+        entries.clear();
+
+        int applied = m_current.applied;
+        if (m_entries.empty())
+            m_entries.swap(entries);
+        // 新记录的变更数据在另一个分配器中，本帧的分配器可以重置
+        finishFrame(frame);
+        return applied;
+    }
+
+    /**
+     * @brief
+     * 丢弃本帧的变更，保留已分配的内存供下一帧使用
+     */
+    void reset()
+    {
+        destroyEntries();
+        std::fill(m_slots.begin(), m_slots.end(), -1);
+        finishFrame(m_arenas[m_active]);
+    }
+
+    int pendingCount() const { return int(m_entries.size()); }
+    const Statistics &pending() const { return m_current; }
+
+    /**
+     * @brief
+     * 上一次apply()或reset()时的统计
+     */
+    const Statistics &statistics() const { return m_last; }
+
+private:
+    struct Entry
+    {
+        quint64 key;
+        LiNodeId id;
+        int property;
+        const void *type;
+        void *data;
+        void (*destroy)(void *);
+    };
+
+    struct Handler
+    {
+        const void *type = nullptr;
+        std::function<void(LiNodeId, const void *)> func;
+    };
+
+    struct Block
+    {
+        char *data;
+        int size;
+    };
+
+    struct Arena
+    {
+        QVector<Block> blocks;
+        int block = 0;
+        int offset = 0;
+        qint64 bytes = 0;
+    };
+
+    template<typename T>
+    static const void *typeTag()
+    {
+        static const char tag = 0;
+        return &tag;
+    }
+
+    template<typename T>
+    static void destroyData(void *data)
+    {
+        static_cast<T *>(data)->~T();
+    }
+
+    static quint64 makeKey(LiNodeId id, int property)
+    {
+        // 只用于散列，节点编号超过48位时可能与其他(节点, 属性)相同，比较时使用id和property
+        return (quint64(property) << 48) ^ id.id();
+    }
+
+    static quint64 hash(quint64 key)
+    {
+        key ^= key >> 33;
+        key *= Q_UINT64_C(0xff51afd7ed558ccd);
+        key ^= key >> 33;
+        return key;
+    }
+
+    void rehash(int capacity)
+    {
+        m_slots.assign(capacity, -1);
+        m_mask = capacity - 1;
+        for (int i = 0; i < int(m_entries.size()); ++i)
+        {
+            int slot = int(hash(m_entries[i].key) & m_mask);
+            while (m_slots[slot] >= 0)
+                slot = (slot + 1) & m_mask;
+            m_slots[slot] = i;
+        }
+    }
+
+    void *allocate(Arena &arena, int size, int alignment)
+    {
+        arena.bytes += size;
+        while (arena.block < arena.blocks.size())
+        {
+            Block &block = arena.blocks[arena.block];
+            int offset = (arena.offset + alignment - 1) & ~(alignment - 1);
+            if (offset + size <= block.size)
+            {
+                arena.offset = offset + size;
+                return block.data + offset;
+            }
+            ++arena.block;
+            arena.offset = 0;
+        }
+
+        Block block;
+        block.size = qMax(m_blockSize, size + alignment);
+        block.data = static_cast<char *>(::operator new(size_t(block.size)));
+        arena.blocks.append(block);
+        arena.block = arena.blocks.size() - 1;
+        arena.offset = size;
+        return block.data;
+    }
+
+    /**
+     * @brief
+     * 结束一帧的统计并重置这一帧使用的分配器，分配器中的变更数据必须已经销毁
+     */
+    void finishFrame(Arena &arena)
+    {
+        m_current.bytes = arena.bytes;
+        m_last = m_current;
+        m_current = Statistics();
+
+        arena.block = 0;
+        arena.offset = 0;
+        arena.bytes = 0;
+    }
+
+    void destroyEntries()
+    {
+        for (const Entry &entry : m_entries)
+            entry.destroy(entry.data);
+        m_entries.clear();
+    }
+
+    int m_blockSize;
+    Arena m_arenas[2];
+    int m_active;
+
+    std::vector<Entry> m_entries;
+    std::vector<int> m_slots;
+    int m_mask;
+    QVector<Handler> m_handlers;
+
+    Statistics m_current;
+    Statistics m_last;
+};
+
+#endif // LINODECHANGEARENA_H
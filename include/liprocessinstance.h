@@ -0,0 +1,48 @@
+#ifndef LIPROCESSINSTANCE_H
+#define LIPROCESSINSTANCE_H
+
+#include "licore_global.h"
+
+/**
+ * @brief
+ * 进程内共享的实例登记。头文件中函数内的静态对象在每个DLL中各有一份，并且要到静态析构时才销毁，
+ * 因此只有头文件的线程池等对象由应用程序显式创建和销毁，并以名称登记在QCoreApplication的动态属性上，
+ * 各模块通过get()取得同一个对象。登记和注销应在主线程中进行。
+ */
+template<typename T>
+class LiProcessInstance
+{
+public:
+    static T *get(const char *name)
+    {
+        QCoreApplication *app = QCoreApplication::instance();
+        if (!app)
+            return nullptr;
+        return static_cast<T *>(app->property(name).value<void *>());
+    }
+
+    /**
+     * @brief
+     * 还没有登记的对象时登记object
+     */
+    static void attach(const char *name, T *object)
+    {
+        QCoreApplication *app = QCoreApplication::instance();
+        Q_ASSERT_X(app, "LiProcessInstance", "QCoreApplication must be created first");
+        if (app && !get(name))
+            app->setProperty(name, QVariant::fromValue<void *>(object));
+    }
+
+    /**
+     * @brief
+     * object是登记的对象时注销
+     */
+    static void detach(const char *name, T *object)
+    {
+        QCoreApplication *app = QCoreApplication::instance();
+        if (app && get(name) == object)
+            app->setProperty(name, QVariant());
+    }
+};
+
+#endif // LIPROCESSINSTANCE_H
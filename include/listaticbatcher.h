@@ -0,0 +1,595 @@
+#ifndef LISTATICBATCHER_H
+#define LISTATICBATCHER_H
+
+#include "lientity.h"
+#include "litransform.h"
+#include "ligeometry.h"
+#include "ligeometryattribute.h"
+#include "ligeometryrenderer.h"
+#include "libuffer.h"
+#include "libatchtable.h"
+#include "lifeature.h"
+#include "matrix3.h"
+#include <vector>
+
+/**
+ * @brief
+ * 静态合批。LiSceneLoader或Li3DTileContent加载的模型中大量细小的子网格各自对应一个LiEntity + LiGeometryRenderer，
+ * 绘制调用次数成为瓶颈。batch()在加载完成后遍历实体树，把顶点布局、材质、图元类型和阴影设置都相同的静态几何体
+ * 合并到共享的顶点和索引LiBuffer中，变换烘焙到顶点，每个批次只需一次绘制，原来的renderer被禁用。
+ * 每个子网格写入BATCHID顶点属性并在LiBatchTable中记录拾取颜色，保持逐对象的拾取和LiFeature对应关系。
+ * 同时为每个批次生成DrawIndirectBuffer类型的间接绘制缓存（每个对象一条DrawElementsIndirectCommand），
+ * 供glMultiDrawElementsIndirect按对象裁剪或隐藏时使用。只在主线程中调用。
+ * 已经带有LiBatchTable或BATCHID属性的几何体（b3dm、i3dm等3D Tiles要素表内容）不参与合批，
+ * 这类内容本身已经按瓦片合并为少量绘制，重新编号还需要合并各自的要素属性和拾取颜色。
+ */
+class LiStaticBatcher
+{
+public:
+    struct Options
+    {
+        int maxSourceVertices = 4096;       ///< 顶点数超过该值的几何体不参与合批
+        int maxBatchVertices = 1 << 20;     ///< 单个批次的最大顶点数
+        int minBatchObjects = 2;            ///< 少于该数量的分组不合批
+    };
+
+    struct ObjectRange
+    {
+        LiEntity *source = nullptr;
+        LiGeometryRenderer *renderer = nullptr;
+        LiFeature *feature = nullptr;
+        int batchId = 0;
+        int firstIndex = 0;
+        int indexCount = 0;
+        int firstVertex = 0;
+        int vertexCount = 0;
+    };
+
+    struct Batch
+    {
+        LiEntity *entity = nullptr;
+        LiGeometryRenderer *renderer = nullptr;
+        LiBuffer *indirectBuffer = nullptr;
+        QVector<ObjectRange> objects;
+    };
+
+    struct Statistics
+    {
+        int sourceDrawCalls = 0;        ///< 合批前的绘制次数
+        int batchedDrawCalls = 0;       ///< 合批后的绘制次数，包括未参与合批的
+        int batchedObjects = 0;         ///< 被合并的子网格数量
+    };
+
+    /**
+     * @brief
+     * 与GL_DRAW_INDIRECT_BUFFER中的DrawElementsIndirectCommand布局一致
+     */
+    struct DrawElementsIndirectCommand
+    {
+        quint32 count;
+        quint32 instanceCount;
+        quint32 firstIndex;
+        qint32 baseVertex;
+        quint32 baseInstance;
+    };
+
+    explicit LiStaticBatcher(const Options &options = Options())
+        : m_options(options)
+    {
+    }
+
+    const Options &options() const { return m_options; }
+    void setOptions(const Options &options) { m_options = options; }
+
+    /**
+     * @brief
+     * 合并root下所有可以合批的几何体，批次实体作为root的子实体添加
+     * @return 新建的批次数量
+     */
+    int batch(LiEntity *root)
+    {
+        if (!root)
+            return 0;
+
+        std::vector<Source> sources;
+        QStringList keys;
+        QHash<QString, QVector<int>> groups;
+        int ineligible = 0;
+        int unbatched = 0;
+
+        bool invertible = true;
+        Matrix4 rootInverse = root->transform()->localToWorldMatrix().inverted(&invertible);
+        if (!invertible)
+            return 0;
+
+        for (LiEntity *child : root->childEntities())
+            collect(child, rootInverse, false, sources, ineligible);
+
+        for (int i = 0; i < int(sources.size()); ++i)
+        {
+            const QString &key = sources[i].key;
+            auto it = groups.find(key);
+            if (it == groups.end())
+            {
+                keys.append(key);
+                groups.insert(key, QVector<int>() << i);
+            }
+            else
+            {
+                it.value().append(i);
+            }
+        }
+
+        int created = 0;
+        for (const QString &key : keys)
+        {
+            const QVector<int> &group = groups[key];
+            if (group.size() < m_options.minBatchObjects)
+            {
+                unbatched += group.size();
+                continue;
+            }
+
+            int begin = 0;
+            while (begin < group.size())
+            {
+                int end = begin;
+                int vertices = 0;
+                while (end < group.size() && (end == begin || vertices + sources[group[end]].vertexCount <= m_options.maxBatchVertices))
+                    vertices += sources[group[end++]].vertexCount;
+
+                if (end - begin >= m_options.minBatchObjects)
+                {
+                    build(root, sources, group.mid(begin, end - begin));
+                    ++created;
+                }
+                else
+                {
+                    unbatched += end - begin;
+                }
+                begin = end;
+            }
+        }
+
+        m_statistics.sourceDrawCalls += int(sources.size()) + ineligible;
+        m_statistics.batchedDrawCalls += created + unbatched + ineligible;
+        return created;
+    }
+
+    const QVector<Batch> &batches() const { return m_batches; }
+    const Statistics &statistics() const { return m_statistics; }
+
+    /**
+     * @brief
+     * 按批次renderer和BATCHID查找对应的原始对象，用于拾取
+     */
+    const ObjectRange *findObject(const LiGeometryRenderer *renderer, int batchId) const
+    {
+        for (const Batch &batch : m_batches)
+        {
+            if (batch.renderer == renderer && batchId >= 0 && batchId < batch.objects.size())
+                return &batch.objects[batchId];
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief
+     * 删除所有批次并重新启用原来的renderer
+     */
+    void restore()
+    {
+        for (const Batch &batch : m_batches)
+        {
+            for (const ObjectRange &object : batch.objects)
+            {
+                if (object.renderer)
+                    object.renderer->setEnabled(true);
+            }
+            batch.entity->destroy();
+        }
+        m_batches.clear();
+        m_statistics = Statistics();
+    }
+
+    static int componentBytes(LiGeometryAttribute::ComponentDataType type)
+    {
+        switch (type)
+        {
+        case LiGeometryAttribute::SINT8:
+        case LiGeometryAttribute::UINT8:
+            return 1;
+        case LiGeometryAttribute::SINT16:
+        case LiGeometryAttribute::UINT16:
+            return 2;
+        case LiGeometryAttribute::FLOAT64:
+            return 8;
+        default:
+            return 4;
+        }
+    }
+
+private:
+    struct Source
+    {
+        LiEntity *entity;
+        LiGeometryRenderer *renderer;
+        Matrix4 matrix;
+        QString key;
+        int vertexCount;
+    };
+
+    struct Layout
+    {
+        QString name;
+        LiGeometryAttribute::ComponentDataType type;
+        int components;
+        bool normalized;
+        int bytes;
+        int offset;
+    };
+
+    static int attributeStride(LiGeometryAttribute *attribute)
+    {
+        int stride = attribute->buffer()->strideBytes();
+        return stride > 0 ? stride : attribute->components() * componentBytes(attribute->componentDataType());
+    }
+
+    /**
+     * @brief
+     * size字节的缓存数据中能完整读取的顶点数
+     */
+    static int attributeVertexCount(LiGeometryAttribute *attribute, int size)
+    {
+        int bytes = attribute->components() * componentBytes(attribute->componentDataType());
+        int available = size - attribute->offsetBytes();
+        return available >= bytes ? (available - bytes) / attributeStride(attribute) + 1 : 0;
+    }
+
+    static int vertexCount(LiGeometry *geometry)
+    {
+        int count = -1;
+        for (LiGeometryAttribute *attribute : geometry->attributes())
+        {
+            int n = attributeVertexCount(attribute, attribute->buffer()->data().size());
+            count = count < 0 ? n : qMin(count, n);
+        }
+        return qMax(count, 0);
+    }
+
+    static bool isBatchable(LiGeometryRenderer *renderer)
+    {
+        LiGeometry *geometry = renderer->geometry();
+        if (!geometry || !renderer->material() || geometry->attributes().isEmpty())
+            return false;
+        if (renderer->instanceCount() > 1 || renderer->instanceAttributes())
+            return false;
+        if (geometry->hasMorphing() || !renderer->bones().isEmpty())
+            return false;
+        // 不重新编号已有的BATCHID，因此排除b3dm等自带要素表的内容
+        if (renderer->batchTable() || geometry->hasAttribute(LiGeometryAttribute::BATCHID))
+            return false;
+
+        switch (renderer->primitiveType())
+        {
+        case LiGeometryRenderer::PointList:
+        case LiGeometryRenderer::LineList:
+        case LiGeometryRenderer::TriangleList:
+            break;
+        default:
+            return false;
+        }
+
+        for (LiGeometryAttribute *attribute : geometry->attributes())
+        {
+            if (!attribute->buffer() || attribute->instanceDataStep() != 0)
+                return false;
+            // 烘焙变换只支持float的位置、法线和切线，量化的顶点保持原样绘制
+            if (isTransformed(attribute->name())
+                    && (attribute->componentDataType() != LiGeometryAttribute::FLOAT32 || attribute->components() < 3))
+                return false;
+        }
+        return true;
+    }
+
+    static QString groupKey(LiGeometryRenderer *renderer)
+    {
+        QString key = QString("%1/%2/%3/%4/%5/%6/%7")
+                .arg(quintptr(renderer->material()))
+                .arg(int(renderer->type()))
+                .arg(int(renderer->primitiveType()))
+                .arg(int(renderer->cullMode()))
+                .arg(renderer->priority())
+                .arg(int(renderer->castShadow()))
+                .arg(int(renderer->receiveShadow()));
+        for (LiGeometryAttribute *attribute : renderer->geometry()->attributes())
+        {
+            key += QString("|%1:%2:%3:%4")
+                    .arg(attribute->name())
+                    .arg(int(attribute->componentDataType()))
+                    .arg(attribute->components())
+                    .arg(int(attribute->normalized()));
+        }
+        return key;
+    }
+
+    void collect(LiEntity *entity, const Matrix4 &rootInverse, bool dynamic,
+                 std::vector<Source> &sources, int &ineligible)
+    {
+        if (!entity->isEnabled())
+            return;
+
+        // 带动画或刚体的实体及其子实体都会移动，不能烘焙变换
+        dynamic = dynamic || entity->animation() || entity->animator() || entity->rigidbody();
+
+        LiGeometryRenderer *renderer = entity->renderer();
+        if (renderer && renderer->isEnabled())
+        {
+            bool batchable = !dynamic && !entity->skin() && isBatchable(renderer);
+            int count = batchable ? vertexCount(renderer->geometry()) : 0;
+            if (batchable && count > 0 && count <= m_options.maxSourceVertices)
+            {
+                Source source;
+                source.entity = entity;
+                source.renderer = renderer;
+                source.matrix = rootInverse * entity->transform()->localToWorldMatrix();
+                source.key = groupKey(renderer);
+                source.vertexCount = count;
+                sources.push_back(source);
+            }
+            else
+            {
+                ++ineligible;
+            }
+        }
+
+        for (LiEntity *child : entity->childEntities())
+            collect(child, rootInverse, dynamic, sources, ineligible);
+    }
+
+    static void readIndices(LiGeometryRenderer *renderer, int vertices, std::vector<quint32> &indices)
+    {
+        indices.clear();
+        LiBuffer *indexBuffer = renderer->geometry()->indexBuffer();
+        if (!indexBuffer)
+        {
+            int first = qBound(0, renderer->firstVertex(), vertices);
+            int count = renderer->primitiveCount() > 0 ? qMin(renderer->primitiveCount(), vertices - first) : vertices - first;
+            for (int i = 0; i < count; ++i)
+                indices.push_back(quint32(first + i));
+            return;
+        }
+
+        const int total = indexBuffer->count();
+        const int first = qBound(0, renderer->indexOffset(), total);
+        const int count = renderer->primitiveCount() > 0 ? qMin(renderer->primitiveCount(), total - first) : total - first;
+        const QByteArray data = indexBuffer->data();
+        const int stride = indexBuffer->strideBytes();
+        indices.reserve(size_t(count));
+        for (int i = first; i < first + count; ++i)
+        {
+            quint32 index;
+            if (stride == 2)
+                index = reinterpret_cast<const quint16 *>(data.constData())[i];
+            else if (stride == 4)
+                index = reinterpret_cast<const quint32 *>(data.constData())[i];
+            else if (stride == 1)
+                index = reinterpret_cast<const quint8 *>(data.constData())[i];
+            else
+                index = indexBuffer->getIndex(i);
+            if (index < quint32(vertices))
+                indices.push_back(index);
+        }
+    }
+
+    static bool isTransformed(const QString &name)
+    {
+        return name == LiGeometryAttribute::defaultPositionAttributeName()
+                || name == LiGeometryAttribute::defaultNormalAttributeName()
+                || name == LiGeometryAttribute::defaultTangentAttributeName();
+    }
+
+    static void transformAttribute(const Layout &layout, const Matrix4 &matrix, const Matrix3 &normalMatrix, char *dst)
+    {
+        // isBatchable()已经排除了其他类型的位置、法线和切线
+        if (layout.type != LiGeometryAttribute::FLOAT32 || layout.components < 3)
+            return;
+
+        float *v = reinterpret_cast<float *>(dst);
+        Vector3 value(v[0], v[1], v[2]);
+        if (layout.name == LiGeometryAttribute::defaultPositionAttributeName())
+            value = matrix.map(value);
+        else if (layout.name == LiGeometryAttribute::defaultNormalAttributeName())
+            value = (normalMatrix * value).normalized();
+        else if (layout.name == LiGeometryAttribute::defaultTangentAttributeName())
+            value = matrix.mapVector(value).normalized();
+        else
+            return;
+
+        v[0] = float(value.x());
+        v[1] = float(value.y());
+        v[2] = float(value.z());
+    }
+
+    void build(LiEntity *root, const std::vector<Source> &sources, const QVector<int> &members)
+    {
+        const Source &first = sources[members.first()];
+        LiGeometryRenderer *prototype = first.renderer;
+
+        QVector<Layout> layouts;
+        int stride = 0;
+        for (LiGeometryAttribute *attribute : prototype->geometry()->attributes())
+        {
+            Layout layout;
+            layout.name = attribute->name();
+            layout.type = attribute->componentDataType();
+            layout.components = attribute->components();
+            layout.normalized = attribute->normalized();
+            layout.bytes = layout.components * componentBytes(layout.type);
+            layout.offset = stride;
+            stride += (layout.bytes + 3) & ~3;
+            layouts.append(layout);
+        }
+        const int batchIdOffset = stride;
+        stride += 4;
+
+        int totalVertices = 0;
+        for (int member : members)
+            totalVertices += sources[member].vertexCount;
+
+        QByteArray vertexData;
+        vertexData.reserve(totalVertices * stride);
+        std::vector<quint32> indices;
+        std::vector<quint32> sourceIndices;
+        std::vector<int> remap;
+        QVector<DrawElementsIndirectCommand> commands;
+
+        Batch batch;
+        bool hasFeatures = false;
+        for (int member : members)
+        {
+            const Source &source = sources[member];
+            LiGeometry *geometry = source.renderer->geometry();
+            const QVector<LiGeometryAttribute *> attributes = geometry->attributes();
+            const Matrix3 normalMatrix = source.matrix.normalMatrix();
+            const float batchId = float(batch.objects.size());
+
+            // 按实际读取的数据限制顶点数，collect()之后缓存可能被修改
+            QVector<QByteArray> data;
+            int vertices = source.vertexCount;
+            for (LiGeometryAttribute *attribute : attributes)
+            {
+                data.append(attribute->buffer()->data());
+                vertices = qMin(vertices, attributeVertexCount(attribute, data.last().size()));
+            }
+
+            readIndices(source.renderer, vertices, sourceIndices);
+            remap.assign(size_t(source.vertexCount), -1);
+
+            ObjectRange object;
+            object.source = source.entity;
+            object.renderer = source.renderer;
+            object.feature = source.renderer->feature();
+            object.batchId = batch.objects.size();
+            object.firstIndex = int(indices.size());
+            object.firstVertex = vertexData.size() / stride;
+
+            // 只复制被索引引用的顶点，多个子网格共享同一个大顶点缓存时不会重复复制
+            for (quint32 index : sourceIndices)
+            {
+                int &mapped = remap[index];
+                if (mapped < 0)
+                {
+                    mapped = vertexData.size() / stride;
+                    int offset = vertexData.size();
+                    vertexData.resize(offset + stride);
+                    char *dst = vertexData.data() + offset;
+                    memset(dst, 0, size_t(stride));
+                    for (int a = 0; a < layouts.size(); ++a)
+                    {
+                        LiGeometryAttribute *attribute = attributes[a];
+                        const char *src = data[a].constData() + attribute->offsetBytes() + int(index) * attributeStride(attribute);
+                        memcpy(dst + layouts[a].offset, src, size_t(layouts[a].bytes));
+                        transformAttribute(layouts[a], source.matrix, normalMatrix, dst + layouts[a].offset);
+                    }
+                    memcpy(dst + batchIdOffset, &batchId, sizeof(float));
+                }
+                indices.push_back(quint32(mapped));
+            }
+
+            object.indexCount = int(indices.size()) - object.firstIndex;
+            object.vertexCount = vertexData.size() / stride - object.firstVertex;
+            hasFeatures = hasFeatures || object.feature;
+            batch.objects.append(object);
+
+            DrawElementsIndirectCommand command;
+            command.count = quint32(object.indexCount);
+            command.instanceCount = 1;
+            command.firstIndex = quint32(object.firstIndex);
+            command.baseVertex = 0;
+            command.baseInstance = quint32(object.batchId);
+            commands.append(command);
+        }
+
+        const int vertices = vertexData.size() / stride;
+        QByteArray indexData;
+        int indexStride;
+        if (vertices <= 0x10000)
+        {
+            indexStride = 2;
+            indexData.resize(int(indices.size()) * 2);
+            quint16 *out = reinterpret_cast<quint16 *>(indexData.data());
+            for (size_t i = 0; i < indices.size(); ++i)
+                out[i] = quint16(indices[i]);
+        }
+        else
+        {
+            indexStride = 4;
+            indexData = QByteArray(reinterpret_cast<const char *>(indices.data()), int(indices.size()) * 4);
+        }
+
+        LiGeometryRenderer *renderer = new LiGeometryRenderer();
+        LiGeometry *geometry = new LiGeometry(renderer);
+        LiBuffer *vertexBuffer = LiBuffer::createVertexBuffer(vertexData, stride, LiBuffer::StaticDraw, geometry);
+        for (const Layout &layout : layouts)
+        {
+            LiGeometryAttribute *attribute = LiGeometryAttribute::create(vertexBuffer, layout.offset, layout.components, layout.type);
+            attribute->setName(layout.name);
+            attribute->setNormalized(layout.normalized);
+            geometry->addAttribute(attribute);
+        }
+        LiGeometryAttribute *batchIdAttribute = LiGeometryAttribute::create(vertexBuffer, batchIdOffset, 1);
+        batchIdAttribute->setName(LiGeometryAttribute::defaultAttributeName(LiGeometryAttribute::BATCHID));
+        geometry->addAttribute(batchIdAttribute);
+        geometry->setIndexBuffer(LiBuffer::createIndexBuffer(indexData, indexStride, LiBuffer::StaticDraw, geometry));
+
+        renderer->setGeometry(geometry);
+        renderer->setMaterial(prototype->material());
+        renderer->setType(prototype->type());
+        renderer->setPrimitiveType(prototype->primitiveType());
+        renderer->setPrimitiveCount(int(indices.size()));
+        renderer->setCullMode(prototype->cullMode());
+        renderer->setPriority(prototype->priority());
+        renderer->setCastShadow(prototype->castShadow());
+        renderer->setReceiveShadow(prototype->receiveShadow());
+
+        if (hasFeatures)
+        {
+            LiBatchTable *batchTable = new LiBatchTable(renderer);
+            batchTable->addAttribute(LiBatchTable::Color);
+            batchTable->setNumberOfInstances(batch.objects.size());
+            for (const ObjectRange &object : batch.objects)
+            {
+                if (object.feature)
+                    batchTable->setBatchedAttribute(object.batchId, 0, object.feature->pickId().color());
+            }
+            renderer->setBatchTable(batchTable);
+        }
+
+        renderer->computeBoundingVolume();
+
+        batch.indirectBuffer = new LiBuffer(renderer);
+        batch.indirectBuffer->setBufferType(LiBuffer::DrawIndirectBuffer);
+        batch.indirectBuffer->setUsageType(LiBuffer::StaticDraw);
+        batch.indirectBuffer->setStrideBytes(int(sizeof(DrawElementsIndirectCommand)));
+        batch.indirectBuffer->setData(QByteArray(reinterpret_cast<const char *>(commands.constData()),
+                                                 commands.size() * int(sizeof(DrawElementsIndirectCommand))));
+
+        batch.entity = new LiEntity(root);
+        batch.entity->addComponent(renderer);
+        batch.renderer = renderer;
+
+        // 只禁用renderer，原实体的子实体和其他组件不受影响
+        for (const ObjectRange &object : batch.objects)
+            object.renderer->setEnabled(false);
+
+        m_statistics.batchedObjects += batch.objects.size();
+        m_batches.append(batch);
+    }
+
+    Options m_options;
+    QVector<Batch> m_batches;
+    Statistics m_statistics;
+};
+
+#endif // LISTATICBATCHER_H
@@ -0,0 +1,436 @@
+#ifndef LITRANSFORMHIERARCHY_H
+#define LITRANSFORMHIERARCHY_H
+
+#include "licore_global.h"
+#include "matrix3.h"
+#include "matrix4.h"
+#include "quaternion.h"
+#include "vector3.h"
+#include <QtConcurrent>
+#include <climits>
+
+/**
+ * @brief
+ * 面向数据的变换层级。父节点索引、本地TRS和世界矩阵分别存放在连续的数组中，节点用整数索引表示，
+ * 修改本地变换只设置脏标记，update()每帧按深度逐层重新计算脏节点及其子树的世界矩阵，
+ * 同一层的节点互不依赖，数量较多时在线程池中并行计算，没有脏节点的层直接跳过。
+ * 替代在LiTransform::worldMatrix()中沿父链逐级求值，适用于大量运动实体（车辆、骨骼动画、关键帧动画）。
+ * 修改和update()都应在同一个线程中调用，update()期间不能修改层级。
+ */
+class LiTransformHierarchy
+{
+public:
+    enum
+    {
+        InvalidIndex = -1
+    };
+
+    explicit LiTransformHierarchy(QThreadPool *threadPool = QThreadPool::globalInstance(), int grainSize = 512)
+        : m_threadPool(threadPool)
+        , m_grainSize(qMax(1, grainSize))
+        , m_count(0)
+        , m_frame(0)
+        , m_minDirtyDepth(INT_MAX)
+    {
+    }
+
+    QThreadPool *threadPool() const { return m_threadPool; }
+    void setThreadPool(QThreadPool *pool) { m_threadPool = pool; }
+
+    int count() const { return m_count; }
+
+    bool isValid(int node) const
+    {
+        return node >= 0 && node < m_flags.size() && (m_flags[node] & Alive);
+    }
+
+    /**
+     * @brief
+     * 创建节点，本地变换为单位矩阵
+     * @return 节点索引，删除后会被复用
+     */
+    int create(int parent = InvalidIndex)
+    {
+        Q_ASSERT(parent == InvalidIndex || isValid(parent));
+
+        int node;
+        if (!m_freeList.isEmpty())
+        {
+            node = m_freeList.takeLast();
+        }
+        else
+        {
+            node = m_flags.size();
+            m_parent.append(InvalidIndex);
+            m_firstChild.append(InvalidIndex);
+            m_nextSibling.append(InvalidIndex);
+            m_prevSibling.append(InvalidIndex);
+            m_depth.append(0);
+            m_levelSlot.append(0);
+            m_translation.append(Vector3());
+            m_rotation.append(Quaternion());
+            m_scale.append(Vector3(1.0, 1.0, 1.0));
+            m_local.append(Matrix4());
+            m_world.append(Matrix4());
+            m_changedFrame.append(0);
+            m_flags.append(0);
+        }
+
+        m_parent[node] = InvalidIndex;
+        m_firstChild[node] = InvalidIndex;
+        m_nextSibling[node] = InvalidIndex;
+        m_prevSibling[node] = InvalidIndex;
+        m_translation[node] = Vector3();
+        m_rotation[node] = Quaternion();
+        m_scale[node] = Vector3(1.0, 1.0, 1.0);
+        m_local[node] = Matrix4();
+        m_world[node] = Matrix4();
+        m_changedFrame[node] = 0;
+        m_flags[node] = Alive;
+        ++m_count;
+
+        link(node, parent);
+        addToLevel(node, parent == InvalidIndex ? 0 : m_depth[parent] + 1);
+        markWorldDirty(node);
+        return node;
+    }
+
+    /**
+     * @brief
+     * 删除节点及其所有子节点
+     */
+    void destroy(int node)
+    {
+        Q_ASSERT(isValid(node));
+        unlink(node);
+
+        QVector<int> stack;
+        stack.append(node);
+        while (!stack.isEmpty())
+        {
+            int n = stack.takeLast();
+            for (int child = m_firstChild[n]; child != InvalidIndex; child = m_nextSibling[child])
+                stack.append(child);
+
+            if (m_flags[n] & WorldDirty)
+                --m_levelDirty[m_depth[n]];
+            removeFromLevel(n);
+            m_flags[n] = 0;
+            m_freeList.append(n);
+            --m_count;
+        }
+    }
+
+    int parent(int node) const { return m_parent[node]; }
+    int depth(int node) const { return m_depth[node]; }
+
+    /**
+     * @brief
+     * 修改父节点，保持本地变换不变，子树的深度随之更新
+     */
+    void setParent(int node, int parent)
+    {
+        Q_ASSERT(isValid(node) && (parent == InvalidIndex || isValid(parent)));
+        if (m_parent[node] == parent)
+            return;
+        for (int p = parent; p != InvalidIndex; p = m_parent[p])
+        {
+            Q_ASSERT(p != node);
+        }
+
+        unlink(node);
+        link(node, parent);
+
+        const int delta = (parent == InvalidIndex ? 0 : m_depth[parent] + 1) - m_depth[node];
+        if (delta != 0)
+        {
+            QVector<int> stack;
+            stack.append(node);
+            while (!stack.isEmpty())
+            {
+                int n = stack.takeLast();
+                for (int child = m_firstChild[n]; child != InvalidIndex; child = m_nextSibling[child])
+                    stack.append(child);
+
+                const bool dirty = m_flags[n] & WorldDirty;
+                if (dirty)
+                    --m_levelDirty[m_depth[n]];
+                removeFromLevel(n);
+                addToLevel(n, m_depth[n] + delta);
+                if (dirty)
+                {
+                    // 子树上移后脏节点可能比原来的最小脏深度更浅
+                    ++m_levelDirty[m_depth[n]];
+                    m_minDirtyDepth = qMin(m_minDirtyDepth, m_depth[n]);
+                }
+            }
+        }
+
+        markWorldDirty(node);
+    }
+
+    const Vector3 &translation(int node) const { return m_translation[node]; }
+    const Quaternion &rotation(int node) const { return m_rotation[node]; }
+    const Vector3 &scale(int node) const { return m_scale[node]; }
+
+    void setTranslation(int node, const Vector3 &translation)
+    {
+        m_translation[node] = translation;
+        markLocalDirty(node);
+    }
+
+    void setRotation(int node, const Quaternion &rotation)
+    {
+        m_rotation[node] = rotation;
+        markLocalDirty(node);
+    }
+
+    void setScale(int node, const Vector3 &scale)
+    {
+        m_scale[node] = scale;
+        markLocalDirty(node);
+    }
+
+    void setTranslationRotationScale(int node, const Vector3 &translation, const Quaternion &rotation, const Vector3 &scale)
+    {
+        m_translation[node] = translation;
+        m_rotation[node] = rotation;
+        m_scale[node] = scale;
+        markLocalDirty(node);
+    }
+
+    /**
+     * @brief
+     * 直接设置本地矩阵，之后的setTranslation()等调用会重新按TRS计算本地矩阵
+     */
+    void setLocalMatrix(int node, const Matrix4 &matrix)
+    {
+        m_local[node] = matrix;
+        m_flags[node] &= ~LocalDirty;
+        markWorldDirty(node);
+    }
+
+    /**
+     * @brief
+     * 本地矩阵和世界矩阵都是上一次update()的结果
+     */
+    const Matrix4 &localMatrix(int node) const { return m_local[node]; }
+    const Matrix4 &worldMatrix(int node) const { return m_world[node]; }
+
+    bool isDirty(int node) const { return m_flags[node] & WorldDirty; }
+
+    /**
+     * @brief
+     * 世界矩阵是否在上一次update()中被重新计算
+     */
+    bool worldChanged(int node) const { return m_changedFrame[node] == m_frame; }
+
+    /**
+     * @brief
+     * 按深度逐层重新计算脏节点及其子树的世界矩阵
+     * @return 重新计算的节点数量
+     */
+    int update()
+    {
+        ++m_frame;
+        if (m_minDirtyDepth == INT_MAX)
+            return 0;
+
+        const quint32 frame = m_frame;
+        const int *parents = m_parent.constData();
+        const Vector3 *translations = m_translation.constData();
+        const Quaternion *rotations = m_rotation.constData();
+        const Vector3 *scales = m_scale.constData();
+        Matrix4 *locals = m_local.data();
+        Matrix4 *worlds = m_world.data();
+        quint32 *changedFrames = m_changedFrame.data();
+        quint8 *flags = m_flags.data();
+
+        int updated = 0;
+        int changedInLevel = 0;
+        for (int depth = m_minDirtyDepth; depth < m_levels.size(); ++depth)
+        {
+            // 本层没有脏节点且上一层没有变化时，整层都不需要计算
+            if (m_levelDirty[depth] == 0 && changedInLevel == 0)
+                continue;
+
+            const QVector<int> &level = m_levels[depth];
+            const int *nodes = level.constData();
+            const bool checkParents = changedInLevel > 0;
+            QAtomicInt changed(0);
+
+            auto updateRange = [&](int begin, int end) {
+                int n = 0;
+                for (int i = begin; i < end; ++i)
+                {
+                    const int node = nodes[i];
+                    const int parent = parents[node];
+                    const bool parentChanged = checkParents && parent != InvalidIndex && changedFrames[parent] == frame;
+                    if (!(flags[node] & WorldDirty) && !parentChanged)
+                        continue;
+
+                    if (flags[node] & LocalDirty)
+                        locals[node] = composeMatrix(translations[node], rotations[node], scales[node]);
+                    worlds[node] = parent != InvalidIndex ? worlds[parent] * locals[node] : locals[node];
+                    flags[node] &= ~(LocalDirty | WorldDirty);
+                    changedFrames[node] = frame;
+                    ++n;
+                }
+                changed.fetchAndAddRelaxed(n);
+            };
+
+            const int chunks = (level.size() + m_grainSize - 1) / m_grainSize;
+            parallelFor(chunks, [&](int chunk) {
+                updateRange(chunk * m_grainSize, qMin(level.size(), (chunk + 1) * m_grainSize));
+            });
+
+            m_levelDirty[depth] = 0;
+            changedInLevel = changed.load();
+            updated += changedInLevel;
+        }
+
+        m_minDirtyDepth = INT_MAX;
+        return updated;
+    }
+
+    static Matrix4 composeMatrix(const Vector3 &translation, const Quaternion &rotation, const Vector3 &scale)
+    {
+        Matrix3 rotationScale = rotation.toRotationMatrix();
+        rotationScale.multiplyByScale(scale);
+        return Matrix4::fromRotationTranslation(rotationScale, translation);
+    }
+
+private:
+    enum Flag
+    {
+        Alive = 0x1,
+        LocalDirty = 0x2,
+        WorldDirty = 0x4
+    };
+
+    void markLocalDirty(int node)
+    {
+        Q_ASSERT(isValid(node));
+        m_flags[node] |= LocalDirty;
+        markWorldDirty(node);
+    }
+
+    void markWorldDirty(int node)
+    {
+        if (m_flags[node] & WorldDirty)
+            return;
+        m_flags[node] |= WorldDirty;
+        ++m_levelDirty[m_depth[node]];
+        m_minDirtyDepth = qMin(m_minDirtyDepth, m_depth[node]);
+    }
+
+    void link(int node, int parent)
+    {
+        m_parent[node] = parent;
+        m_prevSibling[node] = InvalidIndex;
+        m_nextSibling[node] = InvalidIndex;
+        if (parent == InvalidIndex)
+            return;
+
+        int first = m_firstChild[parent];
+        m_nextSibling[node] = first;
+        if (first != InvalidIndex)
+            m_prevSibling[first] = node;
+        m_firstChild[parent] = node;
+    }
+
+    void unlink(int node)
+    {
+        int parent = m_parent[node];
+        int prev = m_prevSibling[node];
+        int next = m_nextSibling[node];
+        if (prev != InvalidIndex)
+            m_nextSibling[prev] = next;
+        else if (parent != InvalidIndex)
+            m_firstChild[parent] = next;
+        if (next != InvalidIndex)
+            m_prevSibling[next] = prev;
+
+        m_parent[node] = InvalidIndex;
+        m_prevSibling[node] = InvalidIndex;
+        m_nextSibling[node] = InvalidIndex;
+    }
+
+    void addToLevel(int node, int depth)
+    {
+        while (m_levels.size() <= depth)
+        {
+            m_levels.append(QVector<int>());
+            m_levelDirty.append(0);
+        }
+        m_depth[node] = depth;
+        m_levelSlot[node] = m_levels[depth].size();
+        m_levels[depth].append(node);
+    }
+
+    void removeFromLevel(int node)
+    {
+        QVector<int> &level = m_levels[m_depth[node]];
+        int slot = m_levelSlot[node];
+        int last = level.last();
+        level[slot] = last;
+        m_levelSlot[last] = slot;
+        level.removeLast();
+    }
+
+    template <typename Func>
+    void parallelFor(int count, const Func &func)
+    {
+        int threads = m_threadPool ? qMin(count, m_threadPool->maxThreadCount()) : 1;
+        if (threads <= 1)
+        {
+            for (int i = 0; i < count; ++i)
+                func(i);
+            return;
+        }
+
+        QAtomicInt next(0);
+        auto worker = [&]() {
+            for (;;)
+            {
+                int i = next.fetchAndAddRelaxed(1);
+                if (i >= count)
+                    break;
+                func(i);
+            }
+        };
+
+        QVector<QFuture<void>> futures;
+        for (int i = 1; i < threads; ++i)
+            futures.append(QtConcurrent::run(m_threadPool, worker));
+        worker();
+        for (QFuture<void> &future : futures)
+            future.waitForFinished();
+    }
+
+    QThreadPool *m_threadPool;
+    int m_grainSize;
+    int m_count;
+    quint32 m_frame;
+    int m_minDirtyDepth;
+
+    QVector<int> m_parent;
+    QVector<int> m_firstChild;
+    QVector<int> m_nextSibling;
+    QVector<int> m_prevSibling;
+    QVector<int> m_depth;
+    QVector<int> m_levelSlot;
+    QVector<Vector3> m_translation;
+    QVector<Quaternion> m_rotation;
+    QVector<Vector3> m_scale;
+    QVector<Matrix4> m_local;
+    QVector<Matrix4> m_world;
+    QVector<quint32> m_changedFrame;
+    QVector<quint8> m_flags;
+
+    QVector<QVector<int>> m_levels;
+    QVector<int> m_levelDirty;
+    QVector<int> m_freeList;
+};
+
+#endif // LITRANSFORMHIERARCHY_H
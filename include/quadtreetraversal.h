@@ -0,0 +1,178 @@
+#ifndef QUADTREETRAVERSAL_H
+#define QUADTREETRAVERSAL_H
+
+#include "licore_global.h"
+#include <QtConcurrent>
+#include <functional>
+
+/**
+ * @brief
+ * 四叉树瓦片的并行遍历，用于QuadtreePrimitive::selectTilesForRendering。
+ * 深度小于parallelDepth的子树分发到线程池中遍历，每个子树有独立的输出列表，
+ * 遍历结束后按子瓦片的顺序合并，渲染列表和加载队列的顺序与串行遍历完全一致。
+ * enter/leave回调会在多个线程中同时调用，只能修改当前瓦片及其子瓦片的状态。
+ */
+template <typename Tile>
+class QuadtreeTraversal
+{
+public:
+    struct Result
+    {
+        QVector<Tile *> tilesToRender;
+        QVector<Tile *> tileLoadQueueHigh;
+        QVector<Tile *> tileLoadQueueMedium;
+        QVector<Tile *> tileLoadQueueLow;
+        int tilesVisited = 0;
+        int tilesCulled = 0;
+        int tilesWaitingForChildren = 0;
+        int maxDepth = 0;
+
+        void clear()
+        {
+            tilesToRender.clear();
+            tileLoadQueueHigh.clear();
+            tileLoadQueueMedium.clear();
+            tileLoadQueueLow.clear();
+            tilesVisited = 0;
+            tilesCulled = 0;
+            tilesWaitingForChildren = 0;
+            maxDepth = 0;
+        }
+
+        void append(const Result &other)
+        {
+            tilesToRender += other.tilesToRender;
+            tileLoadQueueHigh += other.tileLoadQueueHigh;
+            tileLoadQueueMedium += other.tileLoadQueueMedium;
+            tileLoadQueueLow += other.tileLoadQueueLow;
+            tilesVisited += other.tilesVisited;
+            tilesCulled += other.tilesCulled;
+            tilesWaitingForChildren += other.tilesWaitingForChildren;
+            maxDepth = qMax(maxDepth, other.maxDepth);
+        }
+    };
+
+    /**
+     * @brief
+     * 进入瓦片时渲染列表和三个加载队列的长度
+     */
+    struct Marker
+    {
+        int render = 0;
+        int loadHigh = 0;
+        int loadMedium = 0;
+        int loadLow = 0;
+    };
+
+    /**
+     * @brief
+     * 访问瓦片，把需要继续遍历的子瓦片按由近到远的顺序写入children，返回子瓦片的数量（最多4个）
+     */
+    typedef std::function<int(Tile *tile, Result &result, Tile **children)> EnterFunction;
+
+    /**
+     * @brief
+     * 子瓦片遍历完成后调用，start为进入该瓦片时各列表的长度。
+     * 子瓦片不能渲染时，可以把渲染列表截断到start.render后加入当前瓦片，
+     * 并像Cesium的kick一样把加载队列截断到start中的长度，丢弃子孙瓦片的加载请求
+     */
+    typedef std::function<void(Tile *tile, Result &result, const Marker &start)> LeaveFunction;
+
+    QuadtreeTraversal()
+        : m_parallel(true)
+        , m_parallelDepth(3)
+        , m_threadPool(QThreadPool::globalInstance())
+    {
+    }
+
+    bool isParallel() const { return m_parallel; }
+    void setParallel(bool parallel) { m_parallel = parallel; }
+
+    /**
+     * @brief
+     * 分发到线程池的最大深度，0级瓦片的深度为0
+     */
+    int parallelDepth() const { return m_parallelDepth; }
+    void setParallelDepth(int depth) { m_parallelDepth = depth; }
+
+    QThreadPool *threadPool() const { return m_threadPool; }
+    void setThreadPool(QThreadPool *pool) { m_threadPool = pool; }
+
+    void traverse(const QVector<Tile *> &levelZeroTiles,
+                  const EnterFunction &enter,
+                  const LeaveFunction &leave,
+                  Result *result)
+    {
+        m_enter = enter;
+        m_leave = leave;
+        visitTiles(levelZeroTiles.constData(), levelZeroTiles.size(), 0, *result);
+        m_enter = EnterFunction();
+        m_leave = LeaveFunction();
+    }
+
+private:
+    void visitTile(Tile *tile, int depth, Result &result)
+    {
+        ++result.tilesVisited;
+        result.maxDepth = qMax(result.maxDepth, depth);
+
+        Marker start;
+        start.render = result.tilesToRender.size();
+        start.loadHigh = result.tileLoadQueueHigh.size();
+        start.loadMedium = result.tileLoadQueueMedium.size();
+        start.loadLow = result.tileLoadQueueLow.size();
+
+        Tile *children[4];
+        int count = m_enter(tile, result, children);
+        if (count > 0)
+            visitTiles(children, qMin(count, 4), depth + 1, result);
+
+        if (m_leave)
+            m_leave(tile, result, start);
+    }
+
+    void visitTiles(Tile *const *tiles, int count, int depth, Result &result)
+    {
+        if (!m_parallel || !m_threadPool || depth >= m_parallelDepth || count < 2)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                visitTile(tiles[i], depth, result);
+            }
+            return;
+        }
+
+        // 第一个子树在当前线程遍历，waitForFinished会在当前线程执行尚未开始的任务
+        QVector<Result> partials(count);
+        QVector<QFuture<void>> futures;
+        futures.reserve(count - 1);
+        for (int i = 1; i < count; ++i)
+        {
+            Tile *tile = tiles[i];
+            Result *partial = &partials[i];
+            futures.append(QtConcurrent::run(m_threadPool, [this, tile, depth, partial]() {
+                visitTile(tile, depth, *partial);
+            }));
+        }
+
+        visitTile(tiles[0], depth, partials[0]);
+
+        for (auto &future : futures)
+        {
+            future.waitForFinished();
+        }
+
+        for (const Result &partial : partials)
+        {
+            result.append(partial);
+        }
+    }
+
+    bool m_parallel;
+    int m_parallelDepth;
+    QThreadPool *m_threadPool;
+    EnterFunction m_enter;
+    LeaveFunction m_leave;
+};
+
+#endif // QUADTREETRAVERSAL_H
@@ -0,0 +1,310 @@
+#ifndef QUANTIZEDMESHDECODER_H
+#define QUANTIZEDMESHDECODER_H
+
+#include "licore_global.h"
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define QUANTIZEDMESH_SSE2 1
+#endif
+
+/**
+ * @brief
+ * quantized-mesh地形数据的解码函数，包括u/v/height的zig-zag差分、高水位索引、
+ * oct编码法线以及量化值的反量化。支持SSE2时使用向量化实现，否则使用标量实现，
+ * 两种实现的结果完全一致。标量实现同时以xxxScalar公开，向量化实现的尾部也由它完成，
+ * testapp中的benchmarkQuantizedMesh()用它逐字节对比两种实现并测量吞吐量。
+ */
+class QuantizedMeshDecoder
+{
+public:
+    static inline qint16 zigZagDecode(quint16 value)
+    {
+        return qint16((value >> 1) ^ (-(value & 1)));
+    }
+
+    /**
+     * @brief
+     * 原地解码zig-zag差分编码的u、v或height数组
+     */
+    static void decodeZigZagDeltas(quint16 *values, int count)
+    {
+        int i = 0;
+        quint16 value = 0;
+
+#if defined(QUANTIZEDMESH_SSE2)
+        const __m128i one = _mm_set1_epi16(1);
+        const __m128i zero = _mm_setzero_si128();
+        __m128i carry = zero;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i));
+            v = _mm_xor_si128(_mm_srli_epi16(v, 1), _mm_sub_epi16(zero, _mm_and_si128(v, one)));
+
+            // 8个16位数的前缀和
+            v = _mm_add_epi16(v, _mm_slli_si128(v, 2));
+            v = _mm_add_epi16(v, _mm_slli_si128(v, 4));
+            v = _mm_add_epi16(v, _mm_slli_si128(v, 8));
+            v = _mm_add_epi16(v, carry);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(values + i), v);
+            carry = _mm_shuffle_epi32(_mm_shufflehi_epi16(v, 0xff), 0xff);
+        }
+        if (i > 0)
+            value = values[i - 1];
+#endif
+
+        decodeZigZagDeltasScalar(values + i, count - i, value);
+    }
+
+    /**
+     * @brief
+     * decodeZigZagDeltas的标量实现，first为values之前最后一个解码后的值
+     */
+    static void decodeZigZagDeltasScalar(quint16 *values, int count, quint16 first = 0)
+    {
+        quint16 value = first;
+        for (int i = 0; i < count; ++i)
+        {
+            value = quint16(value + zigZagDecode(values[i]));
+            values[i] = value;
+        }
+    }
+
+    /**
+     * @brief
+     * 原地解码高水位编码的16位三角形索引
+     */
+    static void decodeHighWaterMark(quint16 *indices, int count)
+    {
+        int i = 0;
+        quint16 highest = 0;
+
+#if defined(QUANTIZEDMESH_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        __m128i base = zero;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i code = _mm_loadu_si128(reinterpret_cast<const __m128i *>(indices + i));
+
+            // 当前位置之前code为0的数量即highest的增量
+            __m128i isZero = _mm_sub_epi16(zero, _mm_cmpeq_epi16(code, zero));
+            __m128i inclusive = _mm_add_epi16(isZero, _mm_slli_si128(isZero, 2));
+            inclusive = _mm_add_epi16(inclusive, _mm_slli_si128(inclusive, 4));
+            inclusive = _mm_add_epi16(inclusive, _mm_slli_si128(inclusive, 8));
+            __m128i before = _mm_add_epi16(base, _mm_sub_epi16(inclusive, isZero));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(indices + i), _mm_sub_epi16(before, code));
+            base = _mm_add_epi16(base, _mm_shuffle_epi32(_mm_shufflehi_epi16(inclusive, 0xff), 0xff));
+        }
+        if (i > 0)
+            highest = quint16(_mm_cvtsi128_si32(base));
+#endif
+
+        decodeHighWaterMarkScalar(indices + i, count - i, highest);
+    }
+
+    /**
+     * @brief
+     * 16位decodeHighWaterMark的标量实现，highest为当前的高水位
+     */
+    static void decodeHighWaterMarkScalar(quint16 *indices, int count, quint16 highest = 0)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            quint16 code = indices[i];
+            indices[i] = quint16(highest - code);
+            if (code == 0)
+                ++highest;
+        }
+    }
+
+    /**
+     * @brief
+     * 原地解码高水位编码的32位三角形索引
+     */
+    static void decodeHighWaterMark(quint32 *indices, int count)
+    {
+        int i = 0;
+        quint32 highest = 0;
+
+#if defined(QUANTIZEDMESH_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        __m128i base = zero;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i code = _mm_loadu_si128(reinterpret_cast<const __m128i *>(indices + i));
+
+            __m128i isZero = _mm_sub_epi32(zero, _mm_cmpeq_epi32(code, zero));
+            __m128i inclusive = _mm_add_epi32(isZero, _mm_slli_si128(isZero, 4));
+            inclusive = _mm_add_epi32(inclusive, _mm_slli_si128(inclusive, 8));
+            __m128i before = _mm_add_epi32(base, _mm_sub_epi32(inclusive, isZero));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(indices + i), _mm_sub_epi32(before, code));
+            base = _mm_add_epi32(base, _mm_shuffle_epi32(inclusive, 0xff));
+        }
+        if (i > 0)
+            highest = quint32(_mm_cvtsi128_si32(base));
+#endif
+
+        decodeHighWaterMarkScalar(indices + i, count - i, highest);
+    }
+
+    /**
+     * @brief
+     * 32位decodeHighWaterMark的标量实现，highest为当前的高水位
+     */
+    static void decodeHighWaterMarkScalar(quint32 *indices, int count, quint32 highest = 0)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            quint32 code = indices[i];
+            indices[i] = highest - code;
+            if (code == 0)
+                ++highest;
+        }
+    }
+
+    /**
+     * @brief
+     * 解码oct编码的法线
+     * @param encoded 每个法线2个字节
+     * @param count 法线数量
+     * @param normals 输出，每个法线3个float
+     */
+    static void decodeOctNormals(const quint8 *encoded, int count, float *normals)
+    {
+        int i = 0;
+
+#if defined(QUANTIZEDMESH_SSE2)
+        const __m128i zeroi = _mm_setzero_si128();
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 minusOne = _mm_set1_ps(-1.0f);
+        const __m128 two = _mm_set1_ps(2.0f);
+        const __m128 rangeMax = _mm_set1_ps(255.0f);
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(encoded + i * 2));
+            __m128i words = _mm_unpacklo_epi8(bytes, zeroi);
+            __m128 a = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zeroi));
+            __m128 b = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zeroi));
+
+            __m128 x = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 y = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            x = _mm_sub_ps(_mm_mul_ps(_mm_div_ps(x, rangeMax), two), one);
+            y = _mm_sub_ps(_mm_mul_ps(_mm_div_ps(y, rangeMax), two), one);
+
+            __m128 absX = _mm_and_ps(x, absMask);
+            __m128 absY = _mm_and_ps(y, absMask);
+            __m128 z = _mm_sub_ps(one, _mm_add_ps(absX, absY));
+
+            __m128 fold = _mm_cmplt_ps(z, zero);
+            __m128 negX = _mm_cmplt_ps(x, zero);
+            __m128 negY = _mm_cmplt_ps(y, zero);
+            __m128 signX = _mm_or_ps(_mm_and_ps(negX, minusOne), _mm_andnot_ps(negX, one));
+            __m128 signY = _mm_or_ps(_mm_and_ps(negY, minusOne), _mm_andnot_ps(negY, one));
+            __m128 foldedX = _mm_mul_ps(_mm_sub_ps(one, absY), signX);
+            __m128 foldedY = _mm_mul_ps(_mm_sub_ps(one, absX), signY);
+            x = _mm_or_ps(_mm_and_ps(fold, foldedX), _mm_andnot_ps(fold, x));
+            y = _mm_or_ps(_mm_and_ps(fold, foldedY), _mm_andnot_ps(fold, y));
+
+            __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+            x = _mm_div_ps(x, length);
+            y = _mm_div_ps(y, length);
+            z = _mm_div_ps(z, length);
+
+            float xs[4], ys[4], zs[4];
+            _mm_storeu_ps(xs, x);
+            _mm_storeu_ps(ys, y);
+            _mm_storeu_ps(zs, z);
+            for (int j = 0; j < 4; ++j)
+            {
+                normals[(i + j) * 3] = xs[j];
+                normals[(i + j) * 3 + 1] = ys[j];
+                normals[(i + j) * 3 + 2] = zs[j];
+            }
+        }
+#endif
+
+        decodeOctNormalsScalar(encoded + i * 2, count - i, normals + i * 3);
+    }
+
+    /**
+     * @brief
+     * decodeOctNormals的标量实现
+     */
+    static void decodeOctNormalsScalar(const quint8 *encoded, int count, float *normals)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            octDecode(encoded[i * 2], encoded[i * 2 + 1], normals + i * 3);
+        }
+    }
+
+    /**
+     * @brief
+     * 把0~32767的量化值线性映射到[minimum, maximum]，u、v使用0和1
+     */
+    static void dequantize(const quint16 *values, int count, double minimum, double maximum, double *result)
+    {
+        int i = 0;
+
+#if defined(QUANTIZEDMESH_SSE2)
+        const __m128i zeroi = _mm_setzero_si128();
+        const __m128d s = _mm_set1_pd(1.0 / 32767.0);
+        const __m128d one = _mm_set1_pd(1.0);
+        const __m128d lo = _mm_set1_pd(minimum);
+        const __m128d hi = _mm_set1_pd(maximum);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i v = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(values + i)), zeroi);
+            __m128d t0 = _mm_mul_pd(_mm_cvtepi32_pd(v), s);
+            __m128d t1 = _mm_mul_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2))), s);
+            _mm_storeu_pd(result + i, _mm_add_pd(_mm_mul_pd(_mm_sub_pd(one, t0), lo), _mm_mul_pd(t0, hi)));
+            _mm_storeu_pd(result + i + 2, _mm_add_pd(_mm_mul_pd(_mm_sub_pd(one, t1), lo), _mm_mul_pd(t1, hi)));
+        }
+#endif
+
+        dequantizeScalar(values + i, count - i, minimum, maximum, result + i);
+    }
+
+    /**
+     * @brief
+     * dequantize的标量实现
+     */
+    static void dequantizeScalar(const quint16 *values, int count, double minimum, double maximum, double *result)
+    {
+        const double scale = 1.0 / 32767.0;
+        for (int i = 0; i < count; ++i)
+        {
+            double t = values[i] * scale;
+            result[i] = (1.0 - t) * minimum + t * maximum;
+        }
+    }
+
+private:
+    static void octDecode(quint8 ex, quint8 ey, float *normal)
+    {
+        float x = float(ex) / 255.0f * 2.0f - 1.0f;
+        float y = float(ey) / 255.0f * 2.0f - 1.0f;
+        float z = 1.0f - (std::fabs(x) + std::fabs(y));
+
+        if (z < 0.0f)
+        {
+            float oldX = x;
+            x = (1.0f - std::fabs(y)) * (oldX < 0.0f ? -1.0f : 1.0f);
+            y = (1.0f - std::fabs(oldX)) * (y < 0.0f ? -1.0f : 1.0f);
+        }
+
+        float length = std::sqrt(x * x + y * y + z * z);
+        normal[0] = x / length;
+        normal[1] = y / length;
+        normal[2] = z / length;
+    }
+};
+
+#endif // QUANTIZEDMESHDECODER_H
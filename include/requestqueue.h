@@ -0,0 +1,432 @@
+#ifndef REQUESTQUEUE_H
+#define REQUESTQUEUE_H
+
+#include "licore_global.h"
+#include "lirequest.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/**
+ * @brief
+ * 分桶优先级请求队列，用于替代每帧全部重新计算优先级并重建堆的RequestHeap。
+ * 优先级按对数量化到固定数量的桶中，每帧只重新计算被标记为dirty的请求，
+ * 以及轮询的一小部分请求；每种LiRequest::RequestType有独立的并发数预算，
+ * 保证地形、影像和3DTiles之间不会互相饿死。
+ * 优先级数值越小越优先，与RequestScheduler一致。每个桶内部是小顶堆，出队为O(log n)。
+ * 请求出队或被移除后句柄失效，句柄带有序号，失效的句柄不会误操作复用了同一位置的请求。
+ */
+class RequestQueue
+{
+public:
+    struct Handle
+    {
+        int index = -1;
+        quint32 serial = 0;
+
+        bool isNull() const { return index < 0; }
+    };
+
+    enum
+    {
+        NumberOfBuckets = 64,
+        BucketsPerOctave = 2,
+        NumberOfTypes = LiRequest::OTHER + 1
+    };
+
+    RequestQueue()
+        : m_nextType(0)
+        , m_cursor(0)
+        , m_size(0)
+    {
+        for (int t = 0; t < NumberOfTypes; ++t)
+        {
+            m_nonEmpty[t] = 0;
+            m_active[t] = 0;
+            m_maximumActive[t] = 20;
+            m_count[t] = 0;
+        }
+    }
+
+    int size() const { return m_size; }
+    int size(LiRequest::RequestType type) const { return m_count[type]; }
+    bool isEmpty() const { return m_size == 0; }
+
+    /**
+     * @brief
+     * 每种请求类型同时处于ACTIVE状态的最大数量
+     */
+    int maximumActiveRequests(LiRequest::RequestType type) const { return m_maximumActive[type]; }
+    void setMaximumActiveRequests(LiRequest::RequestType type, int maximum) { m_maximumActive[type] = maximum; }
+
+    int activeRequests(LiRequest::RequestType type) const { return m_active[type]; }
+
+    /**
+     * @brief
+     * 加入请求并计算一次优先级
+     * @return Handle 用于markDirty和remove的句柄
+     */
+    Handle push(const LiRequest &request)
+    {
+        int h;
+        if (m_free.empty())
+        {
+            h = int(m_entries.size());
+            m_entries.push_back(Entry());
+        }
+        else
+        {
+            h = m_free.back();
+            m_free.pop_back();
+        }
+
+        Entry &e = m_entries[h];
+        ++e.serial;
+        e.request = request;
+        e.type = request.type();
+        e.used = true;
+        e.dirty = false;
+        e.request.updatePriority();
+        e.priority = e.request.priority();
+        link(h, bucketOf(e.priority));
+
+        ++m_count[e.type];
+        ++m_size;
+
+        Handle handle;
+        handle.index = h;
+        handle.serial = e.serial;
+        return handle;
+    }
+
+    /**
+     * @brief
+     * 句柄对应的请求是否还在队列中
+     */
+    bool contains(Handle h) const
+    {
+        return h.index >= 0 && h.index < int(m_entries.size())
+                && m_entries[h.index].used && m_entries[h.index].serial == h.serial;
+    }
+
+    void remove(Handle h)
+    {
+        if (contains(h))
+            removeAt(h.index);
+    }
+
+    /**
+     * @brief
+     * 标记请求的优先级需要重新计算，通常在瓦片的屏幕空间误差或距离变化后调用
+     */
+    void markDirty(Handle h)
+    {
+        if (!contains(h) || m_entries[h.index].dirty)
+            return;
+
+        m_entries[h.index].dirty = true;
+        m_dirty.push_back(h.index);
+    }
+
+
+    /**
+     * @brief
+     * 重新计算dirty请求的优先级，另外轮询最多maximumRescore个请求，
+     * 保证没有被标记的请求也会逐渐更新
+     */
+    void update(int maximumRescore = 64)
+    {
+        for (int h : m_dirty)
+        {
+            Entry &e = m_entries[h];
+            if (e.used && e.dirty)
+                rescore(h);
+        }
+        m_dirty.clear();
+
+        const int count = int(m_entries.size());
+        for (int i = 0; i < maximumRescore && i < count; ++i)
+        {
+            m_cursor = m_cursor + 1 < count ? m_cursor + 1 : 0;
+            if (m_entries[m_cursor].used)
+                rescore(m_cursor);
+        }
+    }
+
+    /**
+     * @brief
+     * 取出预算内优先级最高的请求。被取消的请求会被直接丢弃。
+     * @param request 输出的请求
+     * @param canIssue 额外的过滤条件，如服务器是否还有空闲连接
+     * @return bool 没有可发出的请求时返回false
+     */
+    bool pop(LiRequest *request, const std::function<bool(const LiRequest &)> &canIssue = nullptr)
+    {
+        quint64 skipped[NumberOfTypes];
+        for (int t = 0; t < NumberOfTypes; ++t)
+        {
+            skipped[t] = 0;
+        }
+
+        for (;;)
+        {
+            int bestType = -1;
+            int bestBucket = NumberOfBuckets;
+            for (int i = 0; i < NumberOfTypes; ++i)
+            {
+                // 同一桶内的类型轮流出队
+                int t = (m_nextType + i) % NumberOfTypes;
+                if (m_active[t] >= m_maximumActive[t])
+                    continue;
+
+                quint64 mask = m_nonEmpty[t] & ~skipped[t];
+                if (!mask)
+                    continue;
+
+                int b = lowestBit(mask);
+                if (b < bestBucket)
+                {
+                    bestBucket = b;
+                    bestType = t;
+                }
+            }
+
+            if (bestType < 0)
+                return false;
+
+            // 桶内是按优先级排列的小顶堆，canIssue拒绝的请求先移出，找到结果后再放回
+            std::vector<int> &bucket = m_buckets[bestType][bestBucket];
+            int best = -1;
+            while (!bucket.empty())
+            {
+                int h = bucket.front();
+                Entry &e = m_entries[h];
+                if (e.request.isCanceled())
+                {
+                    removeAt(h);
+                    continue;
+                }
+
+                if (canIssue && !canIssue(e.request))
+                {
+                    unlink(h);
+                    m_rejected.push_back(h);
+                    continue;
+                }
+
+                best = h;
+                break;
+            }
+
+            for (int h : m_rejected)
+                link(h, bestBucket);
+            m_rejected.clear();
+
+            if (best < 0)
+            {
+                skipped[bestType] |= quint64(1) << bestBucket;
+                continue;
+            }
+
+            *request = m_entries[best].request;
+            removeAt(best);
+            ++m_active[bestType];
+            m_nextType = (bestType + 1) % NumberOfTypes;
+            return true;
+        }
+    }
+
+    /**
+     * @brief
+     * 请求完成、失败或取消后调用，归还该类型的并发预算
+     */
+    void release(LiRequest::RequestType type)
+    {
+        if (m_active[type] > 0)
+            --m_active[type];
+    }
+
+    /**
+     * @brief
+     * 按优先级从低到高丢弃超出maximumLength的请求，丢弃的请求会被cancel
+     */
+    void trim(int maximumLength)
+    {
+        for (int b = NumberOfBuckets - 1; b >= 0 && m_size > maximumLength; --b)
+        {
+            for (int t = 0; t < NumberOfTypes && m_size > maximumLength; ++t)
+            {
+                // 小顶堆的末尾不一定是优先级最低的，只丢弃桶的一部分时先选出优先级数值最大的请求
+                std::vector<int> victims = m_buckets[t][b];
+                const int excess = m_size - maximumLength;
+                if (excess < int(victims.size()))
+                {
+                    std::nth_element(victims.begin(), victims.begin() + excess, victims.end(),
+                                     [this](int x, int y) { return lessThan(y, x); });
+                    victims.resize(size_t(excess));
+                }
+
+                for (int h : victims)
+                {
+                    m_entries[h].request.cancel();
+                    removeAt(h);
+                }
+            }
+        }
+    }
+
+    static int bucketOf(double priority)
+    {
+        if (!(priority > 0.0))
+            return 0;
+
+        int b = int(std::log2(1.0 + priority) * BucketsPerOctave);
+        return b < NumberOfBuckets ? b : NumberOfBuckets - 1;
+    }
+
+private:
+    struct Entry
+    {
+        LiRequest request;
+        quint32 serial = 0;
+        double priority = 0.0;
+        int type = 0;
+        int bucket = -1;
+        int position = -1;
+        bool used = false;
+        bool dirty = false;
+    };
+
+    void removeAt(int h)
+    {
+        Entry &e = m_entries[h];
+        unlink(h);
+        e.used = false;
+        e.dirty = false;
+        e.request = LiRequest();
+        m_free.push_back(h);
+
+        --m_count[e.type];
+        --m_size;
+    }
+
+    void rescore(int h)
+    {
+        Entry &e = m_entries[h];
+        e.dirty = false;
+        e.request.updatePriority();
+        e.priority = e.request.priority();
+
+        int b = bucketOf(e.priority);
+        if (b != e.bucket)
+        {
+            unlink(h);
+            link(h, b);
+        }
+        else
+        {
+            std::vector<int> &bucket = m_buckets[e.type][b];
+            siftDown(bucket, siftUp(bucket, e.position));
+        }
+    }
+
+    void link(int h, int b)
+    {
+        Entry &e = m_entries[h];
+        std::vector<int> &bucket = m_buckets[e.type][b];
+        e.bucket = b;
+        e.position = int(bucket.size());
+        bucket.push_back(h);
+        siftUp(bucket, e.position);
+        m_nonEmpty[e.type] |= quint64(1) << b;
+    }
+
+    void unlink(int h)
+    {
+        Entry &e = m_entries[h];
+        std::vector<int> &bucket = m_buckets[e.type][e.bucket];
+        const int position = e.position;
+        int last = bucket.back();
+        bucket[position] = last;
+        m_entries[last].position = position;
+        bucket.pop_back();
+        if (position < int(bucket.size()))
+            siftDown(bucket, siftUp(bucket, position));
+        if (bucket.empty())
+            m_nonEmpty[e.type] &= ~(quint64(1) << e.bucket);
+
+        e.bucket = -1;
+        e.position = -1;
+    }
+
+    bool lessThan(int a, int b) const
+    {
+        return m_entries[a].priority < m_entries[b].priority;
+    }
+
+    void place(std::vector<int> &bucket, int position, int h)
+    {
+        bucket[position] = h;
+        m_entries[h].position = position;
+    }
+
+    int siftUp(std::vector<int> &bucket, int position)
+    {
+        int h = bucket[position];
+        while (position > 0)
+        {
+            int parent = (position - 1) / 2;
+            if (!lessThan(h, bucket[parent]))
+                break;
+            place(bucket, position, bucket[parent]);
+            position = parent;
+        }
+        place(bucket, position, h);
+        return position;
+    }
+
+    void siftDown(std::vector<int> &bucket, int position)
+    {
+        const int count = int(bucket.size());
+        int h = bucket[position];
+        for (;;)
+        {
+            int child = position * 2 + 1;
+            if (child >= count)
+                break;
+            if (child + 1 < count && lessThan(bucket[child + 1], bucket[child]))
+                ++child;
+            if (!lessThan(bucket[child], h))
+                break;
+            place(bucket, position, bucket[child]);
+            position = child;
+        }
+        place(bucket, position, h);
+    }
+
+    static int lowestBit(quint64 mask)
+    {
+        int i = 0;
+        while (!(mask & 1))
+        {
+            mask >>= 1;
+            ++i;
+        }
+        return i;
+    }
+
+    std::vector<Entry> m_entries;
+    std::vector<int> m_free;
+    std::vector<int> m_dirty;
+    std::vector<int> m_rejected;
+    std::vector<int> m_buckets[NumberOfTypes][NumberOfBuckets];
+    quint64 m_nonEmpty[NumberOfTypes];
+    int m_active[NumberOfTypes];
+    int m_maximumActive[NumberOfTypes];
+    int m_count[NumberOfTypes];
+    int m_nextType;
+    int m_cursor;
+    int m_size;
+};
+
+#endif // REQUESTQUEUE_H
@@ -0,0 +1,486 @@
+#ifndef TERRAINHEIGHTSAMPLER_H
+#define TERRAINHEIGHTSAMPLER_H
+
+#include "licore_global.h"
+#include "quadtreetile.h"
+#include "globesurfacetile.h"
+#include "terraindata.h"
+#include "cartographic.h"
+#include <QtConcurrent>
+#include <cmath>
+
+/**
+ * @brief
+ * 批量地形高度采样，用于树木实例、3DTiles瓦片角点等大量点的贴地。
+ * 每个点记录所在的已加载地形数据的最深瓦片。update()在主线程中只检查这些瓦片：瓦片的地形数据变化、
+ * 被释放或有子瓦片加载了地形时，才为其中的点重新查找瓦片，地形数据确实变化的点按瓦片分组，
+ * 各组在线程池中并行调用TerrainData::interpolateHeight；apply()在主线程中写回高度变化的点并增加版本号，
+ * 使用者通过changedSince()只处理上次之后变化的点。
+ */
+class TerrainHeightSampler
+{
+public:
+    struct Change
+    {
+        int index;
+        quint32 generation;     ///< 采样时点的位置版本，点在之后被setPosition移动时结果作废
+        double height;
+    };
+
+    /**
+     * @brief
+     * 一次update()的采样结果。generation不是当前值时（之后调用过clear），apply()丢弃全部结果；
+     * 之后被setPosition移动的点只丢弃该点的结果，addPoints不影响已有点的结果
+     */
+    struct ChangeList
+    {
+        quint64 generation = 0;
+        QVector<Change> changes;
+    };
+
+    TerrainHeightSampler()
+        : m_revision(0)
+        , m_generation(0)
+        , m_threadPool(QThreadPool::globalInstance())
+        , m_tolerance(1e-3)
+    {
+    }
+
+    QThreadPool *threadPool() const { return m_threadPool; }
+    void setThreadPool(QThreadPool *pool) { m_threadPool = pool; }
+
+    /**
+     * @brief
+     * 高度变化小于tolerance（米）时不报告
+     */
+    double tolerance() const { return m_tolerance; }
+    void setTolerance(double tolerance) { m_tolerance = tolerance; }
+
+    /**
+     * @brief
+     * 添加点，经纬度为弧度，返回第一个点的序号
+     */
+    int addPoints(const QVector<Cartographic> &positions)
+    {
+        int first = m_points.size();
+        m_points.reserve(first + positions.size());
+        for (const Cartographic &position : positions)
+        {
+            Point point;
+            point.position = position;
+            m_points.append(point);
+            queue(m_points.size() - 1);
+        }
+        return first;
+    }
+
+    void setPosition(int index, const Cartographic &position)
+    {
+        m_points[index].position = position;
+        ++m_points[index].generation;
+        detach(index);
+        queue(index);
+    }
+
+    void clear()
+    {
+        m_points.clear();
+        m_tiles.clear();
+        m_queued.clear();
+        ++m_generation;
+    }
+
+    int count() const { return m_points.size(); }
+    bool hasHeight(int index) const { return m_points[index].changedRevision > 0; }
+    double height(int index) const { return m_points[index].height; }
+    quint64 revision() const { return m_revision; }
+
+    /**
+     * @brief
+     * 计算需要重新采样的点并在线程池中采样，必须在主线程中调用
+     * @param levelZeroTiles QuadtreePrimitive::levelZeroTiles()
+     * @return 重新采样的点，需要交给apply()
+     */
+    QFuture<ChangeList> update(const QVector<QuadtreeTile *> &levelZeroTiles)
+    {
+        QHash<QuadtreeTile *, int> groupIndex;
+        QVector<Group> groups;
+
+        // 新加入、移动过或之前没有地形的点从根瓦片查找
+        QVector<int> points;
+        points.swap(m_queued);
+        for (int index : points)
+        {
+            m_points[index].queued = false;
+            if (m_points[index].tile == NoTile)
+                assign(index, deepestTile(levelZeroTiles, m_points[index].position), &groups, &groupIndex);
+        }
+
+        // 检查每个已分配的瓦片，没有变化的瓦片中的点直接跳过，本次找不到地形的点留到下一次update()
+        struct Stale
+        {
+            quint64 key;
+            QuadtreeTile *tile;
+        };
+        QVector<Stale> stale;
+        for (auto it = m_tiles.constBegin(); it != m_tiles.constEnd(); ++it)
+        {
+            QuadtreeTile *tile = findTile(levelZeroTiles, it.key());
+            if (!hasTerrain(tile))
+                stale.append({it.key(), nullptr});
+            else if (!isCurrent(it.value(), tile) || hasTerrainChild(tile))
+                stale.append({it.key(), tile});
+        }
+
+        for (const Stale &s : stale)
+        {
+            const TileEntry entry = m_tiles.take(s.key);
+            points = entry.points;
+            for (int index : points)
+            {
+                m_points[index].tile = NoTile;
+                m_points[index].slot = -1;
+            }
+            for (int index : points)
+            {
+                QuadtreeTile *tile = s.tile ? deepestTile(s.tile, m_points[index].position) : nullptr;
+                if (!tile)
+                    tile = deepestTile(levelZeroTiles, m_points[index].position);
+
+                // 瓦片和地形数据都没变的点不需要重新采样
+                const bool unchanged = tile && makeKey(tile) == s.key && isCurrent(entry, tile);
+                assign(index, tile, unchanged ? nullptr : &groups, &groupIndex);
+            }
+        }
+
+        const quint64 generation = m_generation;
+        if (groups.isEmpty())
+        {
+            ChangeList empty;
+            empty.generation = generation;
+            QFutureInterface<ChangeList> promise;
+            promise.reportStarted();
+            promise.reportResult(empty);
+            promise.reportFinished();
+            return promise.future();
+        }
+
+        QThreadPool *pool = m_threadPool;
+        return QtConcurrent::run(pool, [groups, pool, generation]() {
+            QVector<QVector<Change>> partials(groups.size());
+            QVector<QFuture<void>> futures;
+            for (int g = 0; g < groups.size(); ++g)
+            {
+                QVector<Change> *partial = &partials[g];
+                const Group *group = &groups[g];
+                futures.append(QtConcurrent::run(pool, [group, partial]() {
+                    sampleGroup(*group, partial);
+                }));
+            }
+
+            ChangeList result;
+            result.generation = generation;
+            for (int g = 0; g < futures.size(); ++g)
+            {
+                futures[g].waitForFinished();
+                result.changes += partials[g];
+            }
+            return result;
+        });
+    }
+
+    /**
+     * @brief
+     * 写回采样结果，高度有变化时增加版本号，必须在主线程中调用。
+     * clear()之前的结果整体丢弃；采样后被移动的点已经重新排队，只丢弃它们的结果
+     */
+    void apply(const ChangeList &changes)
+    {
+        if (changes.generation != m_generation)
+            return;
+
+        bool changed = false;
+        for (const Change &change : changes.changes)
+        {
+            Point &point = m_points[change.index];
+            if (point.generation != change.generation)
+                continue;
+
+            if (point.changedRevision == 0 || std::fabs(point.height - change.height) >= m_tolerance)
+            {
+                if (!changed)
+                {
+                    ++m_revision;
+                    changed = true;
+                }
+                point.height = change.height;
+                point.changedRevision = m_revision;
+            }
+        }
+    }
+
+    /**
+     * @brief
+     * 返回版本号revision之后高度变化的点
+     */
+    void changedSince(quint64 revision, QVector<int> *indices) const
+    {
+        indices->clear();
+        for (int i = 0; i < m_points.size(); ++i)
+        {
+            if (m_points[i].changedRevision > revision)
+                indices->append(i);
+        }
+    }
+
+private:
+    static const quint64 NoTile = ~quint64(0);
+
+    struct Point
+    {
+        Cartographic position;
+        double height = 0.0;
+        quint64 changedRevision = 0;
+        quint32 generation = 0;     ///< 位置版本，每次setPosition加一
+        quint64 tile = NoTile;      ///< 所在瓦片的键
+        int slot = -1;              ///< 在TileEntry::points中的位置
+        bool queued = false;
+    };
+
+    /**
+     * @brief
+     * 已分配点的瓦片，记录分配时的地形数据
+     */
+    struct TileEntry
+    {
+        TerrainData *source = nullptr;
+        QWeakPointer<TerrainData> sourceRef;
+        QVector<int> points;
+    };
+
+    struct Group
+    {
+        LiRectangle rectangle;
+        QSharedPointer<TerrainData> data;
+        QVector<int> points;
+        QVector<quint32> generations;
+        QVector<Cartographic> positions;
+    };
+
+    static quint64 makeKey(int x, int y, int level)
+    {
+        return (quint64(level) << 58) | (quint64(y) << 29) | quint64(x);
+    }
+
+    static quint64 makeKey(QuadtreeTile *tile)
+    {
+        return makeKey(tile->x(), tile->y(), tile->level());
+    }
+
+    static bool isCurrent(const TileEntry &entry, QuadtreeTile *tile)
+    {
+        return !entry.sourceRef.isNull() && tile->data()->terrainData().data() == entry.source;
+    }
+
+    void queue(int index)
+    {
+        Point &point = m_points[index];
+        if (!point.queued)
+        {
+            point.queued = true;
+            m_queued.append(index);
+        }
+    }
+
+    /**
+     * @brief
+     * 把点从所在瓦片的列表中移除
+     */
+    void detach(int index)
+    {
+        Point &point = m_points[index];
+        if (point.tile == NoTile)
+            return;
+
+        auto it = m_tiles.find(point.tile);
+        if (it != m_tiles.end())
+        {
+            QVector<int> &points = it.value().points;
+            const int last = points.last();
+            points[point.slot] = last;
+            m_points[last].slot = point.slot;
+            points.removeLast();
+            if (points.isEmpty())
+                m_tiles.erase(it);
+        }
+        point.tile = NoTile;
+        point.slot = -1;
+    }
+
+    /**
+     * @brief
+     * 把点分配到瓦片，groups不为空时加入该瓦片的采样组；没有地形的点留到下一次update()
+     */
+    void assign(int index, QuadtreeTile *tile, QVector<Group> *groups, QHash<QuadtreeTile *, int> *groupIndex)
+    {
+        if (!tile)
+        {
+            queue(index);
+            return;
+        }
+
+        const quint64 key = makeKey(tile);
+        auto entry = m_tiles.find(key);
+        if (entry == m_tiles.end())
+        {
+            entry = m_tiles.insert(key, TileEntry());
+            entry.value().source = tile->data()->terrainData().data();
+            entry.value().sourceRef = tile->data()->terrainData();
+        }
+
+        Point &point = m_points[index];
+        point.tile = key;
+        point.slot = entry.value().points.size();
+        entry.value().points.append(index);
+
+        if (!groups)
+            return;
+
+        auto it = groupIndex->find(tile);
+        if (it == groupIndex->end())
+        {
+            Group group;
+            group.rectangle = tile->rectangle();
+            group.data = tile->data()->terrainData();
+            it = groupIndex->insert(tile, groups->size());
+            groups->append(group);
+        }
+        Group &group = (*groups)[it.value()];
+        group.points.append(index);
+        group.generations.append(point.generation);
+        group.positions.append(point.position);
+    }
+
+    static bool contains(const LiRectangle &rectangle, const Cartographic &position)
+    {
+        return position.longitude >= rectangle.west && position.longitude <= rectangle.east
+                && position.latitude >= rectangle.south && position.latitude <= rectangle.north;
+    }
+
+    static bool hasTerrain(QuadtreeTile *tile)
+    {
+        return tile && tile->data() && tile->data()->terrainData();
+    }
+
+    static bool hasTerrainChild(QuadtreeTile *tile)
+    {
+        return hasTerrain(tile->findNorthwestChild()) || hasTerrain(tile->findNortheastChild())
+                || hasTerrain(tile->findSouthwestChild()) || hasTerrain(tile->findSoutheastChild());
+    }
+
+    /**
+     * @brief
+     * 按键查找已创建的瓦片，不存在时返回nullptr
+     */
+    static QuadtreeTile *findTile(const QVector<QuadtreeTile *> &levelZeroTiles, quint64 key)
+    {
+        const int level = int(key >> 58);
+        const int x = int(key & ((quint64(1) << 29) - 1));
+        const int y = int((key >> 29) & ((quint64(1) << 29) - 1));
+
+        QuadtreeTile *tile = nullptr;
+        for (QuadtreeTile *root : levelZeroTiles)
+        {
+            if (root->x() == (x >> level) && root->y() == (y >> level))
+            {
+                tile = root;
+                break;
+            }
+        }
+
+        for (int l = 1; tile && l <= level; ++l)
+        {
+            const int cx = x >> (level - l);
+            const int cy = y >> (level - l);
+            QuadtreeTile *children[4] = {
+                tile->findNorthwestChild(), tile->findNortheastChild(),
+                tile->findSouthwestChild(), tile->findSoutheastChild()
+            };
+            tile = nullptr;
+            for (QuadtreeTile *child : children)
+            {
+                if (child && child->x() == cx && child->y() == cy)
+                {
+                    tile = child;
+                    break;
+                }
+            }
+        }
+        return tile;
+    }
+
+    /**
+     * @brief
+     * 包含该点并且已有地形数据的最深瓦片
+     */
+    static QuadtreeTile *deepestTile(const QVector<QuadtreeTile *> &levelZeroTiles, const Cartographic &position)
+    {
+        for (QuadtreeTile *root : levelZeroTiles)
+        {
+            if (contains(root->rectangle(), position))
+                return deepestTile(root, position);
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief
+     * 从tile开始向下查找包含该点并且已有地形数据的最深瓦片
+     */
+    static QuadtreeTile *deepestTile(QuadtreeTile *tile, const Cartographic &position)
+    {
+        QuadtreeTile *result = hasTerrain(tile) ? tile : nullptr;
+        while (tile)
+        {
+            const LiRectangle &r = tile->rectangle();
+            bool east = position.longitude >= (r.west + r.east) * 0.5;
+            bool north = position.latitude >= (r.south + r.north) * 0.5;
+
+            if (north)
+                tile = east ? tile->findNortheastChild() : tile->findNorthwestChild();
+            else
+                tile = east ? tile->findSoutheastChild() : tile->findSouthwestChild();
+
+            if (hasTerrain(tile))
+                result = tile;
+        }
+        return result;
+    }
+
+    static void sampleGroup(const Group &group, QVector<Change> *changes)
+    {
+        for (int i = 0; i < group.points.size(); ++i)
+        {
+            const Cartographic &position = group.positions[i];
+            double height = group.data->interpolateHeight(group.rectangle, position.longitude, position.latitude);
+            if (std::isnan(height))
+                continue;
+
+            Change change;
+            change.index = group.points[i];
+            change.generation = group.generations[i];
+            change.height = height;
+            changes->append(change);
+        }
+    }
+
+    QVector<Point> m_points;
+    QHash<quint64, TileEntry> m_tiles;
+    QVector<int> m_queued;
+    quint64 m_revision;
+    quint64 m_generation;
+    QThreadPool *m_threadPool;
+    double m_tolerance;
+};
+
+#endif // TERRAINHEIGHTSAMPLER_H
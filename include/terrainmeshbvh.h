@@ -0,0 +1,492 @@
+#ifndef TERRAINMESHBVH_H
+#define TERRAINMESHBVH_H
+
+#include "licore_global.h"
+#include "terrainmesh.h"
+#include "ray.h"
+#include "ellipsoid.h"
+#include "cartographic.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+/**
+ * @brief
+ * 地形网格的三角形包围体层次（BVH），用于拾取和高度查询。
+ * 顶点由TerrainMesh::decodePosition解码一次后保存，不包括裙边三角形。
+ * 高度查询沿椭球法线发出竖直射线，与GlobeSurfaceTile::getHeight的做法一致。
+ * 通常通过TerrainMeshBVHCache在第一次查询时按需创建。
+ */
+class TerrainMeshBVH
+{
+public:
+    /**
+     * @brief
+     * 由网格创建BVH
+     * @param mesh 地形网格
+     * @param leafSize 叶子节点最多包含的三角形数量
+     */
+    explicit TerrainMeshBVH(const TerrainMesh &mesh, int leafSize = 4)
+        : m_minimumHeight(mesh.minimumHeight)
+    {
+        build(mesh, qMax(1, leafSize));
+    }
+
+    /**
+     * @brief
+     * 由已解码的顶点坐标和三角形索引创建BVH
+     * @param positions 顶点坐标，每个顶点3个double
+     * @param indices 三角形索引，每3个一组
+     * @param minimumHeight 网格的最低高度，用于高度查询
+     * @param leafSize 叶子节点最多包含的三角形数量
+     */
+    TerrainMeshBVH(const std::vector<double> &positions, const std::vector<quint32> &indices,
+                   double minimumHeight = 0.0, int leafSize = 4)
+        : m_minimumHeight(minimumHeight)
+    {
+        build(positions.data(), int(positions.size() / 3), int(indices.size()),
+              [&](int i) { return int(indices[size_t(i)]); }, qMax(1, leafSize));
+    }
+
+    int triangleCount() const { return int(m_triangles.size()); }
+    int nodeCount() const { return int(m_nodes.size()); }
+
+    /**
+     * @brief
+     * 射线与网格的最近交点，与GlobeSurfaceTile::pick的结果一致
+     * @param ray 射线
+     * @param cullBackFaces 是否忽略背面
+     * @param result 输出，交点坐标
+     * @return 是否相交
+     */
+    bool pick(const Ray &ray, bool cullBackFaces, Cartesian3 *result) const
+    {
+        if (m_nodes.empty())
+            return false;
+
+        const double origin[3] = { ray.origin.x(), ray.origin.y(), ray.origin.z() };
+        const double direction[3] = { ray.direction.x(), ray.direction.y(), ray.direction.z() };
+        double inverse[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            inverse[i] = direction[i] != 0.0 ? 1.0 / direction[i] : std::numeric_limits<double>::infinity();
+        }
+
+        double closest = std::numeric_limits<double>::max();
+        bool hit = false;
+
+        QVarLengthArray<int, 64> stack;
+        stack.append(0);
+        while (!stack.isEmpty())
+        {
+            const Node &node = m_nodes[stack.last()];
+            stack.removeLast();
+            if (rayBox(node, origin, inverse) >= closest)
+                continue;
+
+            if (node.count > 0)
+            {
+                for (int i = node.first; i < node.first + node.count; ++i)
+                {
+                    double t;
+                    if (rayTriangle(m_triangles[i], origin, direction, cullBackFaces, &t) && t < closest)
+                    {
+                        closest = t;
+                        hit = true;
+                    }
+                }
+                continue;
+            }
+
+            // 先访问较近的子节点
+            const int left = node.first;
+            const int right = node.first + 1;
+            double tl = rayBox(m_nodes[left], origin, inverse);
+            double tr = rayBox(m_nodes[right], origin, inverse);
+            if (tl > tr)
+            {
+                if (tl < closest) stack.append(left);
+                if (tr < closest) stack.append(right);
+            }
+            else
+            {
+                if (tr < closest) stack.append(right);
+                if (tl < closest) stack.append(left);
+            }
+        }
+
+        if (hit && result)
+        {
+            *result = Cartesian3(origin[0] + direction[0] * closest,
+                                 origin[1] + direction[1] * closest,
+                                 origin[2] + direction[2] * closest);
+        }
+        return hit;
+    }
+
+    /**
+     * @brief
+     * 经纬度处的地形高度。射线从网格最低高度与-11500米中较低者出发，沿椭球法线向上，不忽略背面
+     * @param position 经纬度（弧度），height不使用
+     * @param result 输出，交点相对椭球的高度
+     * @return 该位置是否在网格范围内
+     */
+    bool height(const Cartographic &position, double *result, const Ellipsoid *ellipsoid = Ellipsoid::WGS84()) const
+    {
+        const Cartographic surface(position.longitude, position.latitude, 0.0);
+        const Vector3 normal = ellipsoid->geodeticSurfaceNormalCartographic(surface);
+        const Vector3 origin = Vector3(ellipsoid->cartographicToCartesian(surface)) + normal * std::min(m_minimumHeight, -11500.0);
+
+        Cartesian3 hit;
+        if (!pick(Ray(origin, normal), false, &hit))
+            return false;
+        if (result)
+            *result = ellipsoid->cartesianToCartographic(hit).height;
+        return true;
+    }
+
+private:
+    struct Triangle
+    {
+        double v0[3];
+        double e1[3];
+        double e2[3];
+    };
+
+    struct Node
+    {
+        double minimum[3];
+        double maximum[3];
+        qint32 first;   // 内部节点为左子节点序号，叶子节点为第一个三角形序号
+        qint32 count;   // 叶子节点的三角形数量，内部节点为0
+    };
+
+    struct BuildItem
+    {
+        double minimum[3];
+        double maximum[3];
+        double centroid[3];
+        int triangle;
+    };
+
+    void build(const TerrainMesh &mesh, int leafSize)
+    {
+        const int vertexCount = mesh.vertexCountWithoutSkirts > 0 ? mesh.vertexCountWithoutSkirts : mesh.vertexCount();
+        const int indexCount = mesh.indexCountWithoutSkirts > 0 ? mesh.indexCountWithoutSkirts : mesh.indexCount();
+        if (vertexCount <= 0 || indexCount < 3 || mesh.indexStrideBytes <= 0)
+            return;
+
+        std::vector<double> positions(size_t(vertexCount) * 3);
+        for (int i = 0; i < vertexCount; ++i)
+        {
+            Cartesian3 p = mesh.decodePosition(i);
+            positions[i * 3] = p.x;
+            positions[i * 3 + 1] = p.y;
+            positions[i * 3 + 2] = p.z;
+        }
+
+        auto index = [&](int i) -> int {
+            if (mesh.indexStrideBytes == 2)
+                return reinterpret_cast<const quint16 *>(mesh.indexData.constData())[i];
+            return int(reinterpret_cast<const quint32 *>(mesh.indexData.constData())[i]);
+        };
+
+        build(positions.data(), vertexCount, indexCount, index, leafSize);
+    }
+
+    template <typename Index>
+    void build(const double *positions, int vertexCount, int indexCount, const Index &index, int leafSize)
+    {
+        if (vertexCount <= 0 || indexCount < 3)
+            return;
+
+        std::vector<BuildItem> items;
+        std::vector<Triangle> triangles;
+        items.reserve(indexCount / 3);
+        triangles.reserve(indexCount / 3);
+        for (int i = 0; i + 2 < indexCount; i += 3)
+        {
+            int i0 = index(i), i1 = index(i + 1), i2 = index(i + 2);
+            if (i0 < 0 || i1 < 0 || i2 < 0 || i0 >= vertexCount || i1 >= vertexCount || i2 >= vertexCount)
+                continue;
+
+            const double *p0 = &positions[i0 * 3];
+            const double *p1 = &positions[i1 * 3];
+            const double *p2 = &positions[i2 * 3];
+
+            Triangle triangle;
+            BuildItem item;
+            for (int c = 0; c < 3; ++c)
+            {
+                triangle.v0[c] = p0[c];
+                triangle.e1[c] = p1[c] - p0[c];
+                triangle.e2[c] = p2[c] - p0[c];
+                item.minimum[c] = std::min(p0[c], std::min(p1[c], p2[c]));
+                item.maximum[c] = std::max(p0[c], std::max(p1[c], p2[c]));
+                item.centroid[c] = (item.minimum[c] + item.maximum[c]) * 0.5;
+            }
+            item.triangle = int(triangles.size());
+            triangles.push_back(triangle);
+            items.push_back(item);
+        }
+
+        if (items.empty())
+            return;
+
+        m_nodes.reserve(items.size() * 2 / leafSize + 1);
+        m_nodes.push_back(Node());
+
+        struct Range { int node; int begin; int end; };
+        std::vector<Range> work;
+        work.push_back({0, 0, int(items.size())});
+        while (!work.empty())
+        {
+            Range range = work.back();
+            work.pop_back();
+
+            Node node;
+            double centroidMin[3], centroidMax[3];
+            for (int c = 0; c < 3; ++c)
+            {
+                node.minimum[c] = centroidMin[c] = std::numeric_limits<double>::max();
+                node.maximum[c] = centroidMax[c] = -std::numeric_limits<double>::max();
+            }
+            for (int i = range.begin; i < range.end; ++i)
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    node.minimum[c] = std::min(node.minimum[c], items[i].minimum[c]);
+                    node.maximum[c] = std::max(node.maximum[c], items[i].maximum[c]);
+                    centroidMin[c] = std::min(centroidMin[c], items[i].centroid[c]);
+                    centroidMax[c] = std::max(centroidMax[c], items[i].centroid[c]);
+                }
+            }
+
+            const int count = range.end - range.begin;
+            if (count <= leafSize)
+            {
+                node.first = range.begin;
+                node.count = count;
+                m_nodes[range.node] = node;
+                continue;
+            }
+
+            // 在质心范围最大的轴上按中位数划分
+            int axis = 0;
+            for (int c = 1; c < 3; ++c)
+            {
+                if (centroidMax[c] - centroidMin[c] > centroidMax[axis] - centroidMin[axis])
+                    axis = c;
+            }
+            const int middle = range.begin + count / 2;
+            std::nth_element(items.begin() + range.begin, items.begin() + middle, items.begin() + range.end,
+                             [axis](const BuildItem &a, const BuildItem &b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+
+            node.first = int(m_nodes.size());
+            node.count = 0;
+            m_nodes[range.node] = node;
+            m_nodes.push_back(Node());
+            m_nodes.push_back(Node());
+            work.push_back({node.first, range.begin, middle});
+            work.push_back({node.first + 1, middle, range.end});
+        }
+
+        // 按叶子顺序重新排列三角形
+        m_triangles.reserve(items.size());
+        for (const BuildItem &item : items)
+        {
+            m_triangles.push_back(triangles[item.triangle]);
+        }
+    }
+
+    /**
+     * @brief
+     * 射线进入包围盒的参数，不相交时返回最大值
+     */
+    static double rayBox(const Node &node, const double *origin, const double *inverse)
+    {
+        double tmin = 0.0;
+        double tmax = std::numeric_limits<double>::max();
+        for (int c = 0; c < 3; ++c)
+        {
+            double t0 = (node.minimum[c] - origin[c]) * inverse[c];
+            double t1 = (node.maximum[c] - origin[c]) * inverse[c];
+            if (t0 > t1)
+                std::swap(t0, t1);
+            // 射线与坐标面平行时t为nan，此时不限制该轴
+            if (t0 == t0)
+                tmin = std::max(tmin, t0);
+            if (t1 == t1)
+                tmax = std::min(tmax, t1);
+            if (tmin > tmax)
+                return std::numeric_limits<double>::max();
+        }
+        return tmin;
+    }
+
+    /**
+     * @brief
+     * Möller–Trumbore射线三角形求交，与Intersect::rayTriangleParametric一致
+     */
+    static bool rayTriangle(const Triangle &triangle, const double *origin, const double *direction,
+                            bool cullBackFaces, double *t)
+    {
+        const double *e1 = triangle.e1;
+        const double *e2 = triangle.e2;
+        const double p[3] = {
+            direction[1] * e2[2] - direction[2] * e2[1],
+            direction[2] * e2[0] - direction[0] * e2[2],
+            direction[0] * e2[1] - direction[1] * e2[0]
+        };
+        const double det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+        const double epsilon = 1e-6;
+
+        const double tvec[3] = {
+            origin[0] - triangle.v0[0],
+            origin[1] - triangle.v0[1],
+            origin[2] - triangle.v0[2]
+        };
+        const double q[3] = {
+            tvec[1] * e1[2] - tvec[2] * e1[1],
+            tvec[2] * e1[0] - tvec[0] * e1[2],
+            tvec[0] * e1[1] - tvec[1] * e1[0]
+        };
+
+        if (cullBackFaces)
+        {
+            if (det < epsilon)
+                return false;
+
+            double u = tvec[0] * p[0] + tvec[1] * p[1] + tvec[2] * p[2];
+            if (u < 0.0 || u > det)
+                return false;
+
+            double v = direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2];
+            if (v < 0.0 || u + v > det)
+                return false;
+
+            *t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) / det;
+        }
+        else
+        {
+            if (std::fabs(det) < epsilon)
+                return false;
+
+            double invDet = 1.0 / det;
+            double u = (tvec[0] * p[0] + tvec[1] * p[1] + tvec[2] * p[2]) * invDet;
+            if (u < 0.0 || u > 1.0)
+                return false;
+
+            double v = (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]) * invDet;
+            if (v < 0.0 || u + v > 1.0)
+                return false;
+
+            *t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * invDet;
+        }
+
+        return *t >= 0.0;
+    }
+
+    double m_minimumHeight = 0.0;
+    std::vector<Node> m_nodes;
+    std::vector<Triangle> m_triangles;
+};
+
+/**
+ * @brief
+ * 地形网格到BVH的缓存，由持有网格的对象（如地形图层）拥有，可以在多个线程中使用。
+ * 以网格地址为键，并用弱引用确认仍是同一个网格。TerrainMesh::flattenMesh、restoreLodedData等
+ * 原地修改顶点的操作之后需要调用invalidate()。已释放网格的条目在条目数达到上次清理后的两倍时统一清理。
+ */
+class TerrainMeshBVHCache
+{
+public:
+    /**
+     * @brief
+     * 获取网格的BVH，不存在或已失效时创建
+     */
+    QSharedPointer<TerrainMeshBVH> get(const QSharedPointer<TerrainMesh> &mesh)
+    {
+        if (!mesh || mesh->vertexData.isEmpty())
+            return QSharedPointer<TerrainMeshBVH>();
+
+        {
+            QMutexLocker locker(&m_mutex);
+            auto it = m_entries.constFind(mesh.data());
+            if (it != m_entries.constEnd() && it.value().mesh.toStrongRef() == mesh)
+                return it.value().bvh;
+        }
+
+        // 在锁外创建，不阻塞其他网格的查询
+        QSharedPointer<TerrainMeshBVH> bvh(new TerrainMeshBVH(*mesh));
+
+        QMutexLocker locker(&m_mutex);
+        Entry &entry = m_entries[mesh.data()];
+        if (entry.mesh.toStrongRef() != mesh)
+        {
+            entry.mesh = mesh;
+            entry.bvh = bvh;
+        }
+        bvh = entry.bvh;
+
+        if (m_entries.size() >= m_cleanupSize)
+            removeExpired();
+        return bvh;
+    }
+
+    /**
+     * @brief
+     * 网格顶点被原地修改后调用，下一次get()重新创建BVH
+     */
+    void invalidate(const TerrainMesh *mesh)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_entries.remove(mesh);
+    }
+
+    void clear()
+    {
+        QMutexLocker locker(&m_mutex);
+        m_entries.clear();
+        m_cleanupSize = MinimumCleanupSize;
+    }
+
+    int size() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_entries.size();
+    }
+
+private:
+    enum
+    {
+        MinimumCleanupSize = 64
+    };
+
+    struct Entry
+    {
+        QWeakPointer<TerrainMesh> mesh;
+        QSharedPointer<TerrainMeshBVH> bvh;
+    };
+
+    void removeExpired()
+    {
+        for (auto it = m_entries.begin(); it != m_entries.end();)
+        {
+            if (it.value().mesh.isNull())
+                it = m_entries.erase(it);
+            else
+                ++it;
+        }
+        m_cleanupSize = qMax(int(MinimumCleanupSize), m_entries.size() * 2);
+    }
+
+    mutable QMutex m_mutex;
+    QHash<const TerrainMesh *, Entry> m_entries;
+    int m_cleanupSize = MinimumCleanupSize;
+};
+
+#endif // TERRAINMESHBVH_H
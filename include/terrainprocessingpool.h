@@ -0,0 +1,397 @@
+#ifndef TERRAINPROCESSINGPOOL_H
+#define TERRAINPROCESSINGPOOL_H
+
+#include "licore_global.h"
+#include "terraindata.h"
+#include "asyncfuture.h"
+#include "liprocessinstance.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <vector>
+
+/**
+ * @brief
+ * 地形处理线程池。收到的地形数据在工作线程中解码，之后的upsample和createMesh（包括裙边、包围体和地平线遮挡点）
+ * 由TerrainData异步执行，通过observe()串联，工作线程不会阻塞等待这些QFuture。
+ * observe()的回调在主线程中执行，upsample完成后数据重新放回任务队列，createMesh总是由工作线程调用。
+ * 主线程每帧只在时间片内取出处理完成的瓦片并创建LiBuffer，不再由TileTerrain的状态机在processTileLoadQueue中逐步推进。
+ * 任务按优先级执行，数值越小越先处理；同一瓦片重新提交时旧任务被取消。
+ * TerrainData的实现需要允许在工作线程中调用createMesh和upsample。
+ * 由应用程序在QCoreApplication之后显式创建，第一个创建的对象登记为instance()。
+ */
+class TerrainProcessingPool
+{
+public:
+    /**
+     * @brief
+     * 在工作线程中把收到的数据解码为TerrainData，失败时返回nullptr
+     */
+    typedef std::function<TerrainData *()> DecodeFunction;
+
+    struct Result
+    {
+        int x = 0;
+        int y = 0;
+        int level = 0;
+        bool upsampled = false;
+        TerrainDataPtr data;
+        QSharedPointer<TerrainMesh> mesh;
+
+        bool isValid() const { return data && mesh; }
+    };
+
+    explicit TerrainProcessingPool(int threadCount = 0)
+        : m_alive(new int(0))
+    {
+        if (threadCount <= 0)
+            threadCount = qBound(1, QThread::idealThreadCount() - 1, 8);
+
+        m_running = 1;
+        for (int i = 0; i < threadCount; ++i)
+        {
+            Worker *worker = new Worker(this);
+            m_workers.append(worker);
+            worker->start(QThread::LowPriority);
+        }
+
+        LiProcessInstance<TerrainProcessingPool>::attach(InstanceName, this);
+    }
+
+    ~TerrainProcessingPool()
+    {
+        LiProcessInstance<TerrainProcessingPool>::detach(InstanceName, this);
+        shutdown();
+        m_alive.reset();
+    }
+
+    /**
+     * @brief
+     * 应用程序创建的线程池，没有创建时返回nullptr
+     */
+    static TerrainProcessingPool *instance()
+    {
+        return LiProcessInstance<TerrainProcessingPool>::get(InstanceName);
+    }
+
+    void shutdown()
+    {
+        if (!m_running.testAndSetOrdered(1, 0))
+            return;
+
+        m_semaphore.release(m_workers.size());
+        for (Worker *worker : m_workers)
+        {
+            worker->wait();
+            delete worker;
+        }
+        m_workers.clear();
+
+        QMutexLocker locker(&m_mutex);
+        m_jobs.clear();
+        m_ready.clear();
+    }
+
+    /**
+     * @brief
+     * 解码并创建网格
+     * @param tilingScheme 瓦片方案，在任务完成前必须有效
+     * @param decode 解码函数，在工作线程中调用
+     */
+    void process(TilingScheme *tilingScheme, int x, int y, int level, double priority,
+                 const DecodeFunction &decode, double exaggeration = 1.0)
+    {
+        Job job;
+        job.x = x;
+        job.y = y;
+        job.level = level;
+        job.priority = priority;
+        job.tilingScheme = tilingScheme;
+        job.exaggeration = exaggeration;
+        job.decode = decode;
+        enqueue(job);
+    }
+
+    /**
+     * @brief
+     * 由祖先瓦片的数据向上采样并创建网格
+     */
+    void upsample(TilingScheme *tilingScheme, const TerrainDataPtr &sourceData,
+                  int sourceX, int sourceY, int sourceLevel,
+                  int x, int y, int level, double priority, double exaggeration = 1.0)
+    {
+        Job job;
+        job.x = x;
+        job.y = y;
+        job.level = level;
+        job.priority = priority;
+        job.tilingScheme = tilingScheme;
+        job.exaggeration = exaggeration;
+        job.source = sourceData;
+        job.sourceX = sourceX;
+        job.sourceY = sourceY;
+        job.sourceLevel = sourceLevel;
+        enqueue(job);
+    }
+
+    /**
+     * @brief
+     * 取消瓦片尚未开始的任务，已开始的任务完成后结果会被丢弃
+     */
+    void cancel(int x, int y, int level)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_generations.remove(makeKey(x, y, level));
+    }
+
+    /**
+     * @brief
+     * 在主线程中取出处理完成的瓦片并调用finish，超过timeSlice毫秒后停止，剩余的留到下一帧
+     * @return 本次处理的瓦片数量
+     */
+    int processReady(qint64 timeSlice, const std::function<void(const Result &)> &finish)
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        int count = 0;
+        for (;;)
+        {
+            Result result;
+            {
+                QMutexLocker locker(&m_mutex);
+                if (m_ready.empty())
+                    break;
+                result = m_ready.front();
+                m_ready.pop_front();
+            }
+
+            finish(result);
+            ++count;
+
+            if (timer.elapsed() >= timeSlice)
+                break;
+        }
+        return count;
+    }
+
+    int pendingCount()
+    {
+        QMutexLocker locker(&m_mutex);
+        return int(m_jobs.size());
+    }
+
+    int readyCount()
+    {
+        QMutexLocker locker(&m_mutex);
+        return int(m_ready.size());
+    }
+
+    int threadCount() const { return m_workers.size(); }
+
+private:
+    static constexpr const char *InstanceName = "_li_terrainProcessingPool";
+
+    struct Job
+    {
+        int x = 0;
+        int y = 0;
+        int level = 0;
+        double priority = 0.0;
+        quint64 sequence = 0;
+        quint64 generation = 0;
+        TilingScheme *tilingScheme = nullptr;
+        double exaggeration = 1.0;
+        DecodeFunction decode;
+        TerrainDataPtr source;
+        int sourceX = 0;
+        int sourceY = 0;
+        int sourceLevel = 0;
+        TerrainDataPtr data; // 不为空时已完成向上采样，只需创建网格
+    };
+
+    struct Later
+    {
+        bool operator ()(const Job &a, const Job &b) const
+        {
+            if (a.priority != b.priority)
+                return a.priority > b.priority;
+            return a.sequence > b.sequence;
+        }
+    };
+
+    class Worker : public QThread
+    {
+    public:
+        explicit Worker(TerrainProcessingPool *pool) : m_pool(pool) {}
+
+    protected:
+        void run() override { m_pool->work(); }
+
+    private:
+        TerrainProcessingPool *m_pool;
+    };
+
+    static quint64 makeKey(int x, int y, int level)
+    {
+        return (quint64(level) << 58) | (quint64(y) << 29) | quint64(x);
+    }
+
+    void enqueue(Job &job)
+    {
+        if (!m_running.load())
+            return;
+
+        {
+            QMutexLocker locker(&m_mutex);
+            job.generation = ++m_generation;
+            m_generations.insert(makeKey(job.x, job.y, job.level), job.generation);
+            job.sequence = m_sequence++;
+            m_jobs.push_back(job);
+            std::push_heap(m_jobs.begin(), m_jobs.end(), Later());
+        }
+        m_semaphore.release();
+    }
+
+    /**
+     * @brief
+     * 把upsample完成的数据放回队列，保留原来的generation，由工作线程继续创建网格
+     */
+    void resume(Job job, TerrainData *data)
+    {
+        job.data = TerrainDataPtr(data);
+        {
+            QMutexLocker locker(&m_mutex);
+            if (!m_running.load())
+                return;
+            job.sequence = m_sequence++;
+            m_jobs.push_back(job);
+            std::push_heap(m_jobs.begin(), m_jobs.end(), Later());
+        }
+        m_semaphore.release();
+    }
+
+    bool isCurrent(const Job &job)
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_generations.value(makeKey(job.x, job.y, job.level)) == job.generation;
+    }
+
+    void work()
+    {
+        for (;;)
+        {
+            m_semaphore.acquire();
+            if (!m_running.load())
+                break;
+
+            Job job;
+            {
+                QMutexLocker locker(&m_mutex);
+                if (m_jobs.empty())
+                    continue;
+                std::pop_heap(m_jobs.begin(), m_jobs.end(), Later());
+                job = m_jobs.back();
+                m_jobs.pop_back();
+            }
+
+            if (!isCurrent(job))
+                continue;
+
+            if (job.data)
+            {
+                createMesh(job, job.data);
+            }
+            else if (job.source)
+            {
+                // 向上采样和createMesh都是异步的，不阻塞工作线程。回调在主线程中执行，只把结果放回队列
+                auto future = job.source->upsample(job.tilingScheme,
+                                                   job.sourceX, job.sourceY, job.sourceLevel,
+                                                   job.x, job.y, job.level);
+                QWeakPointer<int> alive = m_alive;
+                observe(future).subscribe([=](TerrainData *data) {
+                    if (alive && data)
+                        resume(job, data);
+                    else if (alive)
+                        finish(job, makeResult(job));
+                    else
+                        delete data;
+                }, [=]() {
+                    if (alive)
+                        finish(job, makeResult(job));
+                });
+            }
+            else
+            {
+                createMesh(job, TerrainDataPtr(job.decode ? job.decode() : nullptr));
+            }
+        }
+    }
+
+    static Result makeResult(const Job &job)
+    {
+        Result result;
+        result.x = job.x;
+        result.y = job.y;
+        result.level = job.level;
+        result.upsampled = !job.source.isNull();
+        return result;
+    }
+
+    void createMesh(const Job &job, const TerrainDataPtr &data)
+    {
+        Q_ASSERT_X(QThread::currentThread() != qApp->thread(), "TerrainProcessingPool",
+                   "createMesh must run on a worker thread");
+
+        Result result = makeResult(job);
+        result.data = data;
+
+        if (!data || !isCurrent(job))
+        {
+            finish(job, result);
+            return;
+        }
+
+        Future future = data->createMesh(job.tilingScheme, job.x, job.y, job.level, job.exaggeration);
+        QWeakPointer<int> alive = m_alive;
+        observe(future).subscribe([=]() {
+            if (!alive)
+                return;
+            Result meshed = result;
+            meshed.mesh = meshed.data->terrainMesh();
+            finish(job, meshed);
+        }, [=]() {
+            if (alive)
+                finish(job, result);
+        });
+    }
+
+    /**
+     * @brief
+     * 失败的瓦片同样返回，由主线程设置为FAILED；已取消或被重新提交的任务丢弃结果
+     */
+    void finish(const Job &job, const Result &result)
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_running.load() && m_generations.value(makeKey(job.x, job.y, job.level)) == job.generation)
+        {
+            m_generations.remove(makeKey(job.x, job.y, job.level));
+            m_ready.push_back(result);
+        }
+    }
+
+    quint64 m_sequence = 0;
+    quint64 m_generation = 0;
+    QAtomicInt m_running;
+    QSemaphore m_semaphore;
+    QMutex m_mutex;
+    std::vector<Job> m_jobs;
+    std::deque<Result> m_ready;
+    QHash<quint64, quint64> m_generations;
+    QVector<Worker *> m_workers;
+    QSharedPointer<int> m_alive;
+};
+
+#endif // TERRAINPROCESSINGPOOL_H
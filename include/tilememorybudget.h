@@ -0,0 +1,492 @@
+#ifndef TILEMEMORYBUDGET_H
+#define TILEMEMORYBUDGET_H
+
+#include "licore_global.h"
+#include "quadtreeprimitive.h"
+#include "quadtreetile.h"
+#include "globesurfacetile.h"
+#include "terrainmesh.h"
+#include "tileimagery.h"
+#include "imagery.h"
+#include "libuffer.h"
+#include "litexture.h"
+#include <QPointer>
+#include <QSet>
+
+/**
+ * @brief
+ * 地球瓦片的内存统计，单位为字节
+ */
+struct TileMemoryUsage
+{
+    qint64 cpuBytes = 0;        ///< 网格顶点、索引数据以及压平前保存的副本
+    qint64 bufferBytes = 0;     ///< 已上传的LiBuffer
+    qint64 textureBytes = 0;    ///< 影像和水面纹理
+
+    qint64 total() const { return cpuBytes + bufferBytes + textureBytes; }
+
+    TileMemoryUsage &operator +=(const TileMemoryUsage &other)
+    {
+        cpuBytes += other.cpuBytes;
+        bufferBytes += other.bufferBytes;
+        textureBytes += other.textureBytes;
+        return *this;
+    }
+
+    TileMemoryUsage &operator -=(const TileMemoryUsage &other)
+    {
+        cpuBytes -= other.cpuBytes;
+        bufferBytes -= other.bufferBytes;
+        textureBytes -= other.textureBytes;
+        return *this;
+    }
+};
+
+/**
+ * @brief
+ * 按内存预算裁剪地球瓦片缓存。TileReplacementQueue::trimTiles按瓦片数量裁剪，
+ * 而不同瓦片的内存相差可达数十倍，这里统计每个瓦片的内存，由预算换算出trimTiles需要保留的瓦片数量。
+ * 影像可能被多个瓦片共用，按共用的瓦片数平摊到每个瓦片。
+ * 影像和网格缓冲区往往在tileLoaded之后才就绪，refresh()（maximumTiles()开始时调用）重新统计状态变化的影像，
+ * 以及统计时还有影像或缓冲区未就绪的瓦片。
+ * 注意：核心库的QuadtreePrimitive没有公开替换队列和_tileCacheSize，endFrame中的trimTiles仍按固定数量裁剪，
+ * 这里算出的数量目前只用于统计和调试显示，不会真正卸载瓦片。
+ */
+class TileMemoryBudget
+{
+public:
+    struct Debug
+    {
+        qint64 budgetBytes;
+        qint64 cpuBytes;
+        qint64 bufferBytes;
+        qint64 textureBytes;
+        int tilesTracked;
+        int imageryTracked;
+        int tilesPending;           ///< 影像或缓冲区尚未就绪、每帧重新统计的瓦片
+        int lastMaximumTiles;
+        qint64 lastBytesToFree;
+    };
+
+    explicit TileMemoryBudget(qint64 budgetBytes = qint64(1024) * 1024 * 1024)
+        : m_budget(budgetBytes)
+        , m_lastMaximumTiles(-1)
+        , m_lastBytesToFree(0)
+    {
+    }
+
+    ~TileMemoryBudget()
+    {
+        for (const QMetaObject::Connection &connection : m_connections)
+            QObject::disconnect(connection);
+    }
+
+    qint64 budget() const { return m_budget; }
+    void setBudget(qint64 budgetBytes) { m_budget = budgetBytes; }
+
+    /**
+     * @brief
+     * 统计QuadtreePrimitive加载和删除的瓦片
+     */
+    void attach(QuadtreePrimitive *primitive)
+    {
+        m_connections.append(QObject::connect(primitive, &QuadtreePrimitive::tileLoaded,
+                                              [this](QuadtreeTile *tile) { update(tile); }));
+        m_connections.append(QObject::connect(primitive, &QuadtreePrimitive::tileDeleted,
+                                              [this](QuadtreeTile *tile) { remove(tile); }));
+    }
+
+    /**
+     * @brief
+     * 瓦片加载完成、影像或压平范围变化后重新统计
+     */
+    void update(QuadtreeTile *tile)
+    {
+        remove(tile);
+
+        Entry entry;
+        bool pending = false;
+        GlobeSurfaceTile *surfaceTile = tile->data();
+        if (surfaceTile)
+        {
+            entry.own = measureTerrain(surfaceTile);
+            QSharedPointer<TerrainMesh> mesh = surfaceTile->terrainMesh();
+            if (mesh && !mesh->vertexBuffer)
+                pending = true;
+
+            for (TileImagery *tileImagery : surfaceTile->imagery())
+            {
+                Imagery *imagery = tileImagery->readyImagery();
+                if (!imagery)
+                    imagery = tileImagery->loadingImagery();
+                if (!imagery || entry.imagery.contains(imagery))
+                    continue;
+
+                entry.imagery.append(imagery);
+                ImageryEntry &imageryEntry = m_imagery[imagery];
+                if (imageryEntry.tiles == 0)
+                {
+                    imageryEntry.imagery = imagery;
+                    measure(&imageryEntry);
+                }
+                else
+                {
+                    remeasure(&imageryEntry);
+                }
+                ++imageryEntry.tiles;
+
+                if (imagery->state() < Imagery::READY)
+                    pending = true;
+            }
+        }
+
+        m_total += entry.own;
+        m_tiles.insert(tile, entry);
+        if (pending)
+            m_pending.insert(tile);
+    }
+
+    /**
+     * @brief
+     * 重新统计状态变化的影像，以及上次统计时影像或缓冲区尚未就绪的瓦片
+     */
+    void refresh()
+    {
+        for (auto it = m_imagery.begin(); it != m_imagery.end(); ++it)
+            remeasure(&it.value());
+
+        const QList<QuadtreeTile *> pending = m_pending.values();
+        for (QuadtreeTile *tile : pending)
+            update(tile);
+    }
+
+    void remove(QuadtreeTile *tile)
+    {
+        m_pending.remove(tile);
+        auto it = m_tiles.find(tile);
+        if (it == m_tiles.end())
+            return;
+
+        m_total -= it->own;
+        for (Imagery *imagery : it->imagery)
+        {
+            auto imageryIt = m_imagery.find(imagery);
+            if (imageryIt == m_imagery.end())
+                continue;
+            if (--imageryIt->tiles == 0)
+            {
+                m_total -= imageryIt->usage;
+                m_imagery.erase(imageryIt);
+            }
+        }
+        m_tiles.erase(it);
+    }
+
+    void clear()
+    {
+        m_tiles.clear();
+        m_imagery.clear();
+        m_pending.clear();
+        m_total = TileMemoryUsage();
+    }
+
+    TileMemoryUsage totalUsage() const { return m_total; }
+
+    /**
+     * @brief
+     * 释放瓦片后大约能回收的内存，共用的影像按共用数平摊
+     */
+    qint64 tileBytes(QuadtreeTile *tile) const
+    {
+        auto it = m_tiles.constFind(tile);
+        if (it == m_tiles.constEnd())
+            return 0;
+
+        qint64 bytes = it->own.total();
+        for (Imagery *imagery : it->imagery)
+        {
+            auto imageryIt = m_imagery.constFind(imagery);
+            if (imageryIt != m_imagery.constEnd() && imageryIt->tiles > 0)
+                bytes += imageryIt->usage.total() / imageryIt->tiles;
+        }
+        return bytes;
+    }
+
+    /**
+     * @brief
+     * 由内存预算计算trimTiles的参数。从队尾开始累计可以卸载的瓦片，直到释放后不超过预算，
+     * 当前帧渲染的瓦片不会被卸载。开始时调用refresh()。
+     * @param queue 地球瓦片的替换队列
+     * @param frameNumber 当前帧号
+     * @param minimumTiles 至少保留的瓦片数量
+     * @return 传给TileReplacementQueue::trimTiles的最大瓦片数量
+     */
+    int maximumTiles(const TileReplacementQueue &queue, quint64 frameNumber, int minimumTiles = 0)
+    {
+        return maximumTiles(queue.tail(), queue.count(), frameNumber, minimumTiles);
+    }
+
+    /**
+     * @brief
+     * 同上，替换队列由primitive本帧渲染的瓦片沿replacementNext找到队尾，不需要访问QuadtreePrimitive的私有成员。
+     * 本帧没有渲染任何瓦片时无法定位队列，返回-1
+     */
+    int maximumTiles(const QuadtreePrimitive *primitive, quint64 frameNumber, int minimumTiles = 0)
+    {
+        const QuadtreeTileList rendered = primitive->tilesToRender();
+        if (rendered.isEmpty())
+        {
+            refresh();
+            m_lastMaximumTiles = -1;
+            return -1;
+        }
+
+        QuadtreeTile *tail = rendered.first();
+        while (tail->replacementNext())
+            tail = tail->replacementNext();
+
+        int count = 0;
+        for (QuadtreeTile *tile = tail; tile; tile = tile->replacementPrevious())
+            ++count;
+        return maximumTiles(tail, count, frameNumber, minimumTiles);
+    }
+
+    Debug debug() const
+    {
+        Debug d;
+        d.budgetBytes = m_budget;
+        d.cpuBytes = m_total.cpuBytes;
+        d.bufferBytes = m_total.bufferBytes;
+        d.textureBytes = m_total.textureBytes;
+        d.tilesTracked = m_tiles.size();
+        d.imageryTracked = m_imagery.size();
+        d.tilesPending = m_pending.size();
+        d.lastMaximumTiles = m_lastMaximumTiles;
+        d.lastBytesToFree = m_lastBytesToFree;
+        return d;
+    }
+
+    /**
+     * @brief
+     * 估算纹理占用的显存，包括mipmap
+     */
+    static qint64 textureBytes(const LiTexture *texture)
+    {
+        if (!texture)
+            return 0;
+
+        qint64 pixels = qint64(qMax(texture->width(), 1)) * qMax(texture->height(), 1)
+                * qMax(texture->depth(), 1) * qMax(texture->layers(), 1);
+        qint64 bytes = pixels * bitsPerPixel(texture->format()) / 8;
+        if (texture->generateMipMaps())
+            bytes = bytes * 4 / 3;
+        return bytes;
+    }
+
+    static TileMemoryUsage measureTerrain(GlobeSurfaceTile *surfaceTile)
+    {
+        TileMemoryUsage usage;
+        QSharedPointer<TerrainMesh> mesh = surfaceTile->terrainMesh();
+        if (mesh)
+        {
+            usage.cpuBytes += mesh->vertexData.size() + mesh->indexData.size();
+            // 未压平时loadedData与当前数据隐式共享，不重复统计
+            if (mesh->loadedData.vertexData.constData() != mesh->vertexData.constData())
+                usage.cpuBytes += mesh->loadedData.vertexData.size();
+            if (mesh->loadedData.indexData.constData() != mesh->indexData.constData())
+                usage.cpuBytes += mesh->loadedData.indexData.size();
+            for (const TerrainMesh::FlattenMaskDataPtr &maskData : mesh->maskDataHash)
+            {
+                if (maskData)
+                    usage.cpuBytes += maskData->insideVertices.size() * qint64(sizeof(int));
+            }
+
+            if (mesh->vertexBuffer)
+                usage.bufferBytes += mesh->vertexBuffer->size();
+            if (mesh->indexBuffer)
+                usage.bufferBytes += mesh->indexBuffer->size();
+        }
+
+        // 全水面瓦片共用同一个纹理，这里按瓦片各自的纹理统计
+        usage.textureBytes += textureBytes(surfaceTile->waterMaskTexture().data());
+        return usage;
+    }
+
+    static TileMemoryUsage measureImagery(Imagery *imagery)
+    {
+        TileMemoryUsage usage;
+        const QImage image = imagery->image();
+        usage.cpuBytes += qint64(image.bytesPerLine()) * image.height();
+        usage.textureBytes += textureBytes(imagery->texture());
+        if (imagery->textureWebMercator() != imagery->texture())
+            usage.textureBytes += textureBytes(imagery->textureWebMercator());
+        return usage;
+    }
+
+private:
+    /**
+     * @brief
+     * 从队尾tail开始计算，count为队列中的瓦片数量
+     */
+    int maximumTiles(QuadtreeTile *tail, int count, quint64 frameNumber, int minimumTiles)
+    {
+        refresh();
+
+        qint64 bytesToFree = m_total.total() - m_budget;
+        m_lastBytesToFree = qMax<qint64>(bytesToFree, 0);
+
+        int evicted = 0;
+        QuadtreeTile *tile = tail;
+        while (tile && bytesToFree > 0 && count - evicted > minimumTiles)
+        {
+            if (tile->frameRendered() >= frameNumber)
+                break;
+
+            if (tile->eligibleForUnloading())
+            {
+                bytesToFree -= tileBytes(tile);
+                ++evicted;
+            }
+            tile = tile->replacementPrevious();
+        }
+
+        m_lastMaximumTiles = count - evicted;
+        return m_lastMaximumTiles;
+    }
+
+    struct Entry
+    {
+        TileMemoryUsage own;
+        QVector<Imagery *> imagery;
+    };
+
+    struct ImageryEntry
+    {
+        QPointer<Imagery> imagery;  ///< 影像可能在瓦片重新统计之前被释放
+        Imagery::State state = Imagery::UNLOADED;
+        TileMemoryUsage usage;
+        int tiles = 0;
+    };
+
+    void measure(ImageryEntry *entry)
+    {
+        entry->state = entry->imagery->state();
+        entry->usage = measureImagery(entry->imagery);
+        m_total += entry->usage;
+    }
+
+    /**
+     * @brief
+     * 影像状态与上次统计时不同时重新统计
+     */
+    void remeasure(ImageryEntry *entry)
+    {
+        if (!entry->imagery || entry->imagery->state() == entry->state)
+            return;
+        m_total -= entry->usage;
+        measure(entry);
+    }
+
+    static int bitsPerPixel(LiTexture::TextureFormat format)
+    {
+        switch (format)
+        {
+        case LiTexture::RGB_DXT1:
+        case LiTexture::RGBA_DXT1:
+        case LiTexture::SRGB_DXT1:
+        case LiTexture::SRGB_Alpha_DXT1:
+        case LiTexture::R_ATI1N_UNorm:
+        case LiTexture::R_ATI1N_SNorm:
+        case LiTexture::R11_EAC_UNorm:
+        case LiTexture::R11_EAC_SNorm:
+        case LiTexture::RGB8_ETC2:
+        case LiTexture::SRGB8_ETC2:
+        case LiTexture::RGB8_PunchThrough_Alpha1_ETC2:
+        case LiTexture::SRGB8_PunchThrough_Alpha1_ETC2:
+        case LiTexture::RGB8_ETC1:
+            return 4;
+        case LiTexture::RGBA_DXT3:
+        case LiTexture::RGBA_DXT5:
+        case LiTexture::SRGB_Alpha_DXT3:
+        case LiTexture::SRGB_Alpha_DXT5:
+        case LiTexture::RG_ATI2N_UNorm:
+        case LiTexture::RG_ATI2N_SNorm:
+        case LiTexture::RG11_EAC_UNorm:
+        case LiTexture::RG11_EAC_SNorm:
+        case LiTexture::RGBA8_ETC2_EAC:
+        case LiTexture::SRGB8_Alpha8_ETC2_EAC:
+        case LiTexture::RGB_BP_UNSIGNED_FLOAT:
+        case LiTexture::RGB_BP_SIGNED_FLOAT:
+        case LiTexture::RGB_BP_UNorm:
+        case LiTexture::SRGB_BP_UNorm:
+        case LiTexture::R8_UNorm:
+        case LiTexture::R8_SNorm:
+        case LiTexture::R8U:
+        case LiTexture::R8I:
+        case LiTexture::RG3B2:
+        case LiTexture::AlphaFormat:
+        case LiTexture::LuminanceFormat:
+            return 8;
+        case LiTexture::RG8_UNorm:
+        case LiTexture::RG8_SNorm:
+        case LiTexture::RG8U:
+        case LiTexture::RG8I:
+        case LiTexture::R16_UNorm:
+        case LiTexture::R16_SNorm:
+        case LiTexture::R16U:
+        case LiTexture::R16I:
+        case LiTexture::R16F:
+        case LiTexture::R5G6B5:
+        case LiTexture::RGB5A1:
+        case LiTexture::RGBA4:
+        case LiTexture::D16:
+        case LiTexture::LuminanceAlphaFormat:
+            return 16;
+        case LiTexture::RGB8_UNorm:
+        case LiTexture::RGB8_SNorm:
+        case LiTexture::RGB8U:
+        case LiTexture::RGB8I:
+        case LiTexture::SRGB8:
+        case LiTexture::D24:
+        case LiTexture::RGBFormat:
+            return 24;
+        case LiTexture::RGB16_UNorm:
+        case LiTexture::RGB16_SNorm:
+        case LiTexture::RGB16U:
+        case LiTexture::RGB16I:
+        case LiTexture::RGB16F:
+            return 48;
+        case LiTexture::RG32U:
+        case LiTexture::RG32I:
+        case LiTexture::RG32F:
+        case LiTexture::RGBA16_UNorm:
+        case LiTexture::RGBA16_SNorm:
+        case LiTexture::RGBA16U:
+        case LiTexture::RGBA16I:
+        case LiTexture::RGBA16F:
+        case LiTexture::D32FS8X24:
+            return 64;
+        case LiTexture::RGB32U:
+        case LiTexture::RGB32I:
+        case LiTexture::RGB32F:
+            return 96;
+        case LiTexture::RGBA32U:
+        case LiTexture::RGBA32I:
+        case LiTexture::RGBA32F:
+            return 128;
+        default:
+            return 32;
+        }
+    }
+
+    qint64 m_budget;
+    TileMemoryUsage m_total;
+    QHash<QuadtreeTile *, Entry> m_tiles;
+    QHash<Imagery *, ImageryEntry> m_imagery;
+    QSet<QuadtreeTile *> m_pending;
+    int m_lastMaximumTiles;
+    qint64 m_lastBytesToFree;
+    QVector<QMetaObject::Connection> m_connections;
+};
+
+#endif // TILEMEMORYBUDGET_H
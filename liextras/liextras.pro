@@ -59,7 +59,9 @@ HEADERS += \
     lipluginimageryprovider.h \
     liproviderinterface.h \
     qgsmapprojection.h \
-    pmtscapabilities.h
+    pmtscapabilities.h \
+    litilecache.h \
+    litilesetindex.h
 
 SOURCES += \
     arcgistilingscheme.cpp \
@@ -73,7 +75,9 @@ SOURCES += \
     liprovidermanager.cpp \
     lipluginimageryprovider.cpp \
     qgsmapprojection.cpp \
-    pmtscapabilities.cpp
+    pmtscapabilities.cpp \
+    litilecache.cpp \
+    litilesetindex.cpp
 
 RESOURCES += \
     extras.qrc
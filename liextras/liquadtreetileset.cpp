@@ -6,7 +6,9 @@
 #include "ellipsoid.h"
 #include "transforms.h"
 #include "liutils.h"
+#include "litilesetindex.h"
 #include <qgscoordinatereferencesystem.h>
+#include <QFileInfo>
 
 LiQuadtreeTileset::LiQuadtreeTileset(const QString &url,
                                      Qt::Axis upAxis,
@@ -35,9 +37,16 @@ LiQuadtreeTileset::LiQuadtreeTileset(const QString &url,
 
 Future LiQuadtreeTileset::load(const QUrl &url)
 {
-    auto promise = LiFileSystem::readFile(url);
-    if (promise.isCanceled())
-        return Future();
+    QString path = urlToLocalFileOrQrc(url);
+    bool localFile = !path.isEmpty() && !path.startsWith(QLatin1Char(':')) && QFileInfo(path).exists();
+
+    BufferPromise promise;
+    if (!localFile)
+    {
+        promise = LiFileSystem::readFile(url);
+        if (promise.isCanceled())
+            return Future();
+    }
 
     // asset
     {
@@ -58,6 +67,24 @@ Future LiQuadtreeTileset::load(const QUrl &url)
         m_rootJson["refine"] = "REPLACE";
     }
 
+    // 本地文件优先使用二进制索引，源文件没有变化时不再解析XML
+    if (localFile)
+    {
+        m_indexPath = LiTilesetIndex::indexPath(path);
+        QJsonObject root = LiTilesetIndex::read(m_indexPath, m_geometricError);
+        if (!root.isEmpty())
+        {
+            m_json["root"] = root;
+            m_readyPromise.complete();
+            return m_readyPromise.future();
+        }
+
+        m_sources.append(path);
+        promise = LiFileSystem::readFile(url);
+        if (promise.isCanceled())
+            return Future();
+    }
+
     observe(promise).subscribe([=](QByteArray buffer) {
         QDomDocument doc;
         QDomElement e;
@@ -114,18 +141,12 @@ Future LiQuadtreeTileset::load(const QUrl &url)
                 }
 
                 observe(combined.future()).subscribe([=]() {
-                    m_rootJson["children"] = m_childrenJson;
-                    m_rootJson["boundingVolume"] = createBoundingVolume(m_boundingSphere);
-                    m_json["root"] = m_rootJson;
-                    m_readyPromise.complete();
+                    finishLoad();
                 });
             }
             else
             {
-                m_rootJson["children"] = m_childrenJson;
-                m_rootJson["boundingVolume"] = createBoundingVolume(m_boundingSphere);
-                m_json["root"] = m_rootJson;
-                m_readyPromise.complete();
+                finishLoad();
             }
         }
         else
@@ -137,8 +158,27 @@ Future LiQuadtreeTileset::load(const QUrl &url)
     return m_readyPromise.future();
 }
 
+void LiQuadtreeTileset::finishLoad()
+{
+    m_rootJson["children"] = m_childrenJson;
+    m_rootJson["boundingVolume"] = createBoundingVolume(m_boundingSphere);
+    m_json["root"] = m_rootJson;
+
+    if (!m_indexPath.isEmpty())
+        LiTilesetIndex::write(m_indexPath, m_rootJson, m_sources, m_geometricError);
+
+    m_readyPromise.complete();
+}
+
 QFuture<QVariant> LiQuadtreeTileset::loadNode(const QUrl &url)
 {
+    // 读取失败的Tile文件同样记录下来，之后文件出现时索引失效
+    QString path = urlToLocalFileOrQrc(url);
+    if (!path.isEmpty() && !path.startsWith(QLatin1Char(':')))
+        m_sources.append(path);
+    else
+        m_indexPath.clear();
+
     auto promise = LiFileSystem::readFile(url);
     if (promise.isCanceled())
         return QFuture<QVariant>();
@@ -23,6 +23,7 @@ public:
     QJsonObject json() const { return m_json; }
 
 private:
+    void finishLoad();
     QFuture<QVariant> loadNode(const QUrl &url);
     QJsonObject createNodeJson(const QDomElement &element, const QUrl &baseUrl, int level, const Matrix4 &parentTransform);
     QJsonObject createBoundingVolume(const BoundingSphere &sphere);
@@ -37,6 +38,8 @@ private:
     Deferred<void> m_readyPromise;
     Matrix4 m_rootTransform;
     Matrix4 m_rootInverseTransform;
+    QString m_indexPath;
+    QStringList m_sources;
 };
 
 #endif // LIQUADTREETILESET_H
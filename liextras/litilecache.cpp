@@ -0,0 +1,693 @@
+#include "litilecache.h"
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QFileInfo>
+#include <QNetworkRequest>
+
+static const quint32 kIndexMagic = 0x4c495443; // "LITC"
+static const quint32 kIndexVersion = 1;
+static const quint32 kInitialCapacity = 4096;
+
+LiTileCache::LiTileCache(QObject *parent)
+    : QAbstractNetworkCache(parent)
+{
+}
+
+LiTileCache::~LiTileCache()
+{
+    QMutexLocker locker(&m_mutex);
+    qDeleteAll(m_inserting.keys());
+    m_inserting.clear();
+    close();
+}
+
+void LiTileCache::setCacheDirectory(const QString &cacheDir)
+{
+    QMutexLocker locker(&m_mutex);
+    close();
+    m_cacheDirectory = cacheDir;
+    if (!m_cacheDirectory.isEmpty() && !m_cacheDirectory.endsWith(QLatin1Char('/')))
+        m_cacheDirectory += QLatin1Char('/');
+}
+
+void LiTileCache::setMaximumCacheSize(qint64 size)
+{
+    QMutexLocker locker(&m_mutex);
+    m_maximumCacheSize = size;
+    m_maximumPackSize = qBound(1ll * 1024 * 1024, size / 16, 64ll * 1024 * 1024);
+    if (m_index)
+        evict();
+}
+
+LiTileCache::Statistics LiTileCache::statistics() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_statistics;
+}
+
+void LiTileCache::clearStatistics()
+{
+    QMutexLocker locker(&m_mutex);
+    m_statistics = Statistics();
+}
+
+/**
+ * @brief
+ * 缓存键由服务器（host:port）与完整url组成，与RequestScheduler::getServerKey的分组方式一致，
+ * 去掉了url的fragment部分。
+ */
+QString LiTileCache::cacheKey(const QUrl &url)
+{
+    QString serverKey = url.authority(QUrl::FullyEncoded).toLower();
+    if (url.port() == -1)
+        serverKey += url.scheme() == QLatin1String("https") ? QStringLiteral(":443") : QStringLiteral(":80");
+
+    return serverKey + QLatin1Char('|') + url.toString(QUrl::RemoveFragment | QUrl::FullyEncoded);
+}
+
+static quint64 hashKey(const QUrl &url)
+{
+    QByteArray digest = QCryptographicHash::hash(LiTileCache::cacheKey(url).toUtf8(), QCryptographicHash::Sha1);
+    quint64 key = 0;
+    memcpy(&key, digest.constData(), sizeof(key));
+    return key ? key : 1;
+}
+
+QNetworkCacheMetaData LiTileCache::metaData(const QUrl &url)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!open())
+        return QNetworkCacheMetaData();
+
+    int slot = findSlot(hashKey(url));
+    if (slot < 0)
+    {
+        ++m_statistics.numberOfMisses;
+        return QNetworkCacheMetaData();
+    }
+
+    QNetworkCacheMetaData md;
+    if (!readRecord(entry(slot), &md, nullptr) || md.url() != url)
+    {
+        ++m_statistics.numberOfMisses;
+        return QNetworkCacheMetaData();
+    }
+
+    return md;
+}
+
+void LiTileCache::updateMetaData(const QNetworkCacheMetaData &metaData)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!open())
+        return;
+
+    int slot = findSlot(hashKey(metaData.url()));
+    if (slot < 0)
+        return;
+
+    IndexEntry *e = entry(slot);
+    QNetworkCacheMetaData md;
+    if (!readRecord(e, &md, nullptr) || md.url() != metaData.url())
+        return;
+
+    QByteArray meta;
+    {
+        QDataStream stream(&meta, QIODevice::WriteOnly);
+        stream << pinned(metaData);
+    }
+
+    // 新的元数据不超过原来的大小时原地覆盖，剩余部分补零，不重写瓦片数据
+    if (meta.size() <= int(e->metaSize))
+    {
+        QFile *file = packFile(e->pack);
+        meta.append(QByteArray(int(e->metaSize) - meta.size(), '\0'));
+        if (file && file->seek(e->offset) && file->write(meta) == meta.size())
+            file->flush();
+        return;
+    }
+
+    QByteArray payload;
+    if (readRecord(e, nullptr, &payload))
+        writeRecord(pinned(metaData), payload);
+}
+
+QIODevice *LiTileCache::data(const QUrl &url)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!open())
+        return nullptr;
+
+    int slot = findSlot(hashKey(url));
+    if (slot < 0)
+    {
+        ++m_statistics.numberOfMisses;
+        return nullptr;
+    }
+
+    IndexEntry *e = entry(slot);
+    QNetworkCacheMetaData md;
+    QByteArray payload;
+    if (!readRecord(e, &md, &payload))
+    {
+        removeSlot(slot);
+        ++m_statistics.numberOfMisses;
+        return nullptr;
+    }
+
+    // 键是url的64位散列，发生碰撞时不能返回其他瓦片的数据
+    if (md.url() != url)
+    {
+        ++m_statistics.numberOfMisses;
+        return nullptr;
+    }
+
+    IndexHeader *header = reinterpret_cast<IndexHeader *>(m_index);
+    e->lastAccess = ++header->clock;
+
+    ++m_statistics.numberOfHits;
+    m_statistics.bytesRead += payload.size();
+
+    QBuffer *buffer = new QBuffer;
+    buffer->setData(payload);
+    buffer->open(QBuffer::ReadOnly);
+    return buffer;
+}
+
+bool LiTileCache::remove(const QUrl &url)
+{
+    QMutexLocker locker(&m_mutex);
+
+    for (auto it = m_inserting.begin(); it != m_inserting.end();)
+    {
+        if (it.value().url() == url)
+        {
+            delete it.key();
+            it = m_inserting.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    if (!open())
+        return false;
+
+    int slot = findSlot(hashKey(url));
+    if (slot < 0)
+        return false;
+
+    removeSlot(slot);
+    return true;
+}
+
+qint64 LiTileCache::cacheSize() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_currentCacheSize;
+}
+
+QIODevice *LiTileCache::prepare(const QNetworkCacheMetaData &metaData)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!metaData.isValid() || !metaData.url().isValid() || !open())
+        return nullptr;
+
+    // 只缓存成功返回的数据，忽略服务器返回的no-store等缓存控制
+    QVariant status = metaData.attributes().value(QNetworkRequest::HttpStatusCodeAttribute);
+    if (status.isValid() && status.toInt() != 200)
+        return nullptr;
+
+    QBuffer *buffer = new QBuffer;
+    buffer->open(QBuffer::ReadWrite);
+    m_inserting.insert(buffer, metaData);
+    return buffer;
+}
+
+void LiTileCache::insert(QIODevice *device)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_inserting.contains(device))
+        return;
+
+    QNetworkCacheMetaData md = m_inserting.take(device);
+    QBuffer *buffer = qobject_cast<QBuffer *>(device);
+    if (buffer && open())
+    {
+        if (writeRecord(pinned(md), buffer->data()))
+            ++m_statistics.numberOfInsertions;
+    }
+
+    delete device;
+}
+
+void LiTileCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    close();
+
+    if (m_cacheDirectory.isEmpty())
+        return;
+
+    QDir dir(m_cacheDirectory);
+    const auto files = dir.entryList(QStringList() << QStringLiteral("index.bin") << QStringLiteral("pack_*.dat"), QDir::Files);
+    for (const QString &file : files)
+    {
+        dir.remove(file);
+    }
+}
+
+bool LiTileCache::open()
+{
+    if (m_index)
+        return true;
+
+    if (m_cacheDirectory.isEmpty())
+        return false;
+
+    QDir().mkpath(m_cacheDirectory);
+
+    m_indexFile.setFileName(m_cacheDirectory + QStringLiteral("index.bin"));
+    if (!m_indexFile.open(QFile::ReadWrite))
+        return false;
+
+    bool valid = false;
+    if (m_indexFile.size() >= qint64(sizeof(IndexHeader)))
+    {
+        IndexHeader header;
+        m_indexFile.read(reinterpret_cast<char *>(&header), sizeof(header));
+        valid = header.magic == kIndexMagic
+                && header.version == kIndexVersion
+                && m_indexFile.size() == qint64(sizeof(IndexHeader) + header.capacity * sizeof(IndexEntry));
+    }
+
+    if (!valid)
+    {
+        // 索引损坏或版本不匹配时，丢弃所有旧数据
+        QDir dir(m_cacheDirectory);
+        const auto packs = dir.entryList(QStringList() << QStringLiteral("pack_*.dat"), QDir::Files);
+        for (const QString &pack : packs)
+        {
+            dir.remove(pack);
+        }
+
+        IndexHeader header;
+        header.magic = kIndexMagic;
+        header.version = kIndexVersion;
+        header.capacity = kInitialCapacity;
+        header.packId = 0;
+        header.clock = 0;
+
+        m_indexFile.resize(0);
+        m_indexFile.resize(sizeof(IndexHeader) + kInitialCapacity * sizeof(IndexEntry));
+        m_indexFile.seek(0);
+        m_indexFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        m_indexFile.flush();
+    }
+
+    m_index = m_indexFile.map(0, m_indexFile.size());
+    if (!m_index)
+    {
+        m_indexFile.close();
+        return false;
+    }
+
+    m_slots.clear();
+    m_freeSlots.clear();
+    m_packLiveBytes.clear();
+    m_packBytes.clear();
+    m_currentCacheSize = 0;
+
+    const IndexHeader *header = reinterpret_cast<IndexHeader *>(m_index);
+    for (int i = int(header->capacity) - 1; i >= 0; --i)
+    {
+        const IndexEntry *e = entry(i);
+        if (e->key == 0)
+        {
+            m_freeSlots.append(i);
+            continue;
+        }
+
+        qint64 bytes = e->metaSize + e->size;
+        m_slots.insert(e->key, i);
+        m_packLiveBytes[e->pack] += bytes;
+        m_currentCacheSize += bytes;
+    }
+
+    // 删除没有被索引引用的pack文件
+    QDir dir(m_cacheDirectory);
+    const auto packs = dir.entryList(QStringList() << QStringLiteral("pack_*.dat"), QDir::Files);
+    for (const QString &pack : packs)
+    {
+        quint32 id = pack.mid(5, pack.length() - 9).toUInt();
+        if (id != header->packId && !m_packLiveBytes.contains(id))
+            dir.remove(pack);
+        else
+            m_packBytes[id] = QFileInfo(dir.filePath(pack)).size();
+    }
+
+    return true;
+}
+
+void LiTileCache::close()
+{
+    if (m_index)
+    {
+        m_indexFile.unmap(m_index);
+        m_index = nullptr;
+    }
+    m_indexFile.close();
+
+    qDeleteAll(m_packs);
+    m_packs.clear();
+    m_packLiveBytes.clear();
+    m_packBytes.clear();
+    m_slots.clear();
+    m_freeSlots.clear();
+    m_currentCacheSize = 0;
+}
+
+bool LiTileCache::growIndex()
+{
+    IndexHeader header = *reinterpret_cast<IndexHeader *>(m_index);
+    quint32 capacity = header.capacity * 2;
+
+    m_indexFile.unmap(m_index);
+    m_index = nullptr;
+    if (!m_indexFile.resize(sizeof(IndexHeader) + capacity * sizeof(IndexEntry)))
+    {
+        m_index = m_indexFile.map(0, m_indexFile.size());
+        return false;
+    }
+
+    m_index = m_indexFile.map(0, m_indexFile.size());
+    if (!m_index)
+    {
+        close();
+        return false;
+    }
+
+    reinterpret_cast<IndexHeader *>(m_index)->capacity = capacity;
+    for (int i = int(capacity) - 1; i >= int(header.capacity); --i)
+    {
+        m_freeSlots.append(i);
+    }
+
+    return true;
+}
+
+LiTileCache::IndexEntry *LiTileCache::entry(int slot) const
+{
+    return reinterpret_cast<IndexEntry *>(m_index + sizeof(IndexHeader)) + slot;
+}
+
+int LiTileCache::findSlot(quint64 key) const
+{
+    return m_slots.value(key, -1);
+}
+
+bool LiTileCache::readRecord(const IndexEntry *e, QNetworkCacheMetaData *metaData, QByteArray *payload)
+{
+    QFile *file = packFile(e->pack);
+    if (!file || file->size() < e->offset + e->metaSize + e->size)
+        return false;
+
+    if (metaData)
+    {
+        if (!file->seek(e->offset))
+            return false;
+
+        QByteArray bytes = file->read(e->metaSize);
+        if (bytes.size() != int(e->metaSize))
+            return false;
+
+        QDataStream stream(bytes);
+        stream >> *metaData;
+    }
+
+    if (payload)
+    {
+        if (!file->seek(e->offset + e->metaSize))
+            return false;
+
+        *payload = file->read(e->size);
+        if (payload->size() != e->size)
+            return false;
+    }
+
+    return true;
+}
+
+bool LiTileCache::writeRecord(const QNetworkCacheMetaData &metaData, const QByteArray &payload)
+{
+    QByteArray meta;
+    {
+        QDataStream stream(&meta, QIODevice::WriteOnly);
+        stream << metaData;
+    }
+
+    quint32 pack;
+    qint64 offset;
+    if (!appendRecord(meta, payload, &pack, &offset))
+        return false;
+
+    // 先写数据再写索引，中途退出时索引不会指向不完整的记录
+    // 先扩充索引再删除旧记录，扩充失败时旧记录仍然有效
+    quint64 key = hashKey(metaData.url());
+    int slot = findSlot(key);
+    if (slot < 0 && m_freeSlots.isEmpty() && !growIndex())
+        return false;
+    if (slot >= 0)
+        removeSlot(slot);
+
+    IndexHeader *header = reinterpret_cast<IndexHeader *>(m_index);
+    slot = m_freeSlots.takeLast();
+
+    IndexEntry *e = entry(slot);
+    e->pack = pack;
+    e->metaSize = meta.size();
+    e->offset = offset;
+    e->size = payload.size();
+    e->lastAccess = ++header->clock;
+    e->key = key;
+
+    qint64 bytes = e->metaSize + e->size;
+    m_slots.insert(key, slot);
+    m_packLiveBytes[e->pack] += bytes;
+    m_currentCacheSize += bytes;
+    m_statistics.bytesWritten += bytes;
+
+    evict();
+    return true;
+}
+
+/**
+ * @brief
+ * 把一条记录追加到当前pack文件的末尾，当前pack超出大小时切换到新的pack
+ */
+bool LiTileCache::appendRecord(const QByteArray &meta, const QByteArray &payload, quint32 *pack, qint64 *offset)
+{
+    IndexHeader *header = reinterpret_cast<IndexHeader *>(m_index);
+    QFile *file = packFile(header->packId);
+    if (file && file->size() > 0 && file->size() + meta.size() + payload.size() > m_maximumPackSize)
+    {
+        ++header->packId;
+        file = packFile(header->packId);
+    }
+
+    if (!file)
+        return false;
+
+    *pack = header->packId;
+    *offset = file->size();
+    if (!file->seek(*offset)
+            || file->write(meta) != meta.size()
+            || file->write(payload) != payload.size()
+            || !file->flush())
+    {
+        file->resize(*offset);
+        return false;
+    }
+
+    m_packBytes[*pack] = file->size();
+    return true;
+}
+
+void LiTileCache::removeSlot(int slot)
+{
+    IndexEntry *e = entry(slot);
+    qint64 bytes = e->metaSize + e->size;
+
+    m_slots.remove(e->key);
+    m_packLiveBytes[e->pack] -= bytes;
+    m_currentCacheSize -= bytes;
+    m_freeSlots.append(slot);
+
+    e->key = 0;
+}
+
+void LiTileCache::evict()
+{
+    if (m_currentCacheSize > m_maximumCacheSize)
+        evictLeastRecentlyUsed();
+    compact();
+}
+
+void LiTileCache::evictLeastRecentlyUsed()
+{
+    // 一次淘汰到容量的90%，避免每次插入都排序
+    QVector<QPair<qint64, int>> entries;
+    entries.reserve(m_slots.size());
+    for (auto it = m_slots.constBegin(); it != m_slots.constEnd(); ++it)
+    {
+        entries.append(qMakePair(entry(it.value())->lastAccess, it.value()));
+    }
+    std::sort(entries.begin(), entries.end());
+
+    qint64 goal = m_maximumCacheSize * 9 / 10;
+    for (const auto &it : entries)
+    {
+        if (m_currentCacheSize <= goal)
+            break;
+
+        removeSlot(it.second);
+        ++m_statistics.numberOfEvictions;
+    }
+}
+
+/**
+ * @brief
+ * 淘汰只从索引中删除记录，pack文件中的数据仍然占用磁盘。
+ * 没有存活记录的pack直接删除，不需要读写数据。死数据超过磁盘占用的1/CompactStartRatio时，
+ * 按死数据从多到少把pack的存活记录搬到当前pack后删除，直到死数据不超过1/CompactStopRatio。
+ * 两个阈值之间的间隔保证搬移的数据量与写入的数据量成正比，而不是接近容量时每次插入都重写pack。
+ */
+void LiTileCache::compact()
+{
+    const quint32 currentPack = reinterpret_cast<IndexHeader *>(m_index)->packId;
+
+    qint64 diskBytes = 0;
+    qint64 deadBytes = 0;
+    QVector<QPair<qint64, quint32>> candidates;
+    for (auto it = m_packBytes.constBegin(); it != m_packBytes.constEnd(); ++it)
+    {
+        diskBytes += it.value();
+        if (it.key() == currentPack)
+            continue;
+
+        qint64 live = m_packLiveBytes.value(it.key(), 0);
+        qint64 dead = it.value() - live;
+        deadBytes += dead;
+        if (live <= 0 || dead > 0)
+            candidates.append(qMakePair(-dead, it.key()));
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    const bool rewrite = deadBytes * CompactStartRatio > diskBytes;
+    for (const auto &candidate : candidates)
+    {
+        const quint32 pack = candidate.second;
+        const qint64 size = m_packBytes.value(pack, 0);
+        const qint64 live = m_packLiveBytes.value(pack, 0);
+        if (live > 0 && (!rewrite || deadBytes * CompactStopRatio <= diskBytes))
+            continue;
+
+        if (live > 0 && !compactPack(pack))
+            continue;
+
+        diskBytes -= size - live;
+        deadBytes -= size - live;
+        delete m_packs.take(pack);
+        QFile::remove(packFileName(pack));
+        m_packLiveBytes.remove(pack);
+        m_packBytes.remove(pack);
+    }
+}
+
+bool LiTileCache::compactPack(quint32 pack)
+{
+    QVector<int> slots;
+    for (auto it = m_slots.constBegin(); it != m_slots.constEnd(); ++it)
+    {
+        if (entry(it.value())->pack == pack)
+            slots.append(it.value());
+    }
+
+    for (int slot : slots)
+    {
+        IndexEntry *e = entry(slot);
+        QFile *file = packFile(pack);
+        if (!file || !file->seek(e->offset))
+            return false;
+
+        QByteArray record = file->read(e->metaSize + e->size);
+        if (record.size() != e->metaSize + e->size)
+        {
+            removeSlot(slot);
+            continue;
+        }
+
+        quint32 newPack;
+        qint64 newOffset;
+        if (!appendRecord(record.left(e->metaSize), record.mid(e->metaSize), &newPack, &newOffset))
+            return false;
+
+        const qint64 bytes = e->metaSize + e->size;
+        m_packLiveBytes[pack] -= bytes;
+        m_packLiveBytes[newPack] += bytes;
+        e->pack = newPack;
+        e->offset = newOffset;
+    }
+
+    return true;
+}
+
+QFile *LiTileCache::packFile(quint32 pack)
+{
+    QFile *file = m_packs.value(pack, nullptr);
+    if (file)
+        return file;
+
+    file = new QFile(packFileName(pack));
+    if (!file->open(QFile::ReadWrite))
+    {
+        delete file;
+        return nullptr;
+    }
+
+    m_packs.insert(pack, file);
+    return file;
+}
+
+QString LiTileCache::packFileName(quint32 pack) const
+{
+    return m_cacheDirectory + QStringLiteral("pack_%1.dat").arg(pack, 6, 10, QLatin1Char('0'));
+}
+
+/**
+ * @brief
+ * 固定缓存数据的有效期，去掉会导致重新验证的HTTP头，
+ * 使QNetworkAccessManager直接使用缓存而不发出网络请求。
+ */
+QNetworkCacheMetaData LiTileCache::pinned(const QNetworkCacheMetaData &metaData) const
+{
+    QNetworkCacheMetaData md = metaData;
+
+    QNetworkCacheMetaData::RawHeaderList headers;
+    const auto rawHeaders = md.rawHeaders();
+    for (const auto &header : rawHeaders)
+    {
+        QByteArray name = header.first.toLower();
+        if (name == "cache-control" || name == "pragma" || name == "expires" || name == "age")
+            continue;
+        headers.append(header);
+    }
+
+    md.setRawHeaders(headers);
+    md.setExpirationDate(QDateTime::currentDateTimeUtc().addSecs(m_maximumAge));
+    md.setSaveToDisk(true);
+
+    return md;
+}
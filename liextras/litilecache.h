@@ -0,0 +1,120 @@
+#ifndef LITILECACHE_H
+#define LITILECACHE_H
+
+#include "liextrasglobal.h"
+#include <QAbstractNetworkCache>
+#include <QNetworkCacheMetaData>
+
+/**
+ * @brief
+ * 瓦片缓存，替代LiNetworkAccessManager默认的QNetworkDiskCache。
+ * 不依赖HTTP缓存头，所有成功返回的瓦片都会被缓存，下次请求时直接从本地读取。
+ * 数据以追加方式写入pack文件，索引文件使用内存映射，超出容量时按LRU淘汰。
+ * 使用方法：
+ *     LiTileCache *cache = new LiTileCache();
+ *     cache->setCacheDirectory(dir);
+ *     LiNetworkAccessManager::instance()->setCache(cache);
+ */
+class LIEXTRAS_EXPORT LiTileCache : public QAbstractNetworkCache
+{
+    Q_OBJECT
+public:
+    struct Statistics
+    {
+        quint64 numberOfHits = 0;
+        quint64 numberOfMisses = 0;
+        quint64 numberOfInsertions = 0;
+        quint64 numberOfEvictions = 0;
+        quint64 bytesRead = 0;
+        quint64 bytesWritten = 0;
+    };
+
+    explicit LiTileCache(QObject *parent = nullptr);
+    ~LiTileCache();
+
+    QString cacheDirectory() const { return m_cacheDirectory; }
+    void setCacheDirectory(const QString &cacheDir);
+
+    qint64 maximumCacheSize() const { return m_maximumCacheSize; } // default = 1024*1024*1024 (1 GB)
+    void setMaximumCacheSize(qint64 size);
+
+    int maximumAge() const { return m_maximumAge; } // seconds, default = 30 days
+    void setMaximumAge(int seconds) { m_maximumAge = seconds; }
+
+    Statistics statistics() const;
+    void clearStatistics();
+
+    static QString cacheKey(const QUrl &url);
+
+    QNetworkCacheMetaData metaData(const QUrl &url) override;
+    void updateMetaData(const QNetworkCacheMetaData &metaData) override;
+    QIODevice *data(const QUrl &url) override;
+    bool remove(const QUrl &url) override;
+    qint64 cacheSize() const override;
+    QIODevice *prepare(const QNetworkCacheMetaData &metaData) override;
+    void insert(QIODevice *device) override;
+
+public slots:
+    void clear() override;
+
+private:
+    enum
+    {
+        CompactStartRatio = 4,  ///< 死数据超过磁盘占用的1/4时开始重写pack
+        CompactStopRatio = 8    ///< 重写到死数据不超过磁盘占用的1/8
+    };
+
+    struct IndexHeader
+    {
+        quint32 magic;
+        quint32 version;
+        quint32 capacity;
+        quint32 packId;
+        qint64 clock;
+    };
+
+    struct IndexEntry
+    {
+        quint64 key;
+        quint32 pack;
+        quint32 metaSize;
+        qint64 offset;
+        qint64 size;
+        qint64 lastAccess;
+    };
+
+    bool open();
+    void close();
+    bool growIndex();
+    IndexEntry *entry(int slot) const;
+    int findSlot(quint64 key) const;
+    bool readRecord(const IndexEntry *e, QNetworkCacheMetaData *metaData, QByteArray *payload);
+    bool writeRecord(const QNetworkCacheMetaData &metaData, const QByteArray &payload);
+    bool appendRecord(const QByteArray &meta, const QByteArray &payload, quint32 *pack, qint64 *offset);
+    void removeSlot(int slot);
+    void evict();
+    void evictLeastRecentlyUsed();
+    void compact();
+    bool compactPack(quint32 pack);
+    QFile *packFile(quint32 pack);
+    QString packFileName(quint32 pack) const;
+    QNetworkCacheMetaData pinned(const QNetworkCacheMetaData &metaData) const;
+
+    mutable QMutex m_mutex;
+    QString m_cacheDirectory;
+    qint64 m_maximumCacheSize = 1024ll * 1024 * 1024;
+    qint64 m_maximumPackSize = 64ll * 1024 * 1024;
+    int m_maximumAge = 30 * 24 * 3600;
+    qint64 m_currentCacheSize = 0;
+    QFile m_indexFile;
+    uchar *m_index = nullptr;
+    QHash<quint64, int> m_slots;
+    QVector<int> m_freeSlots;
+    QHash<quint32, QFile *> m_packs;
+    QHash<quint32, qint64> m_packLiveBytes;
+    QHash<quint32, qint64> m_packBytes;
+    QHash<QIODevice *, QNetworkCacheMetaData> m_inserting;
+    Statistics m_statistics;
+};
+
+#endif // LITILECACHE_H
@@ -0,0 +1,281 @@
+#include "litilesetindex.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+static const quint32 kIndexMagic = 0x5849544c; // "LTIX"
+static const quint32 kIndexVersion = 1;
+
+namespace {
+
+struct IndexHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 nodeCount;
+    quint32 sourceCount;
+    quint64 stringBytes;
+    double parameter;
+};
+
+struct IndexSource
+{
+    qint64 lastModified;
+    qint64 size;
+    quint32 path;
+    quint32 pathLength;
+};
+
+enum NodeFlag
+{
+    HasTransform = 0x01,
+    HasContent = 0x02,
+    RefineAdd = 0x04,
+    HasRefine = 0x08
+};
+
+struct IndexNode
+{
+    double transform[16];
+    double sphere[4];
+    double geometricError;
+    qint32 firstChild;
+    qint32 childCount;
+    quint32 content;
+    quint32 contentLength;
+    quint32 flags;
+    quint32 reserved;
+};
+
+}
+
+QString LiTilesetIndex::indexPath(const QString &sourcePath)
+{
+    QString path = QFileInfo(sourcePath).absoluteFilePath();
+    QByteArray digest = QCryptographicHash::hash(path.toUtf8(), QCryptographicHash::Sha1).toHex();
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/tilesetindex/");
+    return dir + QString::fromLatin1(digest) + QStringLiteral(".idx");
+}
+
+QJsonObject LiTilesetIndex::read(const QString &indexPath, double parameter)
+{
+    QFile file(indexPath);
+    if (!file.open(QFile::ReadOnly))
+        return QJsonObject();
+
+    const qint64 fileSize = file.size();
+    if (fileSize < qint64(sizeof(IndexHeader)))
+        return QJsonObject();
+
+    const uchar *data = file.map(0, fileSize);
+    if (!data)
+        return QJsonObject();
+
+    const IndexHeader *header = reinterpret_cast<const IndexHeader *>(data);
+    const qint64 expected = qint64(sizeof(IndexHeader))
+            + qint64(header->sourceCount) * sizeof(IndexSource)
+            + qint64(header->nodeCount) * sizeof(IndexNode)
+            + qint64(header->stringBytes);
+    if (header->magic != kIndexMagic || header->version != kIndexVersion
+            || header->parameter != parameter || header->nodeCount == 0 || expected != fileSize)
+    {
+        file.unmap(const_cast<uchar *>(data));
+        return QJsonObject();
+    }
+
+    const IndexSource *sources = reinterpret_cast<const IndexSource *>(data + sizeof(IndexHeader));
+    const IndexNode *nodes = reinterpret_cast<const IndexNode *>(sources + header->sourceCount);
+    const char *strings = reinterpret_cast<const char *>(nodes + header->nodeCount);
+
+    auto string = [&](quint32 offset, quint32 length) {
+        if (quint64(offset) + length > header->stringBytes)
+            return QString();
+        return QString::fromUtf8(strings + offset, int(length));
+    };
+
+    // 任何源文件变化都使索引失效，生成索引时不存在的文件（size为-1）出现时同样失效
+    for (quint32 i = 0; i < header->sourceCount; ++i)
+    {
+        QFileInfo info(string(sources[i].path, sources[i].pathLength));
+        bool changed;
+        if (sources[i].size < 0)
+            changed = info.exists();
+        else
+            changed = !info.exists() || info.size() != sources[i].size
+                    || info.lastModified().toMSecsSinceEpoch() != sources[i].lastModified;
+        if (changed)
+        {
+            file.unmap(const_cast<uchar *>(data));
+            return QJsonObject();
+        }
+    }
+
+    // 子节点的id总是大于父节点，从后向前组装json
+    const int count = int(header->nodeCount);
+    QVector<QJsonObject> objects(count);
+    for (int id = count - 1; id >= 0; --id)
+    {
+        const IndexNode &node = nodes[id];
+        QJsonObject &json = objects[id];
+
+        json["geometricError"] = node.geometricError;
+        if (node.flags & HasRefine)
+            json["refine"] = (node.flags & RefineAdd) ? QStringLiteral("ADD") : QStringLiteral("REPLACE");
+
+        if (node.flags & HasTransform)
+        {
+            QJsonArray transform;
+            for (double v : node.transform)
+            {
+                transform.append(v);
+            }
+            json["transform"] = transform;
+        }
+
+        QJsonArray sphere;
+        for (double v : node.sphere)
+        {
+            sphere.append(v);
+        }
+        QJsonObject boundingVolume;
+        boundingVolume["sphere"] = sphere;
+        json["boundingVolume"] = boundingVolume;
+
+        if (node.flags & HasContent)
+        {
+            QJsonObject content;
+            content["url"] = string(node.content, node.contentLength);
+            json["content"] = content;
+        }
+
+        if (node.childCount > 0 && node.firstChild > id && node.firstChild + node.childCount <= count)
+        {
+            QJsonArray children;
+            for (int c = 0; c < node.childCount; ++c)
+            {
+                children.append(objects[node.firstChild + c]);
+                objects[node.firstChild + c] = QJsonObject();
+            }
+            json["children"] = children;
+        }
+    }
+
+    file.unmap(const_cast<uchar *>(data));
+    return objects[0];
+}
+
+bool LiTilesetIndex::write(const QString &indexPath, const QJsonObject &root,
+                           const QStringList &sources, double parameter)
+{
+    QByteArray strings;
+    auto appendString = [&](const QString &str, quint32 *offset, quint32 *length) {
+        QByteArray utf8 = str.toUtf8();
+        *offset = quint32(strings.size());
+        *length = quint32(utf8.size());
+        strings.append(utf8);
+    };
+
+    QVector<IndexSource> indexSources;
+    for (const QString &source : sources)
+    {
+        QFileInfo info(source);
+        IndexSource s;
+        if (info.exists())
+        {
+            s.lastModified = info.lastModified().toMSecsSinceEpoch();
+            s.size = info.size();
+        }
+        else
+        {
+            s.lastModified = 0;
+            s.size = -1;
+        }
+        appendString(info.absoluteFilePath(), &s.path, &s.pathLength);
+        indexSources.append(s);
+    }
+
+    // 广度优先排列，同一父节点的子节点连续
+    QVector<IndexNode> nodes;
+    QVector<QJsonObject> queue;
+    queue.append(root);
+    for (int id = 0; id < queue.size(); ++id)
+    {
+        const QJsonObject json = queue.at(id);
+
+        IndexNode node;
+        memset(&node, 0, sizeof(node));
+        node.geometricError = json["geometricError"].toDouble();
+
+        if (json.contains("refine"))
+        {
+            node.flags |= HasRefine;
+            if (json["refine"].toString() == QLatin1String("ADD"))
+                node.flags |= RefineAdd;
+        }
+
+        QJsonArray transform = json["transform"].toArray();
+        if (transform.size() == 16)
+        {
+            node.flags |= HasTransform;
+            for (int i = 0; i < 16; ++i)
+            {
+                node.transform[i] = transform.at(i).toDouble();
+            }
+        }
+
+        QJsonArray sphere = json["boundingVolume"].toObject()["sphere"].toArray();
+        if (sphere.size() != 4)
+            return false;
+        for (int i = 0; i < 4; ++i)
+        {
+            node.sphere[i] = sphere.at(i).toDouble();
+        }
+
+        QJsonObject content = json["content"].toObject();
+        QString url = content.contains("uri") ? content["uri"].toString() : content["url"].toString();
+        if (!url.isEmpty())
+        {
+            node.flags |= HasContent;
+            appendString(url, &node.content, &node.contentLength);
+        }
+
+        QJsonArray children = json["children"].toArray();
+        if (!children.isEmpty())
+        {
+            node.firstChild = queue.size();
+            node.childCount = children.size();
+            for (const QJsonValue &child : children)
+            {
+                queue.append(child.toObject());
+            }
+        }
+
+        nodes.append(node);
+        queue[id] = QJsonObject();
+    }
+
+    IndexHeader header;
+    header.magic = kIndexMagic;
+    header.version = kIndexVersion;
+    header.nodeCount = quint32(nodes.size());
+    header.sourceCount = quint32(indexSources.size());
+    header.stringBytes = quint64(strings.size());
+    header.parameter = parameter;
+
+    QDir().mkpath(QFileInfo(indexPath).absolutePath());
+
+    QSaveFile file(indexPath);
+    if (!file.open(QFile::WriteOnly))
+        return false;
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(indexSources.constData()), indexSources.size() * sizeof(IndexSource));
+    file.write(reinterpret_cast<const char *>(nodes.constData()), nodes.size() * sizeof(IndexNode));
+    file.write(strings);
+
+    return file.commit();
+}
@@ -0,0 +1,45 @@
+#ifndef LITILESETINDEX_H
+#define LITILESETINDEX_H
+
+#include "liextrasglobal.h"
+#include <QJsonObject>
+#include <QStringList>
+
+/**
+ * @brief
+ * 瓦片集的二进制索引缓存。把由XML等源文件生成的瓦片树保存为扁平的节点表
+ * （广度优先排列，包含变换矩阵、包围球、几何误差和内容路径），之后加载时只需映射一个文件。
+ * 索引中记录所有源文件的修改时间和大小，任何一个源文件变化时索引失效。
+ * 索引文件按本机字节序保存，只用作本地缓存。
+ */
+class LIEXTRAS_EXPORT LiTilesetIndex
+{
+public:
+    /**
+     * @brief
+     * 源文件对应的默认索引路径，位于系统缓存目录下
+     */
+    static QString indexPath(const QString &sourcePath);
+
+    /**
+     * @brief
+     * 读取索引，还原根瓦片的json
+     * @param indexPath 索引文件路径
+     * @param parameter 生成索引时使用的参数（如几何误差），不一致时索引失效
+     * @return 根瓦片json，索引不存在、损坏或已失效时返回空对象
+     */
+    static QJsonObject read(const QString &indexPath, double parameter = 0.0);
+
+    /**
+     * @brief
+     * 写入索引
+     * @param indexPath 索引文件路径
+     * @param root 根瓦片json，瓦片只能使用sphere包围体
+     * @param sources 生成瓦片树时读取的本地源文件，不存在的文件也会记录，之后出现时索引失效
+     * @param parameter 生成索引时使用的参数
+     */
+    static bool write(const QString &indexPath, const QJsonObject &root,
+                      const QStringList &sources, double parameter = 0.0);
+};
+
+#endif // LITILESETINDEX_H
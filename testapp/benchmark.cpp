@@ -0,0 +1,1037 @@
+﻿#include "benchmark.h"
+#include <requestqueue.h>
+#include <quadtreetraversal.h>
+#include <cullingbatch.h>
+#include <flattenmaskindex.h>
+#include <terrainmeshbvh.h>
+#include <intersect.h>
+#include <lidxtcompressor.h>
+#include <litextureutil.h>
+#include <quantizedmeshdecoder.h>
+#include <boundingvolume.h>
+#include <cartesian3.h>
+#include <cartographic.h>
+#include <QNetworkRequest>
+#include <QPainterPath>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <random>
+
+namespace
+{
+
+struct RecordedRequest
+{
+    int frame;
+    LiRequest::RequestType type;
+    Cartesian3 position;
+};
+
+struct RequestStream
+{
+    QVector<Cartesian3> cameras;            ///< 每帧的相机位置
+    QVector<RecordedRequest> requests;      ///< 按帧排列的请求
+};
+
+/**
+ * @brief
+ * 读取记录的请求流，每行为“C x y z”（一帧的相机位置）或“R type x y z”（当前帧发出的请求）。
+ * 没有记录文件时生成一段沿直线低空飞行的请求流。
+ */
+RequestStream loadRequestStream(const QString &recording)
+{
+    RequestStream stream;
+    QFile file(recording);
+    if (!recording.isEmpty() && file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        QTextStream in(&file);
+        while (!in.atEnd())
+        {
+            QStringList fields = in.readLine().split(' ', QString::SkipEmptyParts);
+            if (fields.size() == 4 && fields[0] == "C")
+            {
+                stream.cameras.append(Cartesian3(fields[1].toDouble(), fields[2].toDouble(), fields[3].toDouble()));
+            }
+            else if (fields.size() == 5 && fields[0] == "R" && !stream.cameras.isEmpty())
+            {
+                RecordedRequest request;
+                request.frame = stream.cameras.size() - 1;
+                request.type = LiRequest::RequestType(qBound(0, fields[1].toInt(), int(LiRequest::OTHER)));
+                request.position = Cartesian3(fields[2].toDouble(), fields[3].toDouble(), fields[4].toDouble());
+                stream.requests.append(request);
+            }
+        }
+        return stream;
+    }
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> offset(-20000.0, 20000.0);
+    for (int frame = 0; frame < 1200; ++frame)
+    {
+        Cartesian3 camera(frame * 100.0, 0.0, 1000.0);
+        stream.cameras.append(camera);
+        for (int i = 0; i < 40; ++i)
+        {
+            RecordedRequest request;
+            request.frame = frame;
+            request.type = LiRequest::RequestType(i % 3);
+            request.position = Cartesian3(camera.x + offset(rng) + 10000.0, camera.y + offset(rng), 0.0);
+            stream.requests.append(request);
+        }
+    }
+    return stream;
+}
+
+struct ReplayResult
+{
+    qint64 totalNs = 0;
+    qint64 maximumFrameNs = 0;
+    int issued = 0;
+};
+
+/**
+ * @brief
+ * 按帧回放请求流，每帧最多发出issuePerFrame个请求，距离相机超过cancelDistance的请求被取消
+ */
+template <typename Queue>
+ReplayResult replay(const RequestStream &stream, Queue &queue, int issuePerFrame, double cancelDistance)
+{
+    QSharedPointer<Cartesian3> camera(new Cartesian3);
+    ReplayResult result;
+    int next = 0;
+    QElapsedTimer timer;
+    for (int frame = 0; frame < stream.cameras.size(); ++frame)
+    {
+        *camera = stream.cameras[frame];
+        timer.start();
+        for (; next < stream.requests.size() && stream.requests[next].frame == frame; ++next)
+        {
+            const Cartesian3 position = stream.requests[next].position;
+            LiRequest request(QNetworkRequest(), [camera, position]() {
+                return Cartesian3::distance(*camera, position);
+            }, stream.requests[next].type, false, true);
+            queue.push(request);
+        }
+        result.issued += queue.process(issuePerFrame, cancelDistance);
+        qint64 ns = timer.nsecsElapsed();
+        result.totalNs += ns;
+        result.maximumFrameNs = qMax(result.maximumFrameNs, ns);
+    }
+    return result;
+}
+
+/**
+ * @brief
+ * RequestScheduler原来的做法：每帧重新计算所有请求的优先级并重建堆
+ */
+class HeapReplay
+{
+public:
+    void push(const LiRequest &request) { m_requests.append(request); }
+
+    int process(int issuePerFrame, double cancelDistance)
+    {
+        auto greater = [](const LiRequest &a, const LiRequest &b) { return a.priority() > b.priority(); };
+        for (LiRequest &request : m_requests)
+        {
+            request.updatePriority();
+            if (request.priority() > cancelDistance)
+                request.cancel();
+        }
+        m_requests.erase(std::remove_if(m_requests.begin(), m_requests.end(),
+                                        [](const LiRequest &r) { return r.isCanceled(); }), m_requests.end());
+        std::make_heap(m_requests.begin(), m_requests.end(), greater);
+
+        int issued = 0;
+        while (issued < issuePerFrame && !m_requests.isEmpty())
+        {
+            std::pop_heap(m_requests.begin(), m_requests.end(), greater);
+            m_requests.removeLast();
+            ++issued;
+        }
+        return issued;
+    }
+
+private:
+    QVector<LiRequest> m_requests;
+};
+
+/**
+ * @brief
+ * 分桶队列：新请求入队时计算一次优先级，之后只重新计算相机附近（遍历时被访问）的请求和轮询的一部分
+ */
+class BucketReplay
+{
+public:
+    BucketReplay()
+    {
+        for (int t = 0; t < RequestQueue::NumberOfTypes; ++t)
+            m_queue.setMaximumActiveRequests(LiRequest::RequestType(t), 1 << 30);
+    }
+
+    void push(const LiRequest &request)
+    {
+        m_handles.append(qMakePair(m_queue.push(request), request));
+    }
+
+    int process(int issuePerFrame, double cancelDistance)
+    {
+        int alive = 0;
+        for (int i = 0; i < m_handles.size(); ++i)
+        {
+            if (!m_queue.contains(m_handles[i].first))
+                continue;
+            m_handles[alive++] = m_handles[i];
+
+            const LiRequest &request = m_handles[i].second;
+            if (request.priority() < cancelDistance * 0.5)
+                m_queue.markDirty(m_handles[i].first);
+        }
+        m_handles.resize(alive);
+        m_queue.update();
+
+        // 出队时才发现已经离开范围的请求被取消，与重建堆时的取消对应
+        int issued = 0;
+        LiRequest request;
+        while (issued < issuePerFrame && m_queue.pop(&request))
+        {
+            m_queue.release(request.type());
+            if (request.priority() > cancelDistance)
+                request.cancel();
+            else
+                ++issued;
+        }
+        return issued;
+    }
+
+private:
+    RequestQueue m_queue;
+    QVector<QPair<RequestQueue::Handle, LiRequest>> m_handles;
+};
+
+}
+
+void benchmarkRequestQueue(const QString &recording)
+{
+    const RequestStream stream = loadRequestStream(recording);
+    const int issuePerFrame = 20;
+    const double cancelDistance = 30000.0;
+
+    HeapReplay heap;
+    ReplayResult heapResult = replay(stream, heap, issuePerFrame, cancelDistance);
+    BucketReplay bucket;
+    ReplayResult bucketResult = replay(stream, bucket, issuePerFrame, cancelDistance);
+
+    qDebug() << "request replay:" << stream.cameras.size() << "frames" << stream.requests.size() << "requests";
+    qDebug() << "  heap:   total" << heapResult.totalNs / 1e6 << "ms, worst frame" << heapResult.maximumFrameNs / 1e6
+             << "ms, issued" << heapResult.issued;
+    qDebug() << "  bucket: total" << bucketResult.totalNs / 1e6 << "ms, worst frame" << bucketResult.maximumFrameNs / 1e6
+             << "ms, issued" << bucketResult.issued;
+}
+
+namespace
+{
+
+/**
+ * @brief
+ * 用于遍历测试的地理坐标四叉树瓦片，子瓦片在第一次访问时创建
+ */
+struct TraversalTile
+{
+    int level = 0;
+    int x = 0;
+    int y = 0;
+    Cartesian3 center;
+    std::unique_ptr<TraversalTile> children[4];
+
+    static TraversalTile *create(int level, int x, int y)
+    {
+        TraversalTile *tile = new TraversalTile;
+        tile->level = level;
+        tile->x = x;
+        tile->y = y;
+        const double size = M_PI / (1 << level);
+        tile->center = spherePosition(-M_PI + (x + 0.5) * size, M_PI_2 - (y + 0.5) * size, 0.0);
+        return tile;
+    }
+
+    /**
+     * @brief
+     * 测试使用半径为6378137米的球体，地平线剔除只需要比较夹角
+     */
+    static Cartesian3 spherePosition(double longitude, double latitude, double height)
+    {
+        const double radius = 6378137.0 + height;
+        return Cartesian3(radius * std::cos(latitude) * std::cos(longitude),
+                          radius * std::cos(latitude) * std::sin(longitude),
+                          radius * std::sin(latitude));
+    }
+
+    TraversalTile *child(int i)
+    {
+        if (!children[i])
+            children[i].reset(create(level + 1, x * 2 + (i & 1), y * 2 + (i >> 1)));
+        return children[i].get();
+    }
+
+    /**
+     * @brief
+     * 模拟瓦片数据是否已经加载，约10%的瓦片没有加载
+     */
+    bool isRenderable() const
+    {
+        quint32 h = quint32(level) * 73856093u ^ quint32(x) * 19349663u ^ quint32(y) * 83492791u;
+        return h % 10 != 0;
+    }
+};
+
+typedef QuadtreeTraversal<TraversalTile> TileTraversal;
+
+/**
+ * @brief
+ * 简化的selectTilesForRendering：地平线剔除，按距离计算屏幕空间误差，子瓦片不能渲染时渲染父瓦片并撤销子孙瓦片的加载请求
+ */
+void traverseTiles(TileTraversal &traversal, const QVector<TraversalTile *> &levelZeroTiles,
+                   const Cartesian3 &camera, TileTraversal::Result *result)
+{
+    const double maximumScreenSpaceError = 2.0;
+    const double sseDenominator = 2.0 * std::tan(M_PI / 6.0) / 1080.0;
+    const double cameraHeight = camera.magnitude();
+
+    auto enter = [&](TraversalTile *tile, TileTraversal::Result &r, TraversalTile **children) -> int {
+        // 法向量与相机方向夹角超过地平线时剔除，留出瓦片大小的余量
+        const double margin = M_PI / (1 << tile->level);
+        const double cosine = Cartesian3::dot(tile->center, camera) / (6378137.0 * cameraHeight);
+        if (std::acos(qBound(-1.0, cosine, 1.0)) > std::acos(6378137.0 / cameraHeight) + margin)
+        {
+            ++r.tilesCulled;
+            return 0;
+        }
+
+        const double distance = qMax(1.0, Cartesian3::distance(tile->center, camera));
+        const double geometricError = 77067.0 / (1 << tile->level);
+        if (tile->level >= 18 || geometricError / (distance * sseDenominator) <= maximumScreenSpaceError)
+        {
+            r.tilesToRender.append(tile);
+            if (!tile->isRenderable())
+                r.tileLoadQueueHigh.append(tile);
+            return 0;
+        }
+
+        if (!tile->isRenderable())
+            r.tileLoadQueueLow.append(tile);
+
+        int order[4] = { 0, 1, 2, 3 };
+        double distances[4];
+        for (int i = 0; i < 4; ++i)
+            distances[i] = Cartesian3::distance(tile->child(i)->center, camera);
+        std::sort(order, order + 4, [&distances](int a, int b) { return distances[a] < distances[b]; });
+        for (int i = 0; i < 4; ++i)
+            children[i] = tile->child(order[i]);
+        return 4;
+    };
+
+    auto leave = [](TraversalTile *tile, TileTraversal::Result &r, const TileTraversal::Marker &start) {
+        if (r.tilesToRender.size() == start.render || r.tilesToRender[start.render] == tile)
+            return;
+
+        bool allRenderable = true;
+        for (int i = start.render; i < r.tilesToRender.size() && allRenderable; ++i)
+            allRenderable = r.tilesToRender[i]->isRenderable();
+        if (allRenderable || !tile->isRenderable())
+            return;
+
+        // kick：渲染父瓦片，丢弃子孙瓦片的加载请求，只加载子瓦片
+        r.tilesToRender.resize(start.render);
+        r.tilesToRender.append(tile);
+        r.tileLoadQueueHigh.resize(start.loadHigh);
+        r.tileLoadQueueMedium.resize(start.loadMedium);
+        r.tileLoadQueueLow.resize(start.loadLow);
+        ++r.tilesWaitingForChildren;
+        for (int i = 0; i < 4; ++i)
+        {
+            if (!tile->child(i)->isRenderable())
+                r.tileLoadQueueMedium.append(tile->child(i));
+        }
+    };
+
+    traversal.traverse(levelZeroTiles, enter, leave, result);
+}
+
+}
+
+void benchmarkQuadtreeTraversal(const QString &recording)
+{
+    // 每行为一个相机位置“经度 纬度 高度”（度、米），没有记录文件时生成一段低空平飞
+    QVector<Cartographic> poses;
+    QFile file(recording);
+    if (!recording.isEmpty() && file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        QTextStream in(&file);
+        while (!in.atEnd())
+        {
+            QStringList fields = in.readLine().split(' ', QString::SkipEmptyParts);
+            if (fields.size() == 3)
+                poses.append(Cartographic::fromDegrees(fields[0].toDouble(), fields[1].toDouble(), fields[2].toDouble()));
+        }
+    }
+    if (poses.isEmpty())
+    {
+        for (int i = 0; i < 200; ++i)
+            poses.append(Cartographic::fromDegrees(114.0 + i * 0.001, 22.5, 1500.0));
+    }
+
+    QVector<TraversalTile *> levelZeroTiles;
+    levelZeroTiles.append(TraversalTile::create(0, 0, 0));
+    levelZeroTiles.append(TraversalTile::create(0, 1, 0));
+
+    TileTraversal serial;
+    serial.setParallel(false);
+    TileTraversal parallel;
+
+    qint64 serialNs = 0;
+    qint64 parallelNs = 0;
+    int visited = 0;
+    int mismatches = 0;
+    QElapsedTimer timer;
+    for (const Cartographic &pose : poses)
+    {
+        const Cartesian3 camera = TraversalTile::spherePosition(pose.longitude, pose.latitude, pose.height);
+
+        TileTraversal::Result serialResult;
+        timer.start();
+        traverseTiles(serial, levelZeroTiles, camera, &serialResult);
+        serialNs += timer.nsecsElapsed();
+
+        TileTraversal::Result parallelResult;
+        timer.start();
+        traverseTiles(parallel, levelZeroTiles, camera, &parallelResult);
+        parallelNs += timer.nsecsElapsed();
+
+        visited += serialResult.tilesVisited;
+        if (serialResult.tilesToRender != parallelResult.tilesToRender
+                || serialResult.tileLoadQueueHigh != parallelResult.tileLoadQueueHigh
+                || serialResult.tileLoadQueueMedium != parallelResult.tileLoadQueueMedium
+                || serialResult.tileLoadQueueLow != parallelResult.tileLoadQueueLow)
+        {
+            ++mismatches;
+        }
+    }
+
+    for (TraversalTile *tile : levelZeroTiles)
+        delete tile;
+
+    // 第一个相机位置包含创建子瓦片的时间，两种遍历的差异不大
+    qDebug() << "quadtree traversal:" << poses.size() << "poses," << visited / qMax(1, poses.size()) << "tiles per frame";
+    qDebug() << "  serial:  " << serialNs / 1e6 / poses.size() << "ms per frame";
+    qDebug() << "  parallel:" << parallelNs / 1e6 / poses.size() << "ms per frame, mismatched frames" << mismatches;
+}
+
+namespace
+{
+
+/**
+ * @brief
+ * 重复repeat次，返回最短的耗时（纳秒）
+ */
+template <typename Func>
+qint64 bestOf(int repeat, const Func &func)
+{
+    qint64 best = std::numeric_limits<qint64>::max();
+    QElapsedTimer timer;
+    for (int i = 0; i < repeat; ++i)
+    {
+        timer.start();
+        func();
+        best = qMin(best, timer.nsecsElapsed());
+    }
+    return best;
+}
+
+}
+
+void benchmarkCullingBatch()
+{
+    // 原点处朝+z的视锥，近裁切面1米，远裁切面10公里
+    CullingVolume cullingVolume;
+    const double s = std::sqrt(0.5);
+    cullingVolume.addPlane(Plane(Vector3(s, 0, s), 0));
+    cullingVolume.addPlane(Plane(Vector3(-s, 0, s), 0));
+    cullingVolume.addPlane(Plane(Vector3(0, s, s), 0));
+    cullingVolume.addPlane(Plane(Vector3(0, -s, s), 0));
+    cullingVolume.addPlane(Plane(Vector3(0, 0, 1), -1.0));
+    cullingVolume.addPlane(Plane(Vector3(0, 0, -1), 10000.0));
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> position(-10000.0, 10000.0);
+    std::uniform_real_distribution<double> extent(1.0, 200.0);
+    std::uniform_real_distribution<double> angle(0.0, M_PI);
+
+    for (int n : { 1000, 10000, 100000 })
+    {
+        BoundingSphereBatch spheres;
+        OrientedBoundingBoxBatch boxes;
+        QVector<BoundingVolume> sphereVolumes;
+        QVector<BoundingVolume> boxVolumes;
+        spheres.reserve(n);
+        boxes.reserve(n);
+        for (int i = 0; i < n; ++i)
+        {
+            const Vector3 center(position(rng), position(rng), position(rng) * 0.5 + 5000.0);
+            BoundingSphere sphere(center, extent(rng));
+            spheres.append(sphere);
+            sphereVolumes.append(BoundingVolume(sphere));
+
+            const double a = angle(rng);
+            const double x = extent(rng), y = extent(rng), z = extent(rng);
+            Matrix3 halfAxes(std::cos(a) * x, -std::sin(a) * y, 0.0,
+                             std::sin(a) * x, std::cos(a) * y, 0.0,
+                             0.0, 0.0, z);
+            OrientedBoundingBox box(center, halfAxes);
+            boxes.append(box);
+            boxVolumes.append(BoundingVolume(box));
+        }
+
+        std::vector<uint> expected(size_t(n)), masks(size_t(n));
+        const uint indeterminate = CullingVolume::MASK_INDETERMINATE;
+
+        qint64 sphereSingle = bestOf(10, [&]() {
+            for (int i = 0; i < n; ++i)
+                expected[size_t(i)] = cullingVolume.computeVisibilityWithPlaneMask(sphereVolumes[i], indeterminate);
+        });
+        qint64 sphereBatch = bestOf(10, [&]() {
+            CullingBatch(cullingVolume).computeVisibilityWithPlaneMask(spheres, nullptr, masks.data());
+        });
+        const bool sphereSame = expected == masks;
+
+        qint64 boxSingle = bestOf(10, [&]() {
+            for (int i = 0; i < n; ++i)
+                expected[size_t(i)] = cullingVolume.computeVisibilityWithPlaneMask(boxVolumes[i], indeterminate);
+        });
+        qint64 boxBatch = bestOf(10, [&]() {
+            CullingBatch(cullingVolume).computeVisibilityWithPlaneMask(boxes, nullptr, masks.data());
+        });
+        const bool boxSame = expected == masks;
+
+        qDebug() << "culling" << n << "volumes:";
+        qDebug() << "  sphere: single" << sphereSingle / 1e3 << "us, batch" << sphereBatch / 1e3 << "us, same" << sphereSame;
+        qDebug() << "  obb:    single" << boxSingle / 1e3 << "us, batch" << boxBatch / 1e3 << "us, same" << boxSame;
+    }
+}
+
+namespace
+{
+
+/**
+ * @brief
+ * 原地解码的耗时，每次先用reset恢复输入，只计decode的时间，返回最短的耗时（纳秒）
+ */
+template <typename Reset, typename Decode>
+qint64 bestOfInPlace(int repeat, const Reset &reset, const Decode &decode)
+{
+    qint64 best = std::numeric_limits<qint64>::max();
+    QElapsedTimer timer;
+    for (int i = 0; i < repeat; ++i)
+    {
+        reset();
+        timer.start();
+        decode();
+        best = qMin(best, timer.nsecsElapsed());
+    }
+    return best;
+}
+
+template <typename T>
+bool sameBytes(const std::vector<T> &a, const std::vector<T> &b)
+{
+    return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+quint16 zigZagEncode(int value)
+{
+    return quint16((quint32(value) << 1) ^ quint32(value >> 31));
+}
+
+/**
+ * @brief
+ * 生成高水位编码的索引：按三角形条带的顺序引用顶点，新顶点的编码为0
+ */
+template <typename T>
+std::vector<T> highWaterMarkIndices(int triangleCount, int vertexCount, std::mt19937 &rng)
+{
+    std::vector<T> codes;
+    codes.reserve(size_t(triangleCount) * 3);
+    T highest = 0;
+    for (int i = 0; i < triangleCount * 3; ++i)
+    {
+        T index;
+        if (highest < T(vertexCount) && (highest < 3 || rng() % 3 == 0))
+            index = highest;
+        else
+            index = T(highest - 1 - rng() % qMin<quint32>(quint32(highest), 64u));
+        codes.push_back(T(highest - index));
+        if (index == highest)
+            ++highest;
+    }
+    return codes;
+}
+
+}
+
+void benchmarkQuantizedMesh()
+{
+#if defined(QUANTIZEDMESH_SSE2)
+    qDebug() << "quantized-mesh decode: SSE2";
+#else
+    qDebug() << "quantized-mesh decode: scalar only, both columns use the same code";
+#endif
+
+    std::mt19937 rng(1);
+    const int repeat = 50;
+
+    // 顶点数覆盖小瓦片、典型瓦片和需要32位索引的大瓦片
+    for (int vertexCount : { 1000, 16641, 100000 })
+    {
+        const int triangleCount = vertexCount * 2;
+
+        // u/v/height为随机游走的zig-zag差分
+        std::vector<quint16> deltas(size_t(vertexCount) * 3);
+        for (quint16 &delta : deltas)
+        {
+            delta = zigZagEncode(int(rng() % 257) - 128);
+        }
+
+        std::vector<quint16> quantized(static_cast<size_t>(vertexCount));
+        for (quint16 &value : quantized)
+        {
+            value = quint16(rng() % 32768);
+        }
+
+        std::vector<quint8> octNormals(size_t(vertexCount) * 2);
+        for (quint8 &value : octNormals)
+        {
+            value = quint8(rng());
+        }
+
+        std::vector<quint16> codes16;
+        if (vertexCount <= 65536)
+            codes16 = highWaterMarkIndices<quint16>(triangleCount, vertexCount, rng);
+        std::vector<quint32> codes32 = highWaterMarkIndices<quint32>(triangleCount, vertexCount, rng);
+
+        std::vector<quint16> zigZagScalar, zigZagSimd;
+        qint64 zigZagScalarNs = bestOfInPlace(repeat, [&]() { zigZagScalar = deltas; }, [&]() {
+            QuantizedMeshDecoder::decodeZigZagDeltasScalar(zigZagScalar.data(), int(zigZagScalar.size()));
+        });
+        qint64 zigZagSimdNs = bestOfInPlace(repeat, [&]() { zigZagSimd = deltas; }, [&]() {
+            QuantizedMeshDecoder::decodeZigZagDeltas(zigZagSimd.data(), int(zigZagSimd.size()));
+        });
+
+        std::vector<quint16> index16Scalar, index16Simd;
+        qint64 index16ScalarNs = bestOfInPlace(repeat, [&]() { index16Scalar = codes16; }, [&]() {
+            QuantizedMeshDecoder::decodeHighWaterMarkScalar(index16Scalar.data(), int(index16Scalar.size()));
+        });
+        qint64 index16SimdNs = bestOfInPlace(repeat, [&]() { index16Simd = codes16; }, [&]() {
+            QuantizedMeshDecoder::decodeHighWaterMark(index16Simd.data(), int(index16Simd.size()));
+        });
+
+        std::vector<quint32> index32Scalar, index32Simd;
+        qint64 index32ScalarNs = bestOfInPlace(repeat, [&]() { index32Scalar = codes32; }, [&]() {
+            QuantizedMeshDecoder::decodeHighWaterMarkScalar(index32Scalar.data(), int(index32Scalar.size()));
+        });
+        qint64 index32SimdNs = bestOfInPlace(repeat, [&]() { index32Simd = codes32; }, [&]() {
+            QuantizedMeshDecoder::decodeHighWaterMark(index32Simd.data(), int(index32Simd.size()));
+        });
+
+        std::vector<float> normalScalar(size_t(vertexCount) * 3), normalSimd(size_t(vertexCount) * 3);
+        qint64 normalScalarNs = bestOf(repeat, [&]() {
+            QuantizedMeshDecoder::decodeOctNormalsScalar(octNormals.data(), vertexCount, normalScalar.data());
+        });
+        qint64 normalSimdNs = bestOf(repeat, [&]() {
+            QuantizedMeshDecoder::decodeOctNormals(octNormals.data(), vertexCount, normalSimd.data());
+        });
+
+        std::vector<double> heightScalar(static_cast<size_t>(vertexCount)), heightSimd(static_cast<size_t>(vertexCount));
+        qint64 heightScalarNs = bestOf(repeat, [&]() {
+            QuantizedMeshDecoder::dequantizeScalar(quantized.data(), vertexCount, -427.0, 8848.0, heightScalar.data());
+        });
+        qint64 heightSimdNs = bestOf(repeat, [&]() {
+            QuantizedMeshDecoder::dequantize(quantized.data(), vertexCount, -427.0, 8848.0, heightSimd.data());
+        });
+
+        // 百万元素每秒
+        auto rate = [](size_t count, qint64 ns) { return count * 1e3 / qMax<qint64>(1, ns); };
+
+        qDebug() << "quantized-mesh" << vertexCount << "vertices," << triangleCount << "triangles (M/s scalar, simd, bit-exact):";
+        qDebug() << "  zig-zag u/v/h:" << rate(deltas.size(), zigZagScalarNs) << rate(deltas.size(), zigZagSimdNs)
+                 << sameBytes(zigZagScalar, zigZagSimd);
+        if (!codes16.empty())
+            qDebug() << "  indices 16:   " << rate(codes16.size(), index16ScalarNs) << rate(codes16.size(), index16SimdNs)
+                     << sameBytes(index16Scalar, index16Simd);
+        qDebug() << "  indices 32:   " << rate(codes32.size(), index32ScalarNs) << rate(codes32.size(), index32SimdNs)
+                 << sameBytes(index32Scalar, index32Simd);
+        qDebug() << "  oct normals:  " << rate(size_t(vertexCount), normalScalarNs) << rate(size_t(vertexCount), normalSimdNs)
+                 << sameBytes(normalScalar, normalSimd);
+        qDebug() << "  dequantize:   " << rate(size_t(vertexCount), heightScalarNs) << rate(size_t(vertexCount), heightSimdNs)
+                 << sameBytes(heightScalar, heightSimd);
+    }
+}
+
+namespace
+{
+
+/**
+ * @brief
+ * 以center为中心的随机多边形，顶点按角度排列；shuffle为true时打乱顶点顺序，得到自相交的多边形
+ */
+QPolygonF randomPolygon(const QPointF &center, double radius, int count, bool shuffle, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<double> scale(0.3, 1.0);
+    QPolygonF polygon;
+    for (int i = 0; i < count; ++i)
+    {
+        const double angle = 2.0 * M_PI * i / count;
+        const double r = radius * scale(rng);
+        polygon.append(center + QPointF(r * std::cos(angle), r * std::sin(angle)));
+    }
+    if (shuffle)
+        std::shuffle(polygon.begin(), polygon.end(), rng);
+    return polygon;
+}
+
+QPainterPath closedPath(const QPolygonF &polygon)
+{
+    QPainterPath path;
+    path.setFillRule(Qt::OddEvenFill);
+    path.addPolygon(polygon);
+    path.closeSubpath();
+    return path;
+}
+
+}
+
+void benchmarkFlattenMasks()
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    // 随机多边形上与QPainterPath::contains逐点对比
+    int tested = 0;
+    int mismatches = 0;
+    for (int i = 0; i < 500; ++i)
+    {
+        const QPolygonF polygon = randomPolygon(QPointF(0.5, 0.5), 0.45, 3 + int(rng() % 60), i % 5 == 0, rng);
+        const QPainterPath path = closedPath(polygon);
+        const FlattenMaskIndex index(polygon, 1 + int(rng() % 32));
+        for (int k = 0; k < 2000; ++k)
+        {
+            const double x = unit(rng);
+            const double y = unit(rng);
+            if (index.contains(x, y) != path.contains(QPointF(x, y)))
+                ++mismatches;
+            ++tested;
+        }
+    }
+    qDebug() << "flatten mask contains:" << tested << "points," << mismatches << "mismatches against QPainterPath";
+
+    // 40 x 25个单位大小的瓦片，每个瓦片65 x 65个顶点，压平多边形随机分布在瓦片范围内
+    const int tilesX = 40;
+    const int tilesY = 25;
+    const int grid = 65;
+    std::vector<double> u, v;
+    for (int r = 0; r < grid; ++r)
+    {
+        for (int c = 0; c < grid; ++c)
+        {
+            u.push_back(double(c) / (grid - 1));
+            v.push_back(double(r) / (grid - 1));
+        }
+    }
+    const int vertexCount = int(u.size());
+
+    std::uniform_real_distribution<double> radius(0.3, 3.0);
+    QVector<QPolygonF> masks;
+    for (int i = 0; i < 100; ++i)
+    {
+        const QPointF center(unit(rng) * tilesX, unit(rng) * tilesY);
+        masks.append(randomPolygon(center, radius(rng), 8 + int(rng() % 40), false, rng));
+    }
+
+    // 与瓦片相交的多边形变换到瓦片的归一化坐标
+    QVector<QVector<QPolygonF>> tileMasks;
+    int pairs = 0;
+    for (int ty = 0; ty < tilesY; ++ty)
+    {
+        for (int tx = 0; tx < tilesX; ++tx)
+        {
+            const QRectF tile(tx, ty, 1.0, 1.0);
+            QVector<QPolygonF> normalized;
+            for (const QPolygonF &mask : masks)
+            {
+                if (!mask.boundingRect().intersects(tile))
+                    continue;
+                normalized.append(mask.translated(-tile.topLeft()));
+            }
+            pairs += normalized.size();
+            tileMasks.append(normalized);
+        }
+    }
+
+    qint64 insidePath = 0;
+    qint64 insideIndex = 0;
+    qint64 pathNs = bestOf(3, [&]() {
+        insidePath = 0;
+        for (const QVector<QPolygonF> &normalized : tileMasks)
+        {
+            for (const QPolygonF &polygon : normalized)
+            {
+                const QPainterPath path = closedPath(polygon);
+                for (int i = 0; i < vertexCount; ++i)
+                {
+                    if (path.contains(QPointF(u[size_t(i)], v[size_t(i)])))
+                        ++insidePath;
+                }
+            }
+        }
+    });
+    qint64 indexNs = bestOf(3, [&]() {
+        insideIndex = 0;
+        FlattenMaskIndex index;
+        QVector<int> inside;
+        for (const QVector<QPolygonF> &normalized : tileMasks)
+        {
+            for (const QPolygonF &polygon : normalized)
+            {
+                index.build(polygon);
+                index.containedVertices(u.data(), v.data(), vertexCount, &inside);
+                insideIndex += inside.size();
+            }
+        }
+    });
+
+    qDebug() << "flatten masks:" << masks.size() << "masks," << tileMasks.size() << "tiles,"
+             << pairs << "overlapping pairs," << vertexCount << "vertices per tile";
+    qDebug() << "  QPainterPath:" << pathNs / 1e6 << "ms," << insidePath << "vertices inside";
+    qDebug() << "  grid index:  " << indexNs / 1e6 << "ms," << insideIndex << "vertices inside";
+}
+
+namespace
+{
+
+/**
+ * @brief
+ * 逐个三角形求交，与GlobeSurfaceTile::pick相同，返回最近交点的射线参数
+ */
+bool pickTriangles(const Ray &ray, const std::vector<Vector3> &vertices, const std::vector<quint32> &indices, double *closest)
+{
+    bool hit = false;
+    *closest = std::numeric_limits<double>::max();
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        double t;
+        if (Intersect::rayTriangleParametric(ray, vertices[indices[i]], vertices[indices[i + 1]], vertices[indices[i + 2]], false, &t)
+                && t >= 0.0 && t < *closest)
+        {
+            *closest = t;
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+}
+
+void benchmarkTerrainPick(const QString &recording)
+{
+    Ellipsoid *ellipsoid = Ellipsoid::WGS84();
+
+    // 0.1度见方、129 x 129个顶点的起伏地形瓦片
+    const int grid = 129;
+    const double west = 116.3, south = 39.9, size = 0.1;
+    std::vector<double> positions;
+    std::vector<Vector3> vertices;
+    for (int r = 0; r < grid; ++r)
+    {
+        for (int c = 0; c < grid; ++c)
+        {
+            const double height = 200.0 + 150.0 * std::sin(c * 0.21) * std::cos(r * 0.17) + 20.0 * std::sin(c * r * 0.013);
+            const Cartesian3 p = ellipsoid->cartographicToCartesian(
+                        Cartographic::fromDegrees(west + size * c / (grid - 1), south + size * r / (grid - 1), height));
+            positions.insert(positions.end(), { p.x, p.y, p.z });
+            vertices.push_back(Vector3(p));
+        }
+    }
+    std::vector<quint32> indices;
+    for (int r = 0; r + 1 < grid; ++r)
+    {
+        for (int c = 0; c + 1 < grid; ++c)
+        {
+            const quint32 a = quint32(r * grid + c), b = a + 1, d = a + quint32(grid), e = d + 1;
+            indices.insert(indices.end(), { a, b, d, b, e, d });
+        }
+    }
+
+    // 射线记录每行为“ox oy oz dx dy dz”（地心坐标），没有记录时从3000米高度看向瓦片内的随机位置
+    QVector<Ray> rays;
+    QFile file(recording);
+    if (!recording.isEmpty() && file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        QTextStream in(&file);
+        while (!in.atEnd())
+        {
+            QStringList fields = in.readLine().split(' ', QString::SkipEmptyParts);
+            if (fields.size() != 6)
+                continue;
+            rays.append(Ray(Vector3(fields[0].toDouble(), fields[1].toDouble(), fields[2].toDouble()),
+                            Vector3(fields[3].toDouble(), fields[4].toDouble(), fields[5].toDouble()).normalized()));
+        }
+    }
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    if (rays.isEmpty())
+    {
+        for (int i = 0; i < 2000; ++i)
+        {
+            const Vector3 eye(ellipsoid->cartographicToCartesian(
+                                  Cartographic::fromDegrees(west + size * unit(rng), south + size * unit(rng), 3000.0)));
+            const Vector3 target(ellipsoid->cartographicToCartesian(
+                                     Cartographic::fromDegrees(west + size * unit(rng), south + size * unit(rng), 0.0)));
+            rays.append(Ray(eye, (target - eye).normalized()));
+        }
+    }
+
+    QVector<Cartographic> queries;
+    for (int i = 0; i < 2000; ++i)
+    {
+        queries.append(Cartographic::fromDegrees(west + size * unit(rng), south + size * unit(rng), 0.0));
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    TerrainMeshBVH bvh(positions, indices);
+    const qint64 buildNs = timer.nsecsElapsed();
+
+    // 逐个三角形求交的结果作为基准
+    std::vector<double> expected(size_t(rays.size()));
+    std::vector<bool> expectedHit(size_t(rays.size()));
+    timer.start();
+    for (int i = 0; i < rays.size(); ++i)
+    {
+        double t;
+        expectedHit[size_t(i)] = pickTriangles(rays[i], vertices, indices, &t);
+        expected[size_t(i)] = t;
+    }
+    const qint64 triangleNs = timer.nsecsElapsed();
+
+    std::vector<Cartesian3> picked(size_t(rays.size()));
+    std::vector<bool> pickedHit(size_t(rays.size()));
+    const qint64 bvhNs = bestOf(10, [&]() {
+        for (int i = 0; i < rays.size(); ++i)
+            pickedHit[size_t(i)] = bvh.pick(rays[i], false, &picked[size_t(i)]);
+    });
+
+    int mismatches = 0;
+    for (int i = 0; i < rays.size(); ++i)
+    {
+        if (pickedHit[size_t(i)] != expectedHit[size_t(i)])
+            ++mismatches;
+        else if (pickedHit[size_t(i)]
+                 && Cartesian3::distance(picked[size_t(i)], rays[i].getPoint(expected[size_t(i)])) > 1e-6)
+            ++mismatches;
+    }
+
+    // 高度查询，基准为同一条竖直射线逐个三角形求交
+    int heightMismatches = 0;
+    timer.start();
+    std::vector<double> expectedHeights(size_t(queries.size()));
+    for (int i = 0; i < queries.size(); ++i)
+    {
+        const Cartographic &q = queries[i];
+        const Vector3 normal = ellipsoid->geodeticSurfaceNormalCartographic(q);
+        const Ray ray(Vector3(ellipsoid->cartographicToCartesian(q)) + normal * -11500.0, normal);
+        double t;
+        expectedHeights[size_t(i)] = pickTriangles(ray, vertices, indices, &t)
+                ? ellipsoid->cartesianToCartographic(ray.getPoint(t)).height : std::numeric_limits<double>::quiet_NaN();
+    }
+    const qint64 triangleHeightNs = timer.nsecsElapsed();
+
+    std::vector<double> heights(size_t(queries.size()));
+    const qint64 bvhHeightNs = bestOf(10, [&]() {
+        for (int i = 0; i < queries.size(); ++i)
+        {
+            if (!bvh.height(queries[i], &heights[size_t(i)], ellipsoid))
+                heights[size_t(i)] = std::numeric_limits<double>::quiet_NaN();
+        }
+    });
+    for (int i = 0; i < queries.size(); ++i)
+    {
+        const double a = heights[size_t(i)], b = expectedHeights[size_t(i)];
+        if (std::isnan(a) != std::isnan(b) || (!std::isnan(a) && std::fabs(a - b) > 1e-6))
+            ++heightMismatches;
+    }
+
+    qDebug() << "terrain pick:" << bvh.triangleCount() << "triangles," << bvh.nodeCount() << "nodes, build" << buildNs / 1e6 << "ms";
+    qDebug() << "  pick" << rays.size() << "rays: triangles" << triangleNs / 1e6 << "ms, bvh" << bvhNs / 1e6
+             << "ms, mismatches" << mismatches;
+    qDebug() << "  height" << queries.size() << "queries: triangles" << triangleHeightNs / 1e6 << "ms, bvh" << bvhHeightNs / 1e6
+             << "ms, mismatches" << heightMismatches;
+}
+
+void benchmarkDXTCompression(const QString &imagePath)
+{
+    // 没有指定图像时生成带噪声的渐变，避免大片相同颜色的块
+    QImage image;
+    if (!imagePath.isEmpty())
+        image.load(imagePath);
+    if (image.isNull())
+    {
+        std::mt19937 rng(1);
+        image = QImage(2048, 2048, QImage::Format_RGBA8888);
+        for (int y = 0; y < image.height(); ++y)
+        {
+            uchar *line = image.scanLine(y);
+            for (int x = 0; x < image.width(); ++x)
+            {
+                const int noise = int(rng() % 32);
+                line[x * 4] = uchar((x / 8 + noise) & 0xff);
+                line[x * 4 + 1] = uchar((y / 8 + noise) & 0xff);
+                line[x * 4 + 2] = uchar(((x + y) / 16) & 0xff);
+                line[x * 4 + 3] = uchar(x % 512 < 256 ? 255 : (y & 0xff));
+            }
+        }
+    }
+    const QImage rgba = image.convertToFormat(QImage::Format_RGBA8888);
+    const double megaPixels = double(rgba.width()) * rgba.height() / 1e6;
+
+    // LiTextureUtil按图像是否有alpha选择格式，LiDXTCompressor使用同一格式比较
+    QSharedPointer<LiImageData> reference;
+    const qint64 utilNs = bestOf(3, [&]() {
+        reference = LiTextureUtil::compressImageDXT(image, false);
+    });
+    const LiDXTCompressor::Format format = reference && reference->textureFormat == QOpenGLTexture::RGBA_DXT5
+            ? LiDXTCompressor::DXT5 : LiDXTCompressor::DXT1;
+
+    QByteArray compressed(LiDXTCompressor::compressedSize(rgba.width(), rgba.height(), format), Qt::Uninitialized);
+    const quint8 *in = rgba.constBits();
+    quint8 *out = reinterpret_cast<quint8 *>(compressed.data());
+
+    LiDXTCompressor singleThread(nullptr);
+    const qint64 singleNs = bestOf(3, [&]() {
+        singleThread.compress(in, rgba.width(), rgba.height(), rgba.bytesPerLine(), format, out);
+    });
+
+    LiDXTCompressor pooled;
+    const qint64 pooledNs = bestOf(3, [&]() {
+        pooled.compress(in, rgba.width(), rgba.height(), rgba.bytesPerLine(), format, out);
+    });
+
+    qDebug() << "dxt compression:" << rgba.width() << "x" << rgba.height() << (format == LiDXTCompressor::DXT5 ? "DXT5" : "DXT1")
+             << "(MPixels/s)";
+    qDebug() << "  LiTextureUtil::compressImageDXT:" << megaPixels / (utilNs / 1e9)
+             << ", output bytes" << (reference ? reference->imageData.size() : 0);
+    qDebug() << "  LiDXTCompressor, 1 thread:      " << megaPixels / (singleNs / 1e9) << ", output bytes" << compressed.size();
+    qDebug() << "  LiDXTCompressor," << QThreadPool::globalInstance()->maxThreadCount() << "threads:   "
+             << megaPixels / (pooledNs / 1e9);
+}
@@ -0,0 +1,17 @@
+﻿#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QtCore>
+
+//////////////////////////////////////////////////////
+// 不依赖场景的性能测试，结果通过qDebug输出
+void benchmarkRequestQueue(const QString &recording = QString()); // 回放请求流，对比重建堆与分桶队列
+void benchmarkQuadtreeTraversal(const QString &recording = QString()); // 按相机位置遍历四叉树，对比串行与并行遍历
+void benchmarkCullingBatch(); // 1k/10k/100k个包围体，对比逐个裁切与批量裁切
+void benchmarkQuantizedMesh(); // 解码合成的quantized-mesh数据流，对比标量与SSE2实现并逐字节校验
+void benchmarkFlattenMasks(); // 100个压平多边形 x 1000个瓦片，对比QPainterPath::contains与网格索引，并随机校验包含结果
+void benchmarkTerrainPick(const QString &recording = QString()); // 回放拾取射线和高度查询，对比逐个三角形求交与TerrainMeshBVH
+void benchmarkDXTCompression(const QString &imagePath = QString()); // 压缩同一张图像，对比LiTextureUtil::compressImageDXT与LiDXTCompressor的吞吐量
+//////////////////////////////////////////////////////
+
+#endif // BENCHMARK_H
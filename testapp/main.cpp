@@ -67,6 +67,7 @@
 #include <transformhelper.h>
 
 #include "sample.h"
+#include "benchmark.h"
 
 int main(int argc, char *argv[])
 {
@@ -155,6 +156,13 @@ int main(int argc, char *argv[])
 //    loadWMS();
 //    loadPMTS();
 //    flattenTerrain();
+//    benchmarkRequestQueue();
+//    benchmarkQuadtreeTraversal();
+//    benchmarkCullingBatch();
+//    benchmarkQuantizedMesh();
+//    benchmarkFlattenMasks();
+//    benchmarkTerrainPick();
+//    benchmarkDXTCompression();
 
 //    auto *terrainProvider = qobject_cast<LiGlobeTerrainProvider*>(viewer.scene()->globe()->terrainProvider());
 //    if (terrainProvider)
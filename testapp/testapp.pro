@@ -29,7 +29,9 @@ INCLUDEPATH += $$PWD/../liextras
 
 SOURCES += \
     main.cpp \
-    sample.cpp
+    sample.cpp \
+    benchmark.cpp
 
 HEADERS += \
-    sample.h
+    sample.h \
+    benchmark.h